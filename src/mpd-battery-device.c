@@ -18,6 +18,9 @@
  * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <stdbool.h>
+
+#include <dbus/dbus-glib.h>
 #include <devkit-power-gobject/devicekit-power.h>
 #include <glib/gi18n.h>
 
@@ -30,6 +33,16 @@ G_DEFINE_TYPE (MpdBatteryDevice, mpd_battery_device, G_TYPE_OBJECT)
 #define GET_PRIVATE(o) \
   (G_TYPE_INSTANCE_GET_PRIVATE ((o), MPD_TYPE_BATTERY_DEVICE, MpdBatteryDevicePrivate))
 
+/*
+ * The daemon is talked to directly rather than through DkpClient, which
+ * only enumerates synchronously. At login that means waiting for the
+ * daemon to be activated, with the panel blocked meanwhile.
+ */
+#define DKP_SERVICE           "org.freedesktop.DeviceKit.Power"
+#define DKP_PATH              "/org/freedesktop/DeviceKit/Power"
+#define DKP_INTERFACE         "org.freedesktop.DeviceKit.Power"
+#define DKP_DEVICE_INTERFACE  "org.freedesktop.DeviceKit.Power.Device"
+
 enum
 {
   PROP_0,
@@ -40,12 +53,34 @@ enum
 
 typedef struct
 {
-  DkpClient             *client;
-  DkpDevice             *device;
+  DBusGConnection       *connection;
+  DBusGProxy            *proxy;
+  DBusGProxyCall        *enumerate_call;
+  GSList                *probes;          /* Probe, device properties pending */
+  GTimer                *timer;           /* Since enumeration started. */
+  double                 discovery_time;  /* In seconds, -1 while pending. */
+
+  /* Battery */
+  char                  *device_path;
+  DBusGProxy            *device_proxy;
+  double                 energy;
+  double                 energy_full;
+  DkpDeviceState         device_state;
+
   unsigned int           percentage;
   MpdBatteryDeviceState  state;
 } MpdBatteryDevicePrivate;
 
+/* Properties of a device being looked at, to find out whether it's a
+ * battery, or of the battery being refreshed. */
+typedef struct
+{
+  MpdBatteryDevice  *self;
+  char              *path;
+  DBusGProxy        *proxy;
+  DBusGProxyCall    *call;
+} Probe;
+
 static void
 mpd_battery_device_set_percentage (MpdBatteryDevice       *self,
                                    float                   percentage);
@@ -54,68 +89,217 @@ mpd_battery_device_set_state      (MpdBatteryDevice       *self,
                                    MpdBatteryDeviceState   state);
 
 static void
-_client_device_added_cb (DkpClient        *client,
-                         DkpDevice        *device,
-                         MpdBatteryDevice *self)
+update (MpdBatteryDevice *self)
+{
+  mpd_battery_device_set_percentage (self,
+                                     mpd_battery_device_get_percentage (self));
+  mpd_battery_device_set_state (self,
+                                mpd_battery_device_get_state (self));
+}
+
+static void
+discovery_done (MpdBatteryDevice *self)
+{
+  MpdBatteryDevicePrivate *priv = GET_PRIVATE (self);
+
+  if (priv->discovery_time >= 0)
+    return;
+
+  priv->discovery_time = g_timer_elapsed (priv->timer, NULL);
+  g_debug ("%s() waited %.1f ms for power devices",
+           __FUNCTION__, priv->discovery_time * 1000);
+}
+
+static void
+probe_free (Probe *probe)
+{
+  g_object_unref (probe->proxy);
+  g_free (probe->path);
+  g_free (probe);
+}
+
+static double
+get_double (GHashTable *properties,
+            char const *name)
+{
+  GValue *value = g_hash_table_lookup (properties, name);
+
+  return value && G_VALUE_HOLDS_DOUBLE (value) ? g_value_get_double (value) : 0;
+}
+
+static unsigned int
+get_uint (GHashTable *properties,
+          char const *name)
+{
+  GValue *value = g_hash_table_lookup (properties, name);
+
+  return value && G_VALUE_HOLDS_UINT (value) ? g_value_get_uint (value) : 0;
+}
+
+static void
+_get_all_cb (DBusGProxy     *proxy,
+             DBusGProxyCall *call,
+             Probe          *probe)
 {
+  MpdBatteryDevice        *self = probe->self;
   MpdBatteryDevicePrivate *priv = GET_PRIVATE (self);
-  DkpDeviceType device_type;
+  GHashTable  *properties = NULL;
+  GError      *error = NULL;
 
-  if (NULL == priv->device)
+  priv->probes = g_slist_remove (priv->probes, probe);
+
+  dbus_g_proxy_end_call (proxy, call, &error,
+                         dbus_g_type_get_map ("GHashTable",
+                                              G_TYPE_STRING,
+                                              G_TYPE_VALUE),
+                         &properties,
+                         G_TYPE_INVALID);
+  if (error)
   {
-    g_object_get (device,
-                  "type", &device_type,
-                  NULL);
+    g_warning ("%s : %s: %s", G_STRLOC, probe->path, error->message);
+    g_clear_error (&error);
+  } else if (DKP_DEVICE_TYPE_BATTERY == get_uint (properties, "Type") &&
+             (NULL == priv->device_path ||
+              0 == g_strcmp0 (probe->path, priv->device_path))) {
 
-    if (DKP_DEVICE_TYPE_BATTERY == device_type)
+    if (NULL == priv->device_path)
     {
-      priv->device = g_object_ref (device);
-
-      mpd_battery_device_set_percentage (self,
-                                         mpd_battery_device_get_percentage (self));
-      mpd_battery_device_set_state (self,
-                                    mpd_battery_device_get_state (self));
+      priv->device_path = g_strdup (probe->path);
+      priv->device_proxy = g_object_ref (probe->proxy);
     }
+
+    priv->energy = get_double (properties, "Energy");
+    priv->energy_full = get_double (properties, "EnergyFull");
+    priv->device_state = get_uint (properties, "State");
   }
+
+  if (properties)
+    g_hash_table_destroy (properties);
+
+  probe_free (probe);
+
+  /* Battery found, or none among the devices. */
+  if (priv->device_path ||
+      (NULL == priv->enumerate_call && NULL == priv->probes))
+    discovery_done (self);
+
+  update (self);
 }
 
 static void
-_client_device_removed_cb (DkpClient        *client,
-                           DkpDevice        *device,
-                           MpdBatteryDevice *self)
+probe (MpdBatteryDevice *self,
+       char const       *path)
 {
   MpdBatteryDevicePrivate *priv = GET_PRIVATE (self);
+  Probe *probe;
+
+  /* Refreshing the battery goes through its own proxy. */
+  probe = g_new0 (Probe, 1);
+  probe->self = self;
+  probe->path = g_strdup (path);
+  if (priv->device_path &&
+      0 == g_strcmp0 (path, priv->device_path))
+  {
+    probe->proxy = g_object_ref (priv->device_proxy);
+  } else {
+    probe->proxy = dbus_g_proxy_new_for_name (priv->connection,
+                                              DKP_SERVICE,
+                                              path,
+                                              DBUS_INTERFACE_PROPERTIES);
+  }
+
+  probe->call = dbus_g_proxy_begin_call (probe->proxy, "GetAll",
+                                         (DBusGProxyCallNotify) _get_all_cb,
+                                         probe, NULL,
+                                         G_TYPE_STRING, DKP_DEVICE_INTERFACE,
+                                         G_TYPE_INVALID);
+  priv->probes = g_slist_prepend (priv->probes, probe);
+}
 
-  if (priv->device &&
-      0 == g_strcmp0 (dkp_device_get_object_path (device),
-                      dkp_device_get_object_path (priv->device)))
+static void
+_enumerate_devices_cb (DBusGProxy       *proxy,
+                       DBusGProxyCall   *call,
+                       MpdBatteryDevice *self)
+{
+  MpdBatteryDevicePrivate *priv = GET_PRIVATE (self);
+  GPtrArray     *paths = NULL;
+  GError        *error = NULL;
+  unsigned int   i;
+
+  priv->enumerate_call = NULL;
+
+  dbus_g_proxy_end_call (proxy, call, &error,
+                         dbus_g_type_get_collection ("GPtrArray",
+                                                     DBUS_TYPE_G_OBJECT_PATH),
+                         &paths,
+                         G_TYPE_INVALID);
+  if (error)
   {
-    g_object_unref (priv->device);
-    priv->device = NULL;
+    g_warning ("%s : %s", G_STRLOC, error->message);
+    g_clear_error (&error);
+  }
 
-    mpd_battery_device_set_percentage (self, -1);
-    mpd_battery_device_set_state (self, MPD_BATTERY_DEVICE_STATE_MISSING);
+  for (i = 0; paths && i < paths->len; i++)
+  {
+    char *path = g_ptr_array_index (paths, i);
+    probe (self, path);
+    g_free (path);
+  }
+
+  if (paths)
+    g_ptr_array_free (paths, true);
+
+  /* No devices, or no daemon. */
+  if (NULL == priv->probes)
+  {
+    discovery_done (self);
+    update (self);
   }
 }
 
 static void
-_client_device_changed_cb (DkpClient        *client,
-                           DkpDevice        *device,
-                           MpdBatteryDevice *self)
+_device_added_cb (DBusGProxy        *proxy,
+                  char const        *path,
+                  MpdBatteryDevice  *self)
+{
+  MpdBatteryDevicePrivate *priv = GET_PRIVATE (self);
+
+  if (NULL == priv->device_path)
+    probe (self, path);
+}
+
+static void
+_device_removed_cb (DBusGProxy        *proxy,
+                    char const        *path,
+                    MpdBatteryDevice  *self)
 {
   MpdBatteryDevicePrivate *priv = GET_PRIVATE (self);
 
-  if (priv->device &&
-      0 == g_strcmp0 (dkp_device_get_object_path (device),
-                      dkp_device_get_object_path (priv->device)))
+  if (priv->device_path &&
+      0 == g_strcmp0 (path, priv->device_path))
   {
-    mpd_battery_device_set_percentage (self,
-                                       mpd_battery_device_get_percentage (self));
-    mpd_battery_device_set_state (self,
-                                  mpd_battery_device_get_state (self));
+    g_free (priv->device_path);
+    priv->device_path = NULL;
+    g_object_unref (priv->device_proxy);
+    priv->device_proxy = NULL;
+
+    mpd_battery_device_set_percentage (self, -1);
+    mpd_battery_device_set_state (self, MPD_BATTERY_DEVICE_STATE_MISSING);
   }
 }
 
+static void
+_device_changed_cb (DBusGProxy        *proxy,
+                    char const        *path,
+                    MpdBatteryDevice  *self)
+{
+  MpdBatteryDevicePrivate *priv = GET_PRIVATE (self);
+
+  if (priv->device_path &&
+      0 == g_strcmp0 (path, priv->device_path))
+    probe (self, path);
+}
+
 static GObject *
 _constructor (GType                  type,
               unsigned int           n_properties,
@@ -123,9 +307,6 @@ _constructor (GType                  type,
 {
   static MpdBatteryDevice *self = NULL;
   MpdBatteryDevicePrivate *priv = NULL;
-  GPtrArray     *devices;
-  GError        *error = NULL;
-  unsigned int   i;
 
   /* This is a singleton */
 
@@ -138,40 +319,18 @@ _constructor (GType                  type,
                   G_OBJECT_CLASS (mpd_battery_device_parent_class)
                     ->constructor (type, n_properties, properties);
   priv = GET_PRIVATE (self);
-  g_return_val_if_fail (priv->client, NULL);
+  g_return_val_if_fail (priv->proxy, NULL);
   g_object_add_weak_pointer ((GObject *) self, (gpointer) &self);
 
-  /* Look up battery device. */
-
-  devices = dkp_client_enumerate_devices (priv->client, &error);
-  if (error)
-  {
-    g_critical ("%s : %s", G_STRLOC, error->message);
-    g_clear_error (&error);
-    g_object_unref (self);
-    return NULL;
-  }
-
-  for (i = 0; i < devices->len; i++)
-  {
-    DkpDevice *device = g_ptr_array_index (devices, i);
-    DkpDeviceType device_type;
-    g_object_get (device,
-                  "type", &device_type,
-                  NULL);
-
-    if (DKP_DEVICE_TYPE_BATTERY == device_type)
-      priv->device = g_object_ref (device);
-  }
-
-  g_ptr_array_unref (devices);
+  /* Look up battery device, the state is unknown until the answer
+   * arrives. */
 
-  /* Set initial properties. */
-
-  mpd_battery_device_set_percentage (self,
-                                      mpd_battery_device_get_percentage (self));
-  mpd_battery_device_set_state (self,
-                                mpd_battery_device_get_state (self));
+  priv->timer = g_timer_new ();
+  priv->enumerate_call = dbus_g_proxy_begin_call (
+                                priv->proxy, "EnumerateDevices",
+                                (DBusGProxyCallNotify) _enumerate_devices_cb,
+                                self, NULL,
+                                G_TYPE_INVALID);
 
   return (GObject *) self;
 }
@@ -217,7 +376,45 @@ _dispose (GObject *object)
 {
   MpdBatteryDevicePrivate *priv = GET_PRIVATE (object);
 
-  mpd_gobject_detach (object, (GObject **) &priv->client);
+  if (priv->enumerate_call)
+  {
+    dbus_g_proxy_cancel_call (priv->proxy, priv->enumerate_call);
+    priv->enumerate_call = NULL;
+  }
+
+  while (priv->probes)
+  {
+    Probe *probe = priv->probes->data;
+    dbus_g_proxy_cancel_call (probe->proxy, probe->call);
+    priv->probes = g_slist_delete_link (priv->probes, priv->probes);
+    probe_free (probe);
+  }
+
+  if (priv->device_proxy)
+  {
+    g_object_unref (priv->device_proxy);
+    priv->device_proxy = NULL;
+  }
+
+  if (priv->device_path)
+  {
+    g_free (priv->device_path);
+    priv->device_path = NULL;
+  }
+
+  if (priv->timer)
+  {
+    g_timer_destroy (priv->timer);
+    priv->timer = NULL;
+  }
+
+  mpd_gobject_detach (object, (GObject **) &priv->proxy);
+
+  if (priv->connection)
+  {
+    dbus_g_connection_unref (priv->connection);
+    priv->connection = NULL;
+  }
 
   G_OBJECT_CLASS (mpd_battery_device_parent_class)->dispose (object);
 }
@@ -261,14 +458,35 @@ static void
 mpd_battery_device_init (MpdBatteryDevice *self)
 {
   MpdBatteryDevicePrivate *priv = GET_PRIVATE (self);
+  GError *error = NULL;
+
+  priv->discovery_time = -1;
 
-  priv->client = dkp_client_new ();
-  g_signal_connect (priv->client, "device-added",
-                    G_CALLBACK (_client_device_added_cb), self);
-  g_signal_connect (priv->client, "device-removed",
-                    G_CALLBACK (_client_device_removed_cb), self);
-  g_signal_connect (priv->client, "device-changed",
-                    G_CALLBACK (_client_device_changed_cb), self);
+  priv->connection = dbus_g_bus_get (DBUS_BUS_SYSTEM, &error);
+  if (error)
+  {
+    g_critical ("%s : %s", G_STRLOC, error->message);
+    g_clear_error (&error);
+    return;
+  }
+
+  priv->proxy = dbus_g_proxy_new_for_name (priv->connection,
+                                           DKP_SERVICE,
+                                           DKP_PATH,
+                                           DKP_INTERFACE);
+
+  dbus_g_proxy_add_signal (priv->proxy, "DeviceAdded",
+                           G_TYPE_STRING, G_TYPE_INVALID);
+  dbus_g_proxy_add_signal (priv->proxy, "DeviceRemoved",
+                           G_TYPE_STRING, G_TYPE_INVALID);
+  dbus_g_proxy_add_signal (priv->proxy, "DeviceChanged",
+                           G_TYPE_STRING, G_TYPE_INVALID);
+  dbus_g_proxy_connect_signal (priv->proxy, "DeviceAdded",
+                               G_CALLBACK (_device_added_cb), self, NULL);
+  dbus_g_proxy_connect_signal (priv->proxy, "DeviceRemoved",
+                               G_CALLBACK (_device_removed_cb), self, NULL);
+  dbus_g_proxy_connect_signal (priv->proxy, "DeviceChanged",
+                               G_CALLBACK (_device_changed_cb), self, NULL);
 }
 
 MpdBatteryDevice *
@@ -281,21 +499,15 @@ float
 mpd_battery_device_get_percentage (MpdBatteryDevice *self)
 {
   MpdBatteryDevicePrivate *priv = GET_PRIVATE (self);
-  double energy;
-  double energy_full;
 
   g_return_val_if_fail (MPD_IS_BATTERY_DEVICE (self), -1.);
 
   /* Have battery? */
-  if (NULL == priv->device)
+  if (NULL == priv->device_path ||
+      priv->energy_full <= 0)
     return -1.;
 
-  g_object_get (priv->device,
-                "energy", &energy,
-                "energy-full", &energy_full,
-                NULL);
-
-  return (float ) (energy / energy_full * 100);
+  return (float ) (priv->energy / priv->energy_full * 100);
 }
 
 static void
@@ -319,21 +531,20 @@ mpd_battery_device_get_state (MpdBatteryDevice *self)
 {
   MpdBatteryDevicePrivate *priv = GET_PRIVATE (self);
   MpdBatteryDeviceState state;
-  DkpDeviceState        device_state;
 
   g_return_val_if_fail (MPD_IS_BATTERY_DEVICE (self),
                         MPD_BATTERY_DEVICE_STATE_UNKNOWN);
 
-  if (NULL == priv->device)
+  if (NULL == priv->device_path)
   {
+    /* Don't know yet. */
+    if (priv->discovery_time < 0)
+      return MPD_BATTERY_DEVICE_STATE_UNKNOWN;
+
     return MPD_BATTERY_DEVICE_STATE_MISSING;
   }
 
-  g_object_get (priv->device,
-                "state", &device_state,
-                NULL);
-
-  switch (device_state)
+  switch (priv->device_state)
   {
   case DKP_DEVICE_STATE_CHARGING:
     state = MPD_BATTERY_DEVICE_STATE_CHARGING;
@@ -375,6 +586,13 @@ mpd_battery_device_get_state_text (MpdBatteryDevice *self)
 
   g_return_val_if_fail (MPD_IS_BATTERY_DEVICE (self), NULL);
 
+  /* Still enumerating. */
+  if (MPD_BATTERY_DEVICE_STATE_UNKNOWN == priv->state &&
+      priv->discovery_time < 0)
+  {
+    return g_strdup (_("Looking for your battery ..."));
+  }
+
   switch (priv->state)
   {
   case MPD_BATTERY_DEVICE_STATE_MISSING:
@@ -407,16 +625,22 @@ void
 mpd_battery_device_dump (MpdBatteryDevice *self)
 {
   MpdBatteryDevicePrivate *priv = GET_PRIVATE (self);
-  double energy;
-  double energy_full;
 
   g_return_if_fail (MPD_IS_BATTERY_DEVICE (self));
 
-  g_object_get (priv->device,
-                "energy", &energy,
-                "energy-full", &energy_full,
-                NULL);
-
-  g_debug ("energy: %.2f, full: %.2f", energy, energy_full);
+  g_debug ("energy: %.2f, full: %.2f", priv->energy, priv->energy_full);
 }
 
+/*
+ * How long it took to find the battery or to learn there is none, -1
+ * while still looking. Only an answer from the power daemon ends the wait.
+ */
+double
+mpd_battery_device_get_discovery_time (MpdBatteryDevice *self)
+{
+  MpdBatteryDevicePrivate *priv = GET_PRIVATE (self);
+
+  g_return_val_if_fail (MPD_IS_BATTERY_DEVICE (self), -1);
+
+  return priv->discovery_time;
+}
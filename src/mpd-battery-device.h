@@ -80,6 +80,9 @@ mpd_battery_device_get_state_text (MpdBatteryDevice *self);
 void
 mpd_battery_device_dump (MpdBatteryDevice *self);
 
+double
+mpd_battery_device_get_discovery_time (MpdBatteryDevice *self);
+
 G_END_DECLS
 
 #endif /* _MPD_BATTERY_DEVICE */
@@ -0,0 +1,77 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "mpd-block-stat.h"
+#include "config.h"
+
+/*
+ * Returns the stat file for `path', NULL if it is not on a block device,
+ * like network shares.
+ */
+char *
+mpd_block_stat_get_path (char const *path)
+{
+  MpdBlockStat   stat_data;
+  struct stat    st;
+  char          *stat_path;
+
+  g_return_val_if_fail (path, NULL);
+
+  if (0 != stat (path, &st))
+    return NULL;
+
+  stat_path = g_strdup_printf ("/sys/dev/block/%u:%u/stat",
+                               major (st.st_dev), minor (st.st_dev));
+  if (!mpd_block_stat_read (stat_path, &stat_data))
+  {
+    g_free (stat_path);
+    return NULL;
+  }
+
+  return stat_path;
+}
+
+bool
+mpd_block_stat_read (char const   *stat_path,
+                     MpdBlockStat *stat_data)
+{
+  char  *contents = NULL;
+  bool   ret;
+
+  g_return_val_if_fail (stat_path, false);
+  g_return_val_if_fail (stat_data, false);
+
+  if (!g_file_get_contents (stat_path, &contents, NULL, NULL))
+    return false;
+
+  /* reads merges sectors ticks, writes merges sectors ticks, in flight */
+  ret = 3 == sscanf (contents,
+                     "%*u %*u %" SCNu64 " %*u %*u %*u %" SCNu64 " %*u %u",
+                     &stat_data->read_sectors,
+                     &stat_data->write_sectors,
+                     &stat_data->in_flight);
+  g_free (contents);
+  return ret;
+}
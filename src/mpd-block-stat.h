@@ -0,0 +1,55 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPD_BLOCK_STAT_H
+#define MPD_BLOCK_STAT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Counters of the block device a path is on, from its
+ * /sys/dev/block/<major>:<minor>/stat. Reading it is a plain memory read,
+ * cheap enough for the main loop.
+ */
+
+/* Sector counts are in these units, whatever the device's sector size. */
+#define MPD_BLOCK_STAT_SECTOR_SIZE 512
+
+typedef struct
+{
+  uint64_t      read_sectors;
+  uint64_t      write_sectors;
+  unsigned int  in_flight;
+} MpdBlockStat;
+
+char *
+mpd_block_stat_get_path (char const *path);
+
+bool
+mpd_block_stat_read (char const   *stat_path,
+                     MpdBlockStat *stat);
+
+G_END_DECLS
+
+#endif /* MPD_BLOCK_STAT_H */
@@ -0,0 +1,467 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ * Copyright © David Zeuthen <davidz@redhat.com>
+ * Copyright © Michael Natterer
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gio/gdesktopappinfo.h>
+
+#include "mpd-busy-processes.h"
+#include "config.h"
+
+/*
+ * Every process is looked at, a process is busy on the mount when its
+ * working directory, executable or any open file is below the mount
+ * point. PIDs handed in by the mount operation are taken as they are.
+ *
+ * Names come from the desktop file an application was launched from,
+ * or the command name. They're cached by PID and start time, so a reused
+ * PID isn't taken for the process before, and by desktop file.
+ */
+
+#define MAX_CACHED_PIDS 512
+
+typedef struct
+{
+  uint64_t   start_time;
+  char      *name;
+} CachedName;
+
+typedef struct
+{
+  char    *path;
+  GArray  *pids;
+  GPtrArray *names;
+} FindData;
+
+G_LOCK_DEFINE_STATIC (cache);
+static GHashTable *_pid_names = NULL;       /* key=pid, value=CachedName */
+static GHashTable *_desktop_names = NULL;   /* key=desktop file, value=name */
+
+static void
+cached_name_free (CachedName *cached)
+{
+  g_free (cached->name);
+  g_free (cached);
+}
+
+/* Copied from gtk+'s gtk/gtkmountoperation-x11.c (LGPLv2)
+ * (hence David Zeuthen and Michael Natterer added as copyright
+ *  holders).
+ */
+static gchar *
+pid_get_env (GPid         pid,
+             const gchar *key)
+{
+  gchar *ret;
+  gchar *env_filename;
+  gchar *env;
+  gsize env_len;
+  gsize key_len;
+  gchar *end;
+
+  ret = NULL;
+
+  key_len = strlen (key);
+
+  env_filename = g_strdup_printf ("/proc/%d/environ", pid);
+  if (g_file_get_contents (env_filename,
+                           &env,
+                           &env_len,
+                           NULL))
+    {
+      guint n;
+
+      /* /proc/<pid>/environ in Linux is split at '\0' points, g_strsplit() can't handle that... */
+      n = 0;
+      while (TRUE)
+        {
+          if (env[n] == '\0' || n >= env_len)
+            break;
+
+          if (g_str_has_prefix (env + n, key) && (*(env + n + key_len) == '='))
+            {
+              ret = g_strdup (env + n + key_len + 1);
+
+              /* skip invalid UTF-8 */
+              if (!g_utf8_validate (ret, -1, (const gchar **) &end))
+                *end = '\0';
+              break;
+            }
+
+          for (; env[n] != '\0' && n < env_len; n++)
+            ;
+          n++;
+        }
+      g_free (env);
+    }
+  g_free (env_filename);
+
+  return ret;
+}
+
+/*
+ * Ticks since boot the process started at, 0 if it's gone.
+ */
+static uint64_t
+get_start_time (GPid pid)
+{
+  char      *stat_path;
+  char      *contents = NULL;
+  char      *p;
+  uint64_t   start_time = 0;
+
+  stat_path = g_strdup_printf ("/proc/%d/stat", pid);
+  if (g_file_get_contents (stat_path, &contents, NULL, NULL))
+  {
+    /* The command name may contain anything, fields resume after it. */
+    p = strrchr (contents, ')');
+    if (p &&
+        1 != sscanf (p + 1,
+                     " %*c %*d %*d %*d %*d %*d %*u"
+                     " %*u %*u %*u %*u %*u %*u"
+                     " %*d %*d %*d %*d %*d %*d %" SCNu64,
+                     &start_time))
+      start_time = 0;
+    g_free (contents);
+  }
+  g_free (stat_path);
+
+  return start_time;
+}
+
+static char *
+get_command_name (GPid pid)
+{
+  char *comm_path;
+  char *name = NULL;
+
+  comm_path = g_strdup_printf ("/proc/%d/comm", pid);
+  if (g_file_get_contents (comm_path, &name, NULL, NULL))
+    g_strchomp (name);
+  g_free (comm_path);
+
+  return name;
+}
+
+/*
+ * Called with the cache locked.
+ */
+static char *
+lookup_desktop_name (char const *desktop_file)
+{
+  GDesktopAppInfo *app_info;
+  char            *name;
+
+  name = g_hash_table_lookup (_desktop_names, desktop_file);
+  if (name)
+    return g_strdup (name);
+
+  app_info = g_desktop_app_info_new_from_filename (desktop_file);
+  if (NULL == app_info)
+    return NULL;
+
+  name = g_strdup (g_app_info_get_name (G_APP_INFO (app_info)));
+  g_object_unref (app_info);
+
+  if (name)
+    g_hash_table_insert (_desktop_names,
+                         g_strdup (desktop_file), g_strdup (name));
+
+  return name;
+}
+
+static char *
+get_name_for_pid (GPid pid)
+{
+  CachedName  *cached;
+  uint64_t     start_time;
+  char        *desktop_file;
+  char        *name = NULL;
+
+  start_time = get_start_time (pid);
+  if (0 == start_time)
+    return NULL;
+
+  G_LOCK (cache);
+
+  if (NULL == _pid_names)
+  {
+    _pid_names = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+                                        (GDestroyNotify) cached_name_free);
+    _desktop_names = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                            g_free, g_free);
+  }
+
+  cached = g_hash_table_lookup (_pid_names, GINT_TO_POINTER (pid));
+  if (cached && cached->start_time == start_time)
+  {
+    name = g_strdup (cached->name);
+    G_UNLOCK (cache);
+    return name;
+  }
+
+  desktop_file = pid_get_env (pid, "GIO_LAUNCHED_DESKTOP_FILE");
+  if (desktop_file)
+  {
+    name = lookup_desktop_name (desktop_file);
+    g_free (desktop_file);
+  }
+
+  if (NULL == name)
+    name = get_command_name (pid);
+
+  if (name)
+  {
+    if (g_hash_table_size (_pid_names) >= MAX_CACHED_PIDS)
+      g_hash_table_remove_all (_pid_names);
+
+    cached = g_new0 (CachedName, 1);
+    cached->start_time = start_time;
+    cached->name = g_strdup (name);
+    g_hash_table_insert (_pid_names, GINT_TO_POINTER (pid), cached);
+  }
+
+  G_UNLOCK (cache);
+
+  return name;
+}
+
+static bool
+link_is_below (char const *link_path,
+               char const *path,
+               size_t      path_len)
+{
+  char    target[PATH_MAX];
+  ssize_t len;
+
+  len = readlink (link_path, target, sizeof (target) - 1);
+  if (len < 0 || (size_t) len < path_len)
+    return false;
+  target[len] = '\0';
+
+  return 0 == strncmp (target, path, path_len) &&
+         (target[path_len] == '\0' || target[path_len] == '/');
+}
+
+/*
+ * Processes of other users are not accessible, they're skipped.
+ */
+static bool
+is_busy (char const *proc_dir,
+         char const *path,
+         size_t      path_len)
+{
+  char const  *links[] = { "cwd", "exe", "root" };
+  char        *link_path;
+  char        *fd_path;
+  GDir        *dir;
+  char const  *name;
+  bool         busy = false;
+
+  for (unsigned int i = 0; i < G_N_ELEMENTS (links) && !busy; i++)
+  {
+    link_path = g_build_filename (proc_dir, links[i], NULL);
+    busy = link_is_below (link_path, path, path_len);
+    g_free (link_path);
+  }
+
+  if (busy)
+    return true;
+
+  fd_path = g_build_filename (proc_dir, "fd", NULL);
+  dir = g_dir_open (fd_path, 0, NULL);
+  if (dir)
+  {
+    while (!busy && NULL != (name = g_dir_read_name (dir)))
+    {
+      link_path = g_build_filename (fd_path, name, NULL);
+      busy = link_is_below (link_path, path, path_len);
+      g_free (link_path);
+    }
+    g_dir_close (dir);
+  }
+  g_free (fd_path);
+
+  return busy;
+}
+
+static void
+add_pid (GHashTable *names,
+         GPid        pid)
+{
+  char *name = get_name_for_pid (pid);
+
+  if (name)
+    g_hash_table_insert (names, name, NULL);
+}
+
+static int
+_compare_names (char const **a,
+                char const **b)
+{
+  return g_utf8_collate (*a, *b);
+}
+
+static void
+_find_thread_cb (GSimpleAsyncResult *result,
+                 GObject            *object,
+                 GCancellable       *cancellable)
+{
+  FindData        *data = g_simple_async_result_get_op_res_gpointer (result);
+  GHashTable      *names;
+  GHashTableIter   iter;
+  char            *name;
+  GDir            *proc;
+  char const      *entry;
+  size_t           path_len;
+  GPid             self_pid = getpid ();
+  GError          *error = NULL;
+
+  names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  path_len = strlen (data->path);
+
+  for (unsigned int i = 0; data->pids && i < data->pids->len; i++)
+    add_pid (names, g_array_index (data->pids, GPid, i));
+
+  proc = g_dir_open ("/proc", 0, &error);
+  if (error)
+  {
+    g_warning ("%s : %s", G_STRLOC, error->message);
+    g_clear_error (&error);
+  }
+
+  while (proc &&
+         NULL != (entry = g_dir_read_name (proc)) &&
+         !g_cancellable_is_cancelled (cancellable))
+  {
+    char  *proc_dir;
+    char  *end;
+    GPid   pid;
+
+    pid = strtol (entry, &end, 10);
+    if (*end != '\0' || pid <= 0 || pid == self_pid)
+      continue;
+
+    proc_dir = g_build_filename ("/proc", entry, NULL);
+    if (is_busy (proc_dir, data->path, path_len))
+      add_pid (names, pid);
+    g_free (proc_dir);
+  }
+
+  if (proc)
+    g_dir_close (proc);
+
+  data->names = g_ptr_array_new_with_free_func (g_free);
+  g_hash_table_iter_init (&iter, names);
+  while (g_hash_table_iter_next (&iter, (void **) &name, NULL))
+  {
+    g_hash_table_iter_steal (&iter);
+    g_ptr_array_add (data->names, name);
+  }
+  g_ptr_array_sort (data->names, (GCompareFunc) _compare_names);
+  g_hash_table_destroy (names);
+
+  g_cancellable_set_error_if_cancelled (cancellable, &error);
+  if (error)
+  {
+    g_simple_async_result_set_from_error (result, error);
+    g_clear_error (&error);
+  }
+}
+
+static void
+find_data_free (FindData *data)
+{
+  if (data->names)
+    g_ptr_array_unref (data->names);
+  if (data->pids)
+    g_array_free (data->pids, true);
+  g_free (data->path);
+  g_free (data);
+}
+
+/*
+ * Look for processes using files below `path'. `pids' are known to keep
+ * it busy already, e.g. from GMountOperation::show-processes.
+ */
+void
+mpd_busy_processes_find_async (char const           *path,
+                               GArray const         *pids,
+                               GCancellable         *cancellable,
+                               GAsyncReadyCallback   callback,
+                               void                 *data)
+{
+  GSimpleAsyncResult  *result;
+  FindData            *find_data;
+
+  g_return_if_fail (path);
+
+  find_data = g_new0 (FindData, 1);
+  find_data->path = g_strdup (path);
+  if (pids && pids->len)
+  {
+    find_data->pids = g_array_sized_new (false, false, sizeof (GPid),
+                                         pids->len);
+    g_array_append_vals (find_data->pids, pids->data, pids->len);
+  }
+
+  result = g_simple_async_result_new (NULL, callback, data,
+                                      mpd_busy_processes_find_async);
+  g_simple_async_result_set_op_res_gpointer (result, find_data,
+                                             (GDestroyNotify) find_data_free);
+  g_simple_async_result_run_in_thread (result,
+                                       (GSimpleAsyncThreadFunc)
+                                         _find_thread_cb,
+                                       G_PRIORITY_DEFAULT,
+                                       cancellable);
+  g_object_unref (result);
+}
+
+/*
+ * Returns the sorted names of the applications found, without duplicates.
+ * Free with g_ptr_array_unref().
+ */
+GPtrArray *
+mpd_busy_processes_find_finish (GAsyncResult  *result,
+                                GError       **error)
+{
+  GSimpleAsyncResult  *simple = (GSimpleAsyncResult *) result;
+  FindData            *data;
+
+  g_return_val_if_fail (g_simple_async_result_is_valid (result, NULL,
+                                          mpd_busy_processes_find_async),
+                        NULL);
+
+  if (g_simple_async_result_propagate_error (simple, error))
+    return NULL;
+
+  data = g_simple_async_result_get_op_res_gpointer (simple);
+  return g_ptr_array_ref (data->names);
+}
+
@@ -0,0 +1,46 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPD_BUSY_PROCESSES_H
+#define MPD_BUSY_PROCESSES_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Finds the applications keeping a mount busy, on a worker thread.
+ */
+
+void
+mpd_busy_processes_find_async (char const           *path,
+                               GArray const         *pids,
+                               GCancellable         *cancellable,
+                               GAsyncReadyCallback   callback,
+                               void                 *data);
+
+GPtrArray *
+mpd_busy_processes_find_finish (GAsyncResult  *result,
+                                GError       **error);
+
+G_END_DECLS
+
+#endif /* MPD_BUSY_PROCESSES_H */
+
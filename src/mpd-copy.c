@@ -0,0 +1,737 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* sync_file_range() */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.h"
+
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#endif
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
+
+#include "mpd-copy.h"
+#include "mpd-media-hash.h"
+
+/*
+ * Copies are tried in order of decreasing cost saving:
+ * reflink shares the blocks on copy-on-write file systems, copy_file_range
+ * and sendfile move the data within the kernel, and the read/write loop is
+ * the fallback. No fsync per file, the importer syncs the file system once
+ * at the end.
+ *
+ * Low impact copies keep a large import from pushing the desktop's working
+ * set out of memory: the copy thread drops to the lowest best-effort I/O
+ * priority, writeback is started every WRITEBACK_WINDOW bytes, and once
+ * a window is on disk its pages are dropped from the cache, for source
+ * and target. At most about two windows per copy are dirty at any time.
+ * Targets that are read again next, like images to be thumbnailed, stay
+ * cached.
+ *
+ * Verified copies hash the source data as it passes through the buffer,
+ * then read the target back once, from disk rather than the page cache.
+ * That waits for the target's writeback but is no fsync either, the
+ * cost is reading every file twice.
+ * Only reflinks and copy_file_range() within one file system are trusted
+ * and not read back, there the file system clones or copies the blocks
+ * itself. Between devices the kernel falls back to a splice through the
+ * page cache that nothing checks, so that and sendfile() are skipped for
+ * the buffered copy.
+ * Independent of that, the amount copied must match the size from the
+ * scan, which catches sources truncated by flaky card readers.
+ */
+
+#define COPY_CHUNK_SIZE   (8 << 20)
+#define BUFFER_SIZE       (1 << 20)
+#define BUFFER_ALIGN      4096
+#define READAHEAD_SIZE    (8 << 20)
+#define WRITEBACK_WINDOW  (8 << 20)
+
+/* From linux/ioprio.h, which is not exported to userspace. */
+#define IOPRIO_CLASS_SHIFT      13
+#define IOPRIO_CLASS_BE         2
+#define IOPRIO_WHO_PROCESS      1
+#define IOPRIO_LOW_IMPACT       ((IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | 7)
+
+#ifndef FICLONE
+#define FICLONE _IOW (0x94, 9, int)
+#endif
+
+typedef struct
+{
+  char *source_path;
+  char *target_path;
+  char *readahead_path;
+  uint64_t      size;
+  int volatile *copied_kib;
+  MpdCopyFlags  flags;
+
+  /* Verify only, hash of the source data read into the buffer. */
+  MpdMediaHash  hash;
+  bool          hashed;
+  bool          same_device;
+
+  /* Low impact only, the target is on disk and dropped up to `dropped',
+   * writeback was started up to `flushed'. */
+  off_t         flushed;
+  off_t         dropped;
+} CopyData;
+
+/*
+ * Start writing back the latest window, then wait for the one before and
+ * drop both files' pages up to there. Done once per window.
+ */
+static void
+write_back (CopyData *data,
+            int       in,
+            int       out,
+            off_t     copied)
+{
+  if (!(data->flags & MPD_COPY_FLAGS_LOW_IMPACT) ||
+      copied - data->flushed < WRITEBACK_WINDOW)
+    return;
+
+#ifdef HAVE_SYNC_FILE_RANGE
+  sync_file_range (out, data->flushed, copied - data->flushed,
+                   SYNC_FILE_RANGE_WRITE);
+  if (data->flushed > data->dropped)
+  {
+    sync_file_range (out, data->dropped, data->flushed - data->dropped,
+                     SYNC_FILE_RANGE_WAIT_BEFORE |
+                     SYNC_FILE_RANGE_WRITE |
+                     SYNC_FILE_RANGE_WAIT_AFTER);
+#ifdef HAVE_POSIX_FADVISE
+    if (!(data->flags & MPD_COPY_FLAGS_KEEP_CACHED))
+      posix_fadvise (out, data->dropped, data->flushed - data->dropped,
+                     POSIX_FADV_DONTNEED);
+#endif
+    data->dropped = data->flushed;
+  }
+#endif
+
+#ifdef HAVE_POSIX_FADVISE
+  /* Source pages are clean, they can go right away. */
+  posix_fadvise (in, data->flushed, copied - data->flushed,
+                 POSIX_FADV_DONTNEED);
+#endif
+
+  data->flushed = copied;
+}
+
+/* Writeback of the tail is started, the importer syncs at the end. */
+static void
+write_back_finish (CopyData *data,
+                   int       in,
+                   int       out)
+{
+  if (!(data->flags & MPD_COPY_FLAGS_LOW_IMPACT))
+    return;
+
+#ifdef HAVE_SYNC_FILE_RANGE
+  sync_file_range (out, data->flushed, 0, SYNC_FILE_RANGE_WRITE);
+#endif
+#ifdef HAVE_POSIX_FADVISE
+  posix_fadvise (in, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+}
+
+static int
+set_io_priority (int priority)
+{
+#if defined (__NR_ioprio_set)
+  return syscall (__NR_ioprio_set, IOPRIO_WHO_PROCESS, 0, priority);
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+static int
+get_io_priority (void)
+{
+#if defined (__NR_ioprio_get)
+  return syscall (__NR_ioprio_get, IOPRIO_WHO_PROCESS, 0);
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+static void
+report_copied (CopyData *data,
+               off_t     copied)
+{
+  if (data->copied_kib)
+    g_atomic_int_set (data->copied_kib, (int) (copied >> 10));
+}
+
+static void
+copy_data_free (CopyData *data)
+{
+  g_free (data->source_path);
+  g_free (data->target_path);
+  g_free (data->readahead_path);
+  g_free (data);
+}
+
+GQuark
+mpd_copy_error_quark (void)
+{
+  static GQuark _quark = 0;
+  if (!_quark)
+    _quark = g_quark_from_static_string ("mpd-copy-error");
+  return _quark;
+}
+
+static void
+set_error_from_errno (GError      **error,
+                      int           errsv,
+                      char const   *path)
+{
+  g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+               "%s: %s", path, g_strerror (errsv));
+}
+
+static bool
+is_unsupported (int errsv)
+{
+  return errsv == ENOSYS ||
+         errsv == EINVAL ||
+         errsv == EXDEV ||
+         errsv == EOPNOTSUPP ||
+         errsv == ENOTTY ||
+         errsv == EBADF;
+}
+
+static void
+readahead_file (char const *path)
+{
+#ifdef HAVE_POSIX_FADVISE
+  int fd;
+
+  fd = open (path, O_RDONLY);
+  if (fd < 0)
+    return;
+
+  posix_fadvise (fd, 0, READAHEAD_SIZE, POSIX_FADV_WILLNEED);
+  close (fd);
+#endif
+}
+
+/*
+ * Returns 1 when done, 0 if the kernel can't copy between these files and
+ * nothing was written yet, -1 on error.
+ */
+static int
+copy_in_kernel (int            in,
+                int            out,
+                CopyData      *data,
+                GCancellable  *cancellable,
+                GError       **error)
+{
+  off_t     copied = 0;
+  ssize_t   n;
+  int       errsv;
+  bool      use_sendfile = false;
+
+#if !defined (__NR_copy_file_range)
+  if (data->flags & MPD_COPY_FLAGS_VERIFY)
+    return 0;
+  use_sendfile = true;
+#endif
+
+  /* Only trusted within the file system, see above. */
+  if ((data->flags & MPD_COPY_FLAGS_VERIFY) &&
+      !data->same_device)
+    return 0;
+
+  for (;;)
+  {
+    if (g_cancellable_set_error_if_cancelled (cancellable, error))
+      return -1;
+
+    n = -1;
+    errno = ENOSYS;
+#if defined (__NR_copy_file_range)
+    if (!use_sendfile)
+      n = syscall (__NR_copy_file_range, in, NULL, out, NULL,
+                   (size_t) COPY_CHUNK_SIZE, 0);
+#endif
+#ifdef HAVE_SYS_SENDFILE_H
+    if (use_sendfile)
+      n = sendfile (out, in, NULL, COPY_CHUNK_SIZE);
+#endif
+
+    if (n > 0)
+    {
+      copied += n;
+      report_copied (data, copied);
+      write_back (data, in, out, copied);
+      continue;
+    }
+
+    if (0 == n)
+      return 1;
+
+    errsv = errno;
+    if (errsv == EINTR)
+      continue;
+
+    if (0 == copied &&
+        is_unsupported (errsv))
+    {
+      if (use_sendfile ||
+          (data->flags & MPD_COPY_FLAGS_VERIFY))
+        return 0;
+      use_sendfile = true;
+      continue;
+    }
+
+    set_error_from_errno (error, errsv, data->source_path);
+    return -1;
+  }
+}
+
+static bool
+copy_buffered (int             in,
+               int             out,
+               CopyData       *data,
+               GCancellable   *cancellable,
+               GError        **error)
+{
+  char    *buffer = NULL;
+  ssize_t  n_read;
+  off_t    copied = 0;
+  bool     ret = false;
+
+  if (0 != posix_memalign ((void **) &buffer, BUFFER_ALIGN, BUFFER_SIZE))
+  {
+    set_error_from_errno (error, ENOMEM, data->source_path);
+    return false;
+  }
+
+  for (;;)
+  {
+    ssize_t n_written = 0;
+
+    if (g_cancellable_set_error_if_cancelled (cancellable, error))
+      break;
+
+    n_read = read (in, buffer, BUFFER_SIZE);
+    if (n_read < 0 && errno == EINTR)
+      continue;
+    if (n_read < 0)
+    {
+      set_error_from_errno (error, errno, data->source_path);
+      break;
+    }
+    if (0 == n_read)
+    {
+      ret = true;
+      break;
+    }
+
+    if (data->flags & MPD_COPY_FLAGS_VERIFY)
+    {
+      mpd_media_hash_update (&data->hash, buffer, n_read);
+      data->hashed = true;
+    }
+
+    while (n_written < n_read)
+    {
+      ssize_t n = write (out, buffer + n_written, n_read - n_written);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+      {
+        set_error_from_errno (error, errno, data->target_path);
+        goto bail;
+      }
+      n_written += n;
+    }
+
+    copied += n_written;
+    report_copied (data, copied);
+    write_back (data, in, out, copied);
+  }
+
+bail:
+  free (buffer);
+  return ret;
+}
+
+static void
+set_mismatch_error (GError      **error,
+                    CopyData     *data,
+                    char const   *reason)
+{
+  g_set_error (error, MPD_COPY_ERROR, MPD_COPY_ERROR_MISMATCH,
+               "%s: %s", data->source_path, reason);
+}
+
+/* Hash the target as it is on disk. */
+static bool
+hash_target (CopyData      *data,
+             int            out,
+             uint64_t      *hash,
+             GCancellable  *cancellable,
+             GError       **error)
+{
+  MpdMediaHash   state;
+  char          *buffer = NULL;
+  ssize_t        n_read;
+  int            fd;
+  bool           ret = false;
+
+#ifdef HAVE_SYNC_FILE_RANGE
+  /* Wait for writeback of the data only, unlike fdatasync() this commits
+   * no journal and flushes no drive cache, so it is no per file
+   * durability barrier. Without it the target is read from the cache. */
+  if (0 != sync_file_range (out, 0, 0,
+                            SYNC_FILE_RANGE_WAIT_BEFORE |
+                            SYNC_FILE_RANGE_WRITE |
+                            SYNC_FILE_RANGE_WAIT_AFTER))
+  {
+    set_error_from_errno (error, errno, data->target_path);
+    return false;
+  }
+#endif
+
+  fd = open (data->target_path, O_RDONLY);
+  if (fd < 0)
+  {
+    set_error_from_errno (error, errno, data->target_path);
+    return false;
+  }
+
+#ifdef HAVE_POSIX_FADVISE
+  /* Clean after the wait above, so this drops it from the cache. */
+  posix_fadvise (fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+
+  if (0 != posix_memalign ((void **) &buffer, BUFFER_ALIGN, BUFFER_SIZE))
+  {
+    set_error_from_errno (error, ENOMEM, data->target_path);
+    close (fd);
+    return false;
+  }
+
+  mpd_media_hash_init (&state, 0);
+  for (;;)
+  {
+    if (g_cancellable_set_error_if_cancelled (cancellable, error))
+      break;
+
+    n_read = read (fd, buffer, BUFFER_SIZE);
+    if (n_read < 0 && errno == EINTR)
+      continue;
+    if (n_read < 0)
+    {
+      set_error_from_errno (error, errno, data->target_path);
+      break;
+    }
+    if (0 == n_read)
+    {
+      *hash = mpd_media_hash_finish (&state);
+      ret = true;
+      break;
+    }
+
+    mpd_media_hash_update (&state, buffer, n_read);
+  }
+
+#ifdef HAVE_POSIX_FADVISE
+  /* Dropped again, unless KEEP_CACHED asks to leave it for the
+   * thumbnailer. */
+  if (!(data->flags & MPD_COPY_FLAGS_KEEP_CACHED))
+    posix_fadvise (fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+
+  free (buffer);
+  close (fd);
+  return ret;
+}
+
+static bool
+verify_copy (CopyData      *data,
+             int            out,
+             GCancellable  *cancellable,
+             GError       **error)
+{
+  struct stat  st;
+  uint64_t     hash;
+
+  if (0 != fstat (out, &st))
+  {
+    set_error_from_errno (error, errno, data->target_path);
+    return false;
+  }
+
+  if ((uint64_t) st.st_size != data->size)
+  {
+    char *message = g_strdup_printf ("Copied %" G_GUINT64_FORMAT " of %"
+                                     G_GUINT64_FORMAT " bytes",
+                                     (uint64_t) st.st_size, data->size);
+    set_mismatch_error (error, data, message);
+    g_free (message);
+    return false;
+  }
+
+  if (!data->hashed)
+    return true;
+
+  if (!hash_target (data, out, &hash, cancellable, error))
+    return false;
+
+  if (hash != mpd_media_hash_finish (&data->hash))
+  {
+    set_mismatch_error (error, data, "Copy differs from the source");
+    return false;
+  }
+
+  return true;
+}
+
+static void
+_copy_thread_cb (GSimpleAsyncResult *result,
+                 GObject            *object,
+                 GCancellable       *cancellable)
+{
+  CopyData  *data = g_simple_async_result_get_op_res_gpointer (result);
+  int        in = -1;
+  int        out = -1;
+  int        ret = -1;
+  int        io_priority = -1;
+  bool       created = false;
+  GError    *error = NULL;
+
+  /* Pool threads are shared, the priority is restored below. */
+  if (data->flags & MPD_COPY_FLAGS_LOW_IMPACT)
+  {
+    io_priority = get_io_priority ();
+    if (io_priority >= 0 &&
+        0 != set_io_priority (IOPRIO_LOW_IMPACT))
+      io_priority = -1;
+  }
+
+  in = open (data->source_path, O_RDONLY);
+  if (in < 0)
+  {
+    set_error_from_errno (&error, errno, data->source_path);
+    goto bail;
+  }
+
+  out = open (data->target_path, O_WRONLY | O_CREAT | O_EXCL, 0666);
+  if (out < 0)
+  {
+    set_error_from_errno (&error, errno, data->target_path);
+    goto bail;
+  }
+  created = true;
+
+  if (data->flags & MPD_COPY_FLAGS_VERIFY)
+  {
+    struct stat in_st;
+    struct stat out_st;
+
+    data->same_device = 0 == fstat (in, &in_st) &&
+                        0 == fstat (out, &out_st) &&
+                        in_st.st_dev == out_st.st_dev;
+  }
+
+#ifdef HAVE_POSIX_FADVISE
+  posix_fadvise (in, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  /* Get the next file going while this one is copied. */
+  if (data->readahead_path)
+    readahead_file (data->readahead_path);
+
+  if (0 == ioctl (out, FICLONE, in))
+  {
+    ret = 1;
+  } else {
+    ret = copy_in_kernel (in, out, data, cancellable, &error);
+    if (0 == ret)
+      ret = copy_buffered (in, out, data, cancellable, &error) ? 1 : -1;
+    if (ret > 0)
+      write_back_finish (data, in, out);
+  }
+
+  if (ret > 0 &&
+      !verify_copy (data, out, cancellable, &error))
+    ret = -1;
+
+  if (0 != close (out) &&
+      ret > 0)
+  {
+    set_error_from_errno (&error, errno, data->target_path);
+    ret = -1;
+  }
+  out = -1;
+
+bail:
+  if (in >= 0)
+    close (in);
+  if (out >= 0)
+    close (out);
+
+  if (io_priority >= 0)
+    set_io_priority (io_priority);
+
+  if (error)
+  {
+    /* Don't leave partial files behind, but only our own. */
+    if (created)
+      unlink (data->target_path);
+    g_simple_async_result_set_from_error (result, error);
+    g_clear_error (&error);
+  }
+}
+
+void
+mpd_copy_file_async (char const           *source_path,
+                     char const           *target_path,
+                     char const           *readahead_path,
+                     uint64_t              size,
+                     int volatile         *copied_kib,
+                     MpdCopyFlags          flags,
+                     GCancellable         *cancellable,
+                     GAsyncReadyCallback   callback,
+                     void                 *data)
+{
+  GSimpleAsyncResult  *result;
+  CopyData            *copy_data;
+
+  g_return_if_fail (source_path);
+  g_return_if_fail (target_path);
+
+  copy_data = g_new0 (CopyData, 1);
+  copy_data->source_path = g_strdup (source_path);
+  copy_data->target_path = g_strdup (target_path);
+  copy_data->readahead_path = g_strdup (readahead_path);
+  copy_data->size = size;
+  copy_data->copied_kib = copied_kib;
+  copy_data->flags = flags;
+  mpd_media_hash_init (&copy_data->hash, 0);
+
+  result = g_simple_async_result_new (NULL, callback, data,
+                                      mpd_copy_file_async);
+  g_simple_async_result_set_op_res_gpointer (result, copy_data,
+                                             (GDestroyNotify) copy_data_free);
+  g_simple_async_result_run_in_thread (result,
+                                       (GSimpleAsyncThreadFunc)
+                                         _copy_thread_cb,
+                                       G_PRIORITY_DEFAULT,
+                                       cancellable);
+  g_object_unref (result);
+}
+
+bool
+mpd_copy_file_finish (GAsyncResult  *result,
+                      GError       **error)
+{
+  g_return_val_if_fail (g_simple_async_result_is_valid (result, NULL,
+                                                        mpd_copy_file_async),
+                        false);
+
+  return !g_simple_async_result_propagate_error (
+                                        G_SIMPLE_ASYNC_RESULT (result), error);
+}
+
+static void
+_sync_thread_cb (GSimpleAsyncResult *result,
+                 GObject            *object,
+                 GCancellable       *cancellable)
+{
+  char const  *path = g_simple_async_result_get_op_res_gpointer (result);
+  int          fd;
+  int          ret = -1;
+
+  fd = open (path, O_RDONLY);
+  if (fd < 0)
+  {
+    GError *error = NULL;
+    set_error_from_errno (&error, errno, path);
+    g_simple_async_result_set_from_error (result, error);
+    g_clear_error (&error);
+    return;
+  }
+
+#ifdef HAVE_SYNCFS
+  ret = syncfs (fd);
+#endif
+  if (ret < 0)
+  {
+    /* Old kernel or libc, flush everything. */
+    sync ();
+  }
+
+  close (fd);
+}
+
+void
+mpd_copy_sync_async (char const           *path,
+                     GAsyncReadyCallback   callback,
+                     void                 *data)
+{
+  GSimpleAsyncResult *result;
+
+  g_return_if_fail (path);
+
+  result = g_simple_async_result_new (NULL, callback, data,
+                                      mpd_copy_sync_async);
+  g_simple_async_result_set_op_res_gpointer (result, g_strdup (path), g_free);
+  g_simple_async_result_run_in_thread (result,
+                                       (GSimpleAsyncThreadFunc)
+                                         _sync_thread_cb,
+                                       G_PRIORITY_DEFAULT,
+                                       NULL);
+  g_object_unref (result);
+}
+
+bool
+mpd_copy_sync_finish (GAsyncResult  *result,
+                      GError       **error)
+{
+  g_return_val_if_fail (g_simple_async_result_is_valid (result, NULL,
+                                                        mpd_copy_sync_async),
+                        false);
+
+  return !g_simple_async_result_propagate_error (
+                                        G_SIMPLE_ASYNC_RESULT (result), error);
+}
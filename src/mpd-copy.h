@@ -0,0 +1,94 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPD_COPY_H
+#define MPD_COPY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+  MPD_COPY_FLAGS_NONE        = 0,
+  /* Lowest best-effort I/O priority, bounded dirty and cached pages. */
+  MPD_COPY_FLAGS_LOW_IMPACT  = 1 << 0,
+  /* Read the target back and compare with what was read from the source,
+   * unless the file system cloned or copied the blocks itself. */
+  MPD_COPY_FLAGS_VERIFY      = 1 << 1,
+  /* Leave the target's pages cached, it is read again right away. */
+  MPD_COPY_FLAGS_KEEP_CACHED = 1 << 2
+} MpdCopyFlags;
+
+#define MPD_COPY_ERROR mpd_copy_error_quark ()
+
+enum
+{
+  /* Target size or content differs from the source. */
+  MPD_COPY_ERROR_MISMATCH
+};
+
+GQuark
+mpd_copy_error_quark (void);
+
+/*
+ * Local file copy for media import. Runs in a thread, tries reflink, then
+ * in-kernel copy, then a plain read/write loop. The target must not exist.
+ * Data is not synced, see mpd_copy_sync_async().
+ *
+ * `size' is the expected source size, the copy fails with
+ * MPD_COPY_ERROR_MISMATCH if a different amount was copied.
+ *
+ * If `copied_kib' is given, the copy thread stores the amount copied so
+ * far in KiB there, read it with g_atomic_int_get(). It must stay valid
+ * until the callback is invoked.
+ */
+
+void
+mpd_copy_file_async (char const           *source_path,
+                     char const           *target_path,
+                     char const           *readahead_path,
+                     uint64_t              size,
+                     int volatile         *copied_kib,
+                     MpdCopyFlags          flags,
+                     GCancellable         *cancellable,
+                     GAsyncReadyCallback   callback,
+                     void                 *data);
+
+bool
+mpd_copy_file_finish (GAsyncResult  *result,
+                      GError       **error);
+
+/* Flush the file system containing `path' to disk. */
+void
+mpd_copy_sync_async (char const           *path,
+                     GAsyncReadyCallback   callback,
+                     void                 *data);
+
+bool
+mpd_copy_sync_finish (GAsyncResult  *result,
+                      GError       **error);
+
+G_END_DECLS
+
+#endif /* MPD_COPY_H */
+
@@ -26,21 +26,34 @@
 #include <glib/gi18n.h>
 #include <glib/gprintf.h>
 #include <gio/gio.h>
-#include <gio/gdesktopappinfo.h>
 #include <gtk/gtk.h>
 
+#include "mpd-busy-processes.h"
 #include "mpd-default-device-tile.h"
 #include "mpd-devices-tile.h"
 #include "mpd-gobject.h"
 #include "mpd-shell-defines.h"
 #include "mpd-storage-device-tile.h"
+#include "mpd-writeback.h"
 #include "config.h"
 
 G_DEFINE_TYPE (MpdDevicesTile, mpd_devices_tile, MX_TYPE_SCROLL_VIEW)
 
+/* About a frame, volume monitor events within are applied together. */
+#define EVENT_DELAY_MS 20
+
+#define FLUSH_PROGRESS_INTERVAL_MS 500
+
 #define GET_PRIVATE(o) \
   (G_TYPE_INSTANCE_GET_PRIVATE ((o), MPD_TYPE_DEVICES_TILE, MpdDevicesTilePrivate))
 
+enum
+{
+  PROP_0,
+
+  PROP_VOLUME_MONITOR
+};
+
 enum
 {
   REQUEST_HIDE,
@@ -49,15 +62,67 @@ enum
   LAST_SIGNAL
 };
 
+typedef enum
+{
+  MOUNT_STATE_ADDING,     /* Content type not known yet. */
+  MOUNT_STATE_MOUNTED,
+  MOUNT_STATE_EJECTING,
+  MOUNT_STATE_REMOVED     /* Tile still saying goodbye. */
+} MountState;
+
+/*
+ * Registry entry, one per mount that has a tile. Removed mounts are kept
+ * until their tile goes away, so late signals for them are recognised
+ * and ignored. The mount reference keeps its address from being reused.
+ */
+typedef struct
+{
+  MpdDevicesTile  *self;
+  GMount          *mount;
+  char            *uri;
+  char            *uuid;
+  ClutterActor    *tile;
+  MountState       state;
+  unsigned int     expiration_id;
+  MpdWriteback    *writeback;       /* NULL unless a local file system */
+  unsigned int     flush_progress_id;
+} MountEntry;
+
 typedef struct
 {
   ClutterActor    *vbox;
 
   GVolumeMonitor  *monitor;
-  GHashTable      *tiles;      /* key=GMount, value=MpdStorageTile */
+  GHashTable      *mounts;          /* key=GMount, value=MountEntry */
+  GHashTable      *mounts_by_uri;   /* key=root URI, value=MountEntry */
+  GHashTable      *mounts_by_uuid;  /* key=UUID, value=MountEntry */
+  GHashTable      *content_types;   /* key=UUID, value=type, NULL pending */
+  GCancellable    *cancellable;
+  GQueue           events;          /* MountEvent, not applied yet */
+  unsigned int     events_id;
   MplPanelClient  *panel_client;
 } MpdDevicesTilePrivate;
 
+typedef enum
+{
+  MOUNT_EVENT_ADDED,
+  MOUNT_EVENT_CHANGED,
+  MOUNT_EVENT_REMOVED
+} MountEventKind;
+
+typedef struct
+{
+  MountEventKind   kind;
+  GMount          *mount;
+} MountEvent;
+
+/* Eject in flight, the mount is looked up again when it completes. */
+typedef struct
+{
+  MpdDevicesTile  *self;
+  GMount          *mount;
+} EjectOp;
+
 static unsigned int _signals[LAST_SIGNAL] = { 0, };
 
 static char const *
@@ -66,197 +131,200 @@ get_eject_failed_message (void)
   return _("Sorry, we can't eject at the moment");
 }
 
+static char const *
+get_flushing_message (void)
+{
+  return _("Writing to the device");
+}
+
+static char const *
+get_flushing_progress_message (void)
+{
+  return _("Writing to the device, %s done");
+}
+
 static char const *
 get_eject_failed_busy_message (void)
 {
   return _("Sorry, we can't eject because <b>%s</b> is using the disk");
 }
 
-/* Copied from gtk+'s gtk/gtkmountoperation-x11.c (LGPLv2)
- * (hence David Zeuthen and Michael Natterer added as copyright
- *  holders).
- */
-static gchar *
-pid_get_env (GPid         pid,
-             const gchar *key)
-{
-  gchar *ret;
-  gchar *env_filename;
-  gchar *env;
-  gsize env_len;
-  gsize key_len;
-  gchar *end;
-
-  ret = NULL;
-
-  key_len = strlen (key);
-
-  env_filename = g_strdup_printf ("/proc/%d/environ", pid);
-  if (g_file_get_contents (env_filename,
-                           &env,
-                           &env_len,
-                           NULL))
-    {
-      guint n;
-
-      /* /proc/<pid>/environ in Linux is split at '\0' points, g_strsplit() can't handle that... */
-      n = 0;
-      while (TRUE)
-        {
-          if (env[n] == '\0' || n >= env_len)
-            break;
-
-          if (g_str_has_prefix (env + n, key) && (*(env + n + key_len) == '='))
-            {
-              ret = g_strdup (env + n + key_len + 1);
-
-              /* skip invalid UTF-8 */
-              if (!g_utf8_validate (ret, -1, (const gchar **) &end))
-                *end = '\0';
-              break;
-            }
-
-          for (; env[n] != '\0' && n < env_len; n++)
-            ;
-          n++;
-        }
-      g_free (env);
+static void
+show_eject_error (MpdStorageDeviceTile  *tile,
+                  GPtrArray const       *names)
+{
+  if (names && names->len) {
+    GString *list = g_string_new (NULL);
+    char *msg;
+
+    for (unsigned int i = 0; i < names->len; i++) {
+      char *escaped = g_markup_escape_text (g_ptr_array_index (names, i), -1);
+      if (i > 0) {
+        g_string_append (list, ", ");
+      }
+      g_string_append (list, escaped);
+      g_free (escaped);
     }
-  g_free (env_filename);
 
-  return ret;
+    msg = g_strdup_printf (get_eject_failed_busy_message (), list->str);
+    mpd_storage_device_tile_show_message (tile, msg, false);
+
+    g_free (msg);
+    g_string_free (list, TRUE);
+  } else {
+    mpd_storage_device_tile_show_message (tile,
+					  get_eject_failed_message (),
+					  false);
+  }
+
+  mx_widget_set_disabled (MX_WIDGET (tile), FALSE);
 }
 
-static gchar *
-get_name_for_pid (GPid pid)
+static EjectOp *
+eject_op_new (MpdDevicesTile  *self,
+              GMount          *mount)
 {
-  gchar *name = NULL;
-  gchar *desktop_file = pid_get_env (pid, "GIO_LAUNCHED_DESKTOP_FILE");
+  EjectOp *op = g_new0 (EjectOp, 1);
 
-  if (desktop_file) {
-      GDesktopAppInfo *gdapp = g_desktop_app_info_new_from_filename (desktop_file);
+  op->self = g_object_ref (self);
+  op->mount = g_object_ref (mount);
 
-      name = g_strdup (g_app_info_get_name ((GAppInfo *)gdapp));
+  return op;
+}
+
+static void
+eject_op_free (EjectOp *op)
+{
+  g_object_unref (op->mount);
+  g_object_unref (op->self);
+  g_free (op);
+}
 
-      g_object_unref (gdapp);
-      g_free (desktop_file);
+static MountEntry *
+eject_op_get_entry (EjectOp *op)
+{
+  MpdDevicesTilePrivate *priv = GET_PRIVATE (op->self);
+
+  if (NULL == priv->mounts) {
+    return NULL;
   }
 
-  return name;
+  return g_hash_table_lookup (priv->mounts, op->mount);
 }
 
 static void
-_handle_eject_error (MpdStorageDeviceTile *tile,
-		     GError *error)
+_busy_processes_cb (GObject       *source,
+                    GAsyncResult  *result,
+                    EjectOp       *op)
 {
-  GArray *processes = mpd_storage_device_tile_get_processes (tile);
+  MountEntry  *entry;
+  GPtrArray   *names;
+  GError      *error = NULL;
 
-  if (error->code == G_IO_ERROR_BUSY &&
-      processes && processes->len) {
-      gchar *msg;
-      char *process_name;
-      GPid pid;
+  names = mpd_busy_processes_find_finish (result, &error);
+  if (error) {
+    g_warning ("%s : %s", G_STRLOC, error->message);
+    g_clear_error (&error);
+  }
 
-      /* TODO: we maybe want to iterate over the processes
-       *       until we get one from which we can successfully
-       *       lookup its localized name. */
-      pid = g_array_index (processes, GPid, 0);
-      process_name = get_name_for_pid (pid);
-      msg = g_strdup_printf (get_eject_failed_busy_message (),
-			     process_name ? : "Unknown");
-      mpd_storage_device_tile_show_message (tile, msg, false);
+  /* Unless it has been ejected again meanwhile. */
+  entry = eject_op_get_entry (op);
+  if (entry && MOUNT_STATE_MOUNTED == entry->state) {
+    show_eject_error (MPD_STORAGE_DEVICE_TILE (entry->tile), names);
+  }
 
-      g_free (process_name);
-      g_free (msg);
-  } else {
-    mpd_storage_device_tile_show_message (tile,
-					  get_eject_failed_message (),
-					  false);
+  if (names) {
+    g_ptr_array_unref (names);
   }
+  eject_op_free (op);
+}
 
-  mx_widget_set_disabled (MX_WIDGET (tile), FALSE);
-  g_warning ("%s : %s", G_STRLOC, error->message);
-  g_clear_error (&error);
+static void
+eject_op_finish (EjectOp  *op,
+                 GError   *error)
+{
+  MountEntry *entry = eject_op_get_entry (op);
+
+  /* On success mount-removed takes it from here. */
+  if (error) {
+    g_warning ("%s : %s", G_STRLOC, error->message);
+
+    if (entry && MOUNT_STATE_EJECTING == entry->state) {
+      MpdStorageDeviceTile *tile = MPD_STORAGE_DEVICE_TILE (entry->tile);
+      char *path = NULL;
+
+      entry->state = MOUNT_STATE_MOUNTED;
+
+      if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_BUSY)) {
+        GFile *root = g_mount_get_root (entry->mount);
+        path = g_file_get_path (root);
+        g_object_unref (root);
+      }
+
+      if (path) {
+        /* Tell who's using it, that takes a walk through /proc. */
+        mpd_busy_processes_find_async (
+                        path,
+                        mpd_storage_device_tile_get_processes (tile),
+                        NULL,
+                        (GAsyncReadyCallback) _busy_processes_cb,
+                        op);
+        g_free (path);
+        g_clear_error (&error);
+        return;
+      }
+
+      show_eject_error (tile, NULL);
+    }
+
+    g_clear_error (&error);
+  }
+
+  eject_op_free (op);
 }
 
 static void
 _drive_eject_cb (GDrive       *drive,
                  GAsyncResult *result,
-                 gpointer      data)
+                 EjectOp      *op)
 {
   GError *error = NULL;
 
-  g_return_if_fail (MPD_IS_STORAGE_DEVICE_TILE (data));
-
   g_drive_eject_with_operation_finish (drive, result, &error);
-  if (error) {
-    _handle_eject_error (MPD_STORAGE_DEVICE_TILE (data), error);
-  }
+  eject_op_finish (op, error);
 }
 
 static void
 _vol_eject_cb (GVolume      *volume,
                GAsyncResult *result,
-               gpointer      data)
+               EjectOp      *op)
 {
   GError *error = NULL;
 
-  g_return_if_fail (MPD_IS_STORAGE_DEVICE_TILE (data));
-
   g_volume_eject_with_operation_finish (volume, result, &error);
-  if (error) {
-    _handle_eject_error (MPD_STORAGE_DEVICE_TILE (data), error);
-  }
+  eject_op_finish (op, error);
 }
 
 static void
 _mount_eject_cb (GMount       *mount,
                  GAsyncResult *result,
-                 gpointer      data)
+                 EjectOp      *op)
 {
   GError *error = NULL;
 
-  g_return_if_fail (MPD_IS_STORAGE_DEVICE_TILE (data));
-
   g_mount_eject_with_operation_finish (mount, result, &error);
-  if (error) {
-    _handle_eject_error (MPD_STORAGE_DEVICE_TILE (data), error);
-  }
+  eject_op_finish (op, error);
 }
 
 static void
 _mount_unmount_cb (GMount       *mount,
                    GAsyncResult *result,
-                   gpointer      data)
+                   EjectOp      *op)
 {
   GError *error = NULL;
 
-  g_return_if_fail (MPD_IS_STORAGE_DEVICE_TILE (data));
-
   g_mount_unmount_with_operation_finish (mount, result, &error);
-  if (error) {
-    _handle_eject_error (MPD_STORAGE_DEVICE_TILE (data), error);
-  }
-}
-
-static int
-_find_mount_cb (GMount      *mount,
-                char const  *uri)
-{
-  GFile *file;
-  char  *mount_uri;
-  int    ret;
-
-  file = g_mount_get_root (mount);
-  mount_uri = g_file_get_uri (file);
-
-  g_debug ("%s() %s", __FUNCTION__, mount_uri);
-  ret = g_strcmp0 (mount_uri, uri);
-
-  g_free (mount_uri);
-  g_object_unref (file);
-
-  return ret;
+  eject_op_finish (op, error);
 }
 
 static void
@@ -285,83 +353,159 @@ _show_processes_cb (GMountOperation *op,
 }
 
 static void
-_tile_eject_cb (MpdStorageDeviceTile  *tile,
-                MpdDevicesTile        *self)
+eject_mount (MpdDevicesTile *self,
+             MountEntry     *entry)
 {
-  MpdDevicesTilePrivate *priv = GET_PRIVATE (self);
-  char const  *uri;
-  GList       *mounts;
-  GList       *iter;
+  MpdStorageDeviceTile *tile = MPD_STORAGE_DEVICE_TILE (entry->tile);
+  char const *uri = entry->uri;
+  GMount *mount;
+  GDrive *drive;
+  GVolume *vol;
+  gboolean ejected = TRUE;
+  GMountOperation *mount_op;
+
+  mount = entry->mount;
+  mount_op = g_mount_operation_new ();
+
+  mpd_storage_device_tile_set_processes (tile, NULL);
+
+  g_signal_connect (mount_op, "show-processes",
+		    G_CALLBACK (_show_processes_cb), tile);
+
+  drive = g_mount_get_drive (mount);
+  vol = g_mount_get_volume (mount);
+
+  if (drive && g_drive_can_eject (drive)) {
+    g_debug ("%s() ejecting drive %s", __FUNCTION__, uri);
+    g_drive_eject_with_operation (drive,
+                                  G_MOUNT_UNMOUNT_NONE, mount_op, NULL,
+                                  (GAsyncReadyCallback)_drive_eject_cb,
+                                  eject_op_new (self, mount));
+  } else if (vol && g_volume_can_eject (vol)) {
+    g_debug ("%s() ejecting volume %s", __FUNCTION__, uri);
+    g_volume_eject_with_operation (vol,
+                                   G_MOUNT_UNMOUNT_NONE, mount_op, NULL,
+                                   (GAsyncReadyCallback)_vol_eject_cb,
+                                   eject_op_new (self, mount));
+  } else if (g_mount_can_eject (mount)) {
+    g_debug ("%s() ejecting mount %s", __FUNCTION__, uri);
+    g_mount_eject_with_operation (mount,
+                                  G_MOUNT_UNMOUNT_NONE, mount_op, NULL,
+                                  (GAsyncReadyCallback) _mount_eject_cb,
+                                  eject_op_new (self, mount));
+  } else if (g_mount_can_unmount (mount)) {
+    g_debug ("%s() unmounting mount %s", __FUNCTION__, uri);
+    g_mount_unmount_with_operation (mount,
+                                    G_MOUNT_UNMOUNT_NONE, mount_op, NULL,
+                                   (GAsyncReadyCallback) _mount_unmount_cb,
+                                   eject_op_new (self, mount));
+  } else {
+    ejected = FALSE;
+    g_warning ("Eject or unmount not possible");
+  }
 
-  uri = mpd_storage_device_tile_get_mount_point (tile);
+  entry->state = ejected ? MOUNT_STATE_EJECTING : MOUNT_STATE_MOUNTED;
 
-  mounts = g_volume_monitor_get_mounts (priv->monitor);
-  iter = g_list_find_custom (mounts, uri, (GCompareFunc) _find_mount_cb);
-  if (iter)
-  {
-    GMount *mount = G_MOUNT (iter->data);
-    GDrive *drive;
-    GVolume *vol;
-    gboolean ejected = TRUE;
-    GMountOperation *mount_op =  g_mount_operation_new ();
+  mx_widget_set_disabled (MX_WIDGET (tile), ejected);
+  /* TODO: inform user of ejection with text inside the tile:
+   * For that (and other reasons) this code really should be inside
+   * MpdStorageDeviceTile  */
 
-    mpd_storage_device_tile_set_processes (tile, NULL);
+  if (drive) {
+    g_object_unref (drive);
+  }
+  if (vol) {
+    g_object_unref (vol);
+  }
+
+  g_object_unref (mount_op);
+}
 
-    g_signal_connect (mount_op, "show-processes",
-		      G_CALLBACK (_show_processes_cb), tile);
+static bool
+_flush_progress_cb (MountEntry *entry)
+{
+  uint64_t  size;
+  char     *size_text;
+  char     *message;
+
+  /* How much is left is only known system wide, show what's done. */
+  size = mpd_writeback_get_flushed_size (entry->writeback);
+  if (size) {
+    size_text = g_format_size_for_display (size);
+    message = g_strdup_printf (get_flushing_progress_message (), size_text);
+    g_free (size_text);
+  } else {
+    message = g_strdup (get_flushing_message ());
+  }
 
-    drive = g_mount_get_drive (mount);
-    vol = g_mount_get_volume (mount);
+  mpd_storage_device_tile_show_message (MPD_STORAGE_DEVICE_TILE (entry->tile),
+                                        message,
+                                        false);
+  g_free (message);
 
-    if (drive && g_drive_can_eject (drive)) {
-      g_debug ("%s() ejecting drive %s", __FUNCTION__, uri);
-      g_drive_eject_with_operation (drive,
-                                    G_MOUNT_UNMOUNT_NONE, mount_op, NULL,
-                                    (GAsyncReadyCallback)_drive_eject_cb,
-                                    tile);
-    } else if (vol && g_volume_can_eject (vol)) {
-      g_debug ("%s() ejecting volume %s", __FUNCTION__, uri);
-      g_volume_eject_with_operation (vol,
-                                     G_MOUNT_UNMOUNT_NONE, mount_op, NULL,
-                                     (GAsyncReadyCallback)_vol_eject_cb,
-                                     tile);
-    } else if (g_mount_can_eject (mount)) {
-      g_debug ("%s() ejecting mount %s", __FUNCTION__, uri);
-      g_mount_eject_with_operation (mount,
-                                    G_MOUNT_UNMOUNT_NONE, mount_op, NULL,
-                                    (GAsyncReadyCallback) _mount_eject_cb,
-                                    tile);
-    } else if (g_mount_can_unmount (mount)) {
-      g_debug ("%s() unmounting mount %s", __FUNCTION__, uri);
-      g_mount_unmount_with_operation (mount,
-                                      G_MOUNT_UNMOUNT_NONE, mount_op, NULL,
-                                     (GAsyncReadyCallback) _mount_unmount_cb,
-                                     tile);
-    } else {
-      ejected = FALSE;
-      g_warning ("Eject or unmount not possible");
-    }
+  return true;
+}
 
-    mx_widget_set_disabled (MX_WIDGET (tile), ejected);
-    /* TODO: inform user of ejection with text inside the tile:
-     * For that (and other reasons) this code really should be inside
-     * MpdStorageDeviceTile  */
+static void
+_flush_cb (MpdWriteback *writeback,
+           EjectOp      *op)
+{
+  MountEntry *entry = eject_op_get_entry (op);
 
-    /* TODO: we want to start a 2s timeout here, and if not done sync'ing when
-     * expired show the message "Ejecting ..." */
+  if (entry && entry->flush_progress_id) {
+    g_source_remove (entry->flush_progress_id);
+    entry->flush_progress_id = 0;
+  }
 
-    if (drive) {
-      g_object_unref (drive);
-    }
-    if (vol) {
-      g_object_unref (vol);
-    }
+  if (entry && MOUNT_STATE_EJECTING == entry->state)
+  {
+    eject_mount (op->self, entry);
+  }
+
+  eject_op_free (op);
+}
+
+/*
+ * Data still in the page cache is written out before ejecting, with
+ * progress shown in the tile. The eject itself then hardly has anything
+ * left to do, rather than blocking silently while the kernel flushes.
+ */
+static void
+_tile_eject_cb (MpdStorageDeviceTile  *tile,
+                MpdDevicesTile        *self)
+{
+  MpdDevicesTilePrivate *priv = GET_PRIVATE (self);
+  char const  *uri;
+  MountEntry  *entry;
 
-    g_object_unref (mount_op);
+  uri = mpd_storage_device_tile_get_mount_point (tile);
+
+  entry = g_hash_table_lookup (priv->mounts_by_uri, uri);
+  if (NULL == entry ||
+      MOUNT_STATE_EJECTING == entry->state ||
+      MOUNT_STATE_REMOVED == entry->state)
+  {
+    g_debug ("%s() nothing to eject at %s", __FUNCTION__, uri);
+    return;
   }
 
-  g_list_foreach (mounts, (GFunc) g_object_unref, NULL);
-  g_list_free (mounts);
+  if (entry->writeback &&
+      mpd_writeback_has_unflushed (entry->writeback))
+  {
+    g_debug ("%s() flushing %s", __FUNCTION__, uri);
+    entry->state = MOUNT_STATE_EJECTING;
+    mx_widget_set_disabled (MX_WIDGET (tile), TRUE);
+    _flush_progress_cb (entry);
+    entry->flush_progress_id = g_timeout_add (FLUSH_PROGRESS_INTERVAL_MS,
+                                              (GSourceFunc) _flush_progress_cb,
+                                              entry);
+    mpd_writeback_flush_async (entry->writeback,
+                               (MpdWritebackCallback) _flush_cb,
+                               eject_op_new (self, entry->mount));
+    return;
+  }
+
+  eject_mount (self, entry);
 }
 
 static void
@@ -383,24 +527,198 @@ _device_tile_request_show_cb (ClutterActor    *tile,
 static gboolean
 _mount_is_wanted_device (GMount *mount)
 {
-  gboolean removed;
-
   /* shadowed mounts are not supposed to be shown to user */
   if (g_mount_is_shadowed (mount)) {
     return FALSE;
   }
 
-  removed = GPOINTER_TO_INT (
-    g_object_get_data (G_OBJECT (mount), "mpd-removed-already"));
-  if (removed) {
-    /* already removed mounts sometimes emit mount-changed. must keep
-     * track of removals here.. */
-    /* TODO the right way to do this would be to just disconnect
-     * the mount-changed signal handler in _monitor_mount_removed_cb() */
-    return FALSE;
+  return TRUE;
+}
+
+static char *
+get_mount_uuid (GMount *mount)
+{
+  GVolume *volume;
+  char    *uuid = NULL;
+
+  volume = g_mount_get_volume (mount);
+  if (volume) {
+    uuid = g_volume_get_uuid (volume);
+    g_object_unref (volume);
   }
 
-  return TRUE;
+  if (!uuid) {
+    uuid = g_mount_get_uuid (mount);
+  }
+
+  return uuid;
+}
+
+static void
+mount_entry_free (MountEntry *entry)
+{
+  if (entry->expiration_id) {
+    g_source_remove (entry->expiration_id);
+  }
+  if (entry->flush_progress_id) {
+    g_source_remove (entry->flush_progress_id);
+  }
+  if (entry->writeback) {
+    mpd_writeback_free (entry->writeback);
+  }
+  g_object_unref (entry->mount);
+  g_free (entry->uuid);
+  g_free (entry->uri);
+  g_free (entry);
+}
+
+static MountEntry *
+registry_add (MpdDevicesTile  *self,
+              GMount          *mount,
+              char const      *uri,
+              char const      *uuid,
+              ClutterActor    *tile)
+{
+  MpdDevicesTilePrivate *priv = GET_PRIVATE (self);
+  MountEntry *entry = g_new0 (MountEntry, 1);
+
+  entry->self = self;
+  entry->mount = g_object_ref (mount);
+  entry->uri = g_strdup (uri);
+  entry->uuid = g_strdup (uuid);
+  entry->tile = tile;
+  entry->state = MOUNT_STATE_ADDING;
+
+  g_hash_table_insert (priv->mounts, mount, entry);
+  g_hash_table_insert (priv->mounts_by_uri, entry->uri, entry);
+  if (entry->uuid) {
+    g_hash_table_insert (priv->mounts_by_uuid, entry->uuid, entry);
+  }
+
+  return entry;
+}
+
+/*
+ * Only lookups by mount find the entry afterwards.
+ */
+static void
+registry_unindex (MpdDevicesTile  *self,
+                  MountEntry      *entry)
+{
+  MpdDevicesTilePrivate *priv = GET_PRIVATE (self);
+
+  if (entry == g_hash_table_lookup (priv->mounts_by_uri, entry->uri)) {
+    g_hash_table_remove (priv->mounts_by_uri, entry->uri);
+  }
+
+  if (entry->uuid &&
+      entry == g_hash_table_lookup (priv->mounts_by_uuid, entry->uuid)) {
+    g_hash_table_remove (priv->mounts_by_uuid, entry->uuid);
+  }
+}
+
+static void
+registry_remove (MpdDevicesTile *self,
+                 MountEntry     *entry)
+{
+  MpdDevicesTilePrivate *priv = GET_PRIVATE (self);
+
+  registry_unindex (self, entry);
+  g_hash_table_remove (priv->mounts, entry->mount);
+}
+
+/*
+ * The content type guess is done, `mime_type' may be NULL. The volume may
+ * have been mounted again meanwhile, so entries are looked up by mount and
+ * by uuid.
+ */
+static void
+set_mounted (MpdDevicesTile *self,
+             GMount         *mount,
+             char const     *uuid,
+             char const     *mime_type)
+{
+  MpdDevicesTilePrivate *priv = GET_PRIVATE (self);
+  MountEntry *entries[2];
+
+  entries[0] = g_hash_table_lookup (priv->mounts, mount);
+  entries[1] = uuid ? g_hash_table_lookup (priv->mounts_by_uuid, uuid) : NULL;
+  for (unsigned int i = 0; i < G_N_ELEMENTS (entries); i++)
+  {
+    MountEntry *entry = entries[i];
+
+    if (NULL == entry ||
+        MOUNT_STATE_REMOVED == entry->state ||
+        (i > 0 && entry == entries[0])) {
+      continue;
+    }
+
+    mpd_storage_device_tile_set_mime_type (
+                              MPD_STORAGE_DEVICE_TILE (entry->tile),
+                              mime_type);
+    if (MOUNT_STATE_ADDING == entry->state) {
+      entry->state = MOUNT_STATE_MOUNTED;
+    }
+  }
+}
+
+static void
+_guess_content_type_cb (GMount          *mount,
+                        GAsyncResult    *result,
+                        MpdDevicesTile  *self)
+{
+  MpdDevicesTilePrivate *priv;
+  char          **mime_types;
+  char const     *mime_type;
+  char           *uuid;
+  GError         *error = NULL;
+
+  priv = GET_PRIVATE (self);
+  mime_types = g_mount_guess_content_type_finish (mount, result, &error);
+  if (NULL == priv->content_types)
+  {
+    /* Disposed meanwhile. */
+    g_clear_error (&error);
+    g_strfreev (mime_types);
+    g_object_unref (self);
+    return;
+  }
+
+  uuid = get_mount_uuid (mount);
+
+  if (error)
+  {
+    /* Have another go next time the volume shows up. */
+    g_warning ("%s : %s", G_STRLOC, error->message);
+    g_clear_error (&error);
+    if (uuid) {
+      g_hash_table_remove (priv->content_types, uuid);
+    }
+    set_mounted (self, mount, uuid, NULL);
+    g_strfreev (mime_types);
+    g_free (uuid);
+    g_object_unref (self);
+    return;
+  }
+
+  for (int i = 0; mime_types && mime_types[i]; i++)
+  {
+    g_debug ("%s", mime_types[i]);
+  }
+
+  /* "" for volumes that have no known content. */
+  mime_type = mime_types && mime_types[0] ? mime_types[0] : "";
+  if (uuid) {
+    g_hash_table_insert (priv->content_types,
+                         g_strdup (uuid),
+                         g_strdup (mime_type));
+  }
+
+  set_mounted (self, mount, uuid, *mime_type ? mime_type : NULL);
+
+  g_strfreev (mime_types);
+  g_free (uuid);
+  g_object_unref (self);
 }
 
 static void
@@ -410,14 +728,17 @@ add_tile_from_mount (MpdDevicesTile *self,
   MpdDevicesTilePrivate *priv = GET_PRIVATE (self);
   GFile         *file;
   char          *uri;
+  char          *path;
   GVolume       *volume;
   char          *name = NULL;
-  char         **mime_types;
+  char          *uuid;
+  char const    *mime_type = NULL;
+  bool           known;
   GIcon         *icon;
   GtkIconInfo   *icon_info;
   char const    *icon_file;
   ClutterActor  *tile;
-  GError        *error = NULL;
+  MountEntry    *entry;
 
   volume = g_mount_get_volume (mount);
   if (volume) {
@@ -433,15 +754,14 @@ add_tile_from_mount (MpdDevicesTile *self,
   file = g_mount_get_root (mount);
   uri = g_file_get_uri (file);
 
-  mime_types = g_mount_guess_content_type_sync (mount, false, NULL, &error);
-  for (int i = 0; mime_types && mime_types[i]; i++)
-  {
-    g_debug ("%s", mime_types[i]);
-  }
-  if (error)
-  {
-    g_warning ("%s : %s", G_STRLOC, error->message);
-    g_clear_error (&error);
+  /* Guessing the content type may scan the volume, so the tile comes up
+   * without and gets it later. Volumes seen before have it right away. */
+  uuid = get_mount_uuid (mount);
+  known = uuid &&
+          g_hash_table_lookup_extended (priv->content_types, uuid,
+                                        NULL, (void **) &mime_type);
+  if (mime_type && !*mime_type) {
+    mime_type = NULL;
   }
 
   /* Icon */
@@ -455,10 +775,13 @@ add_tile_from_mount (MpdDevicesTile *self,
 
   tile = mpd_storage_device_tile_new (name,
                                       uri,
-                                      mime_types ? mime_types[0] : NULL,
+                                      mime_type,
                                       icon_file);
 
-  mpd_storage_device_tile_set_client (tile, priv->panel_client);
+  /* Not in the tests. */
+  if (priv->panel_client) {
+    mpd_storage_device_tile_set_client (tile, priv->panel_client);
+  }
   g_signal_connect (tile, "eject",
                     G_CALLBACK (_tile_eject_cb), self);
   g_signal_connect (tile, "request-hide",
@@ -467,11 +790,32 @@ add_tile_from_mount (MpdDevicesTile *self,
                     G_CALLBACK (_device_tile_request_show_cb), self);
   mx_box_layout_add_actor (MX_BOX_LAYOUT (priv->vbox), tile, 0);
 
-  g_hash_table_insert (priv->tiles, mount, tile);
+  entry = registry_add (self, mount, uri, uuid, tile);
+
+  path = g_file_get_path (file);
+  if (path) {
+    entry->writeback = mpd_writeback_new (path);
+    g_free (path);
+  }
+
+  if (known) {
+    /* Unless another mount of the volume is still guessing. */
+    if (g_hash_table_lookup (priv->content_types, uuid)) {
+      entry->state = MOUNT_STATE_MOUNTED;
+    }
+  } else {
+    /* Pending, so it's not guessed twice. */
+    if (uuid) {
+      g_hash_table_insert (priv->content_types, g_strdup (uuid), NULL);
+    }
+    g_mount_guess_content_type (mount, false, priv->cancellable,
+                                (GAsyncReadyCallback) _guess_content_type_cb,
+                                g_object_ref (self));
+  }
 
   gtk_icon_info_free (icon_info);
   g_object_unref (icon);
-  g_strfreev (mime_types);
+  g_free (uuid);
   g_free (uri);
   g_object_unref (file);
 }
@@ -488,38 +832,49 @@ _add_mount_cb (GMount         *mount,
 
 
 static void
-_monitor_mount_added_cb (GVolumeMonitor  *monitor,
-                         GMount          *mount,
-                         MpdDevicesTile  *self)
+apply_mount_added (MpdDevicesTile *self,
+                   GMount         *mount)
 {
+  MpdDevicesTilePrivate *priv = GET_PRIVATE (self);
+
+  if (g_hash_table_lookup (priv->mounts, mount)) {
+    return;
+  }
+
   if (_mount_is_wanted_device (mount)) {
     add_tile_from_mount (self, mount);
   }
 }
 
 static bool
-_unmount_message_expiration_cb (MpdStorageDeviceTile *tile)
+_unmount_message_expiration_cb (MountEntry *entry)
 {
-  clutter_actor_destroy (CLUTTER_ACTOR (tile));
+  clutter_actor_destroy (entry->tile);
+  entry->expiration_id = 0;
+  registry_remove (entry->self, entry);
   return false;
 }
 
 static void
-_monitor_mount_changed_cb (GVolumeMonitor *monitor,
-                           GMount         *mount,
-                           MpdDevicesTile *self)
+apply_mount_changed (MpdDevicesTile *self,
+                     GMount         *mount)
 {
   MpdDevicesTilePrivate *priv = GET_PRIVATE (self);
-  MpdStorageDeviceTile *tile;
+  MountEntry *entry;
 
-  tile = g_hash_table_lookup (priv->tiles, mount);
-  if (tile)
+  entry = g_hash_table_lookup (priv->mounts, mount);
+  if (entry)
   {
+    /* Removed mounts sometimes still emit mount-changed. */
+    if (MOUNT_STATE_REMOVED == entry->state) {
+      return;
+    }
+
     if (!_mount_is_wanted_device (mount))
     {
-      g_hash_table_remove (priv->tiles, mount);
       clutter_container_remove_actor (CLUTTER_CONTAINER (priv->vbox),
-                                      CLUTTER_ACTOR (tile));
+                                      entry->tile);
+      registry_remove (self, entry);
     }
   } else {
     if (_mount_is_wanted_device (mount)) {
@@ -529,39 +884,255 @@ _monitor_mount_changed_cb (GVolumeMonitor *monitor,
 }
 
 static void
-_monitor_mount_removed_cb (GVolumeMonitor  *monitor,
-                           GMount          *mount,
-                           MpdDevicesTile  *self)
+apply_mount_removed (MpdDevicesTile *self,
+                     GMount         *mount)
 {
   MpdDevicesTilePrivate *priv = GET_PRIVATE (self);
-  MpdStorageDeviceTile *tile;
-
-  g_object_set_data (G_OBJECT (mount), "mpd-removed-already",
-                     GINT_TO_POINTER (TRUE));
+  MountEntry *entry;
 
-  tile = g_hash_table_lookup (priv->tiles, mount);
-  if (tile)
+  entry = g_hash_table_lookup (priv->mounts, mount);
+  if (entry && MOUNT_STATE_REMOVED != entry->state)
   {
-      g_hash_table_remove (priv->tiles, mount);
-      mpd_storage_device_tile_show_message_full (
-                              MPD_STORAGE_DEVICE_TILE (tile),
+    /* A new mount of the same volume gets its own tile meanwhile. */
+    entry->state = MOUNT_STATE_REMOVED;
+    registry_unindex (self, entry);
+    /* Gone while flushing before the eject. */
+    if (entry->flush_progress_id) {
+      g_source_remove (entry->flush_progress_id);
+      entry->flush_progress_id = 0;
+    }
+    entry->expiration_id = mpd_storage_device_tile_show_message_full (
+                              MPD_STORAGE_DEVICE_TILE (entry->tile),
                               _("It is safe to unplug this device now"),
                               true,
                               15,
                               (GSourceFunc) _unmount_message_expiration_cb,
-                              tile);
-//    clutter_container_remove_actor (CLUTTER_CONTAINER (priv->vbox),
-//                                    CLUTTER_ACTOR (tile));
+                              entry);
+  }
+}
+
+static void
+mount_event_free (MountEvent *event)
+{
+  g_object_unref (event->mount);
+  g_free (event);
+}
+
+/*
+ * Everything that arrived within a frame is applied in one go, so the box
+ * lays out and animates once per burst rather than once per mount.
+ */
+static bool
+_apply_mount_events_cb (MpdDevicesTile *self)
+{
+  MpdDevicesTilePrivate *priv = GET_PRIVATE (self);
+  MountEvent *event;
+
+  priv->events_id = 0;
+
+  while (NULL != (event = g_queue_pop_head (&priv->events)))
+  {
+    switch (event->kind)
+    {
+    case MOUNT_EVENT_ADDED:
+      apply_mount_added (self, event->mount);
+      break;
+    case MOUNT_EVENT_CHANGED:
+      apply_mount_changed (self, event->mount);
+      break;
+    case MOUNT_EVENT_REMOVED:
+      apply_mount_removed (self, event->mount);
+      break;
+    }
+    mount_event_free (event);
   }
+
+  return false;
 }
 
+static MountEvent *
+find_mount_event (MpdDevicesTile  *self,
+                  GMount          *mount)
+{
+  MpdDevicesTilePrivate *priv = GET_PRIVATE (self);
+  GList *iter;
+
+  /* Only as long as a burst. */
+  for (iter = priv->events.tail; iter; iter = iter->prev)
+  {
+    MountEvent *event = iter->data;
+    if (event->mount == mount) {
+      return event;
+    }
+  }
+
+  return NULL;
+}
+
+static void
+queue_mount_event (MpdDevicesTile *self,
+                   MountEventKind  kind,
+                   GMount         *mount)
+{
+  MpdDevicesTilePrivate *priv = GET_PRIVATE (self);
+  MountEvent *last;
+  MountEvent *event;
+
+  last = find_mount_event (self, mount);
+  if (last)
+  {
+    /* Whether it's wanted is looked at when applying the event anyway. */
+    if (MOUNT_EVENT_CHANGED == kind) {
+      return;
+    }
+
+    /* Came and went within the frame, never show it. */
+    if (MOUNT_EVENT_REMOVED == kind &&
+        MOUNT_EVENT_ADDED == last->kind &&
+        NULL == g_hash_table_lookup (priv->mounts, mount)) {
+      g_queue_remove (&priv->events, last);
+      mount_event_free (last);
+      return;
+    }
+  }
+
+  event = g_new0 (MountEvent, 1);
+  event->kind = kind;
+  event->mount = g_object_ref (mount);
+  g_queue_push_tail (&priv->events, event);
+
+  if (0 == priv->events_id) {
+    priv->events_id = g_timeout_add (EVENT_DELAY_MS,
+                                     (GSourceFunc) _apply_mount_events_cb,
+                                     self);
+  }
+}
+
+static void
+_monitor_mount_added_cb (GVolumeMonitor  *monitor,
+                         GMount          *mount,
+                         MpdDevicesTile  *self)
+{
+  queue_mount_event (self, MOUNT_EVENT_ADDED, mount);
+}
+
+static void
+_monitor_mount_changed_cb (GVolumeMonitor *monitor,
+                           GMount         *mount,
+                           MpdDevicesTile *self)
+{
+  queue_mount_event (self, MOUNT_EVENT_CHANGED, mount);
+}
+
+static void
+_monitor_mount_removed_cb (GVolumeMonitor  *monitor,
+                           GMount          *mount,
+                           MpdDevicesTile  *self)
+{
+  queue_mount_event (self, MOUNT_EVENT_REMOVED, mount);
+}
+
+static GObject *
+_constructor (GType                  type,
+              unsigned int           n_properties,
+              GObjectConstructParam *properties)
+{
+  MpdDevicesTile *self = (MpdDevicesTile *)
+                          G_OBJECT_CLASS (mpd_devices_tile_parent_class)
+                            ->constructor (type, n_properties, properties);
+  MpdDevicesTilePrivate *priv = GET_PRIVATE (self);
+  GList *mounts;
+
+  if (NULL == priv->monitor)
+    priv->monitor = g_volume_monitor_get ();
+
+  g_signal_connect (priv->monitor, "mount-added",
+                    G_CALLBACK (_monitor_mount_added_cb), self);
+  g_signal_connect (priv->monitor, "mount-changed",
+                    G_CALLBACK (_monitor_mount_changed_cb), self);
+  g_signal_connect (priv->monitor, "mount-removed",
+                    G_CALLBACK (_monitor_mount_removed_cb), self);
+
+  mounts = g_volume_monitor_get_mounts (priv->monitor);
+  g_list_foreach (mounts, (GFunc) _add_mount_cb, self);
+  g_list_free (mounts);
+
+  return (GObject *) self;
+}
+
+static void
+_get_property (GObject      *object,
+               unsigned int  property_id,
+               GValue       *value,
+               GParamSpec   *pspec)
+{
+  MpdDevicesTilePrivate *priv = GET_PRIVATE (object);
+
+  switch (property_id)
+  {
+  case PROP_VOLUME_MONITOR:
+    g_value_set_object (value, priv->monitor);
+    break;
+  default:
+    G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+  }
+}
+
+static void
+_set_property (GObject      *object,
+               unsigned int  property_id,
+               const GValue *value,
+               GParamSpec   *pspec)
+{
+  MpdDevicesTilePrivate *priv = GET_PRIVATE (object);
+
+  switch (property_id)
+  {
+  case PROP_VOLUME_MONITOR:
+    /* Construct-only. */
+    priv->monitor = g_value_dup_object (value);
+    break;
+  default:
+    G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+  }
+}
 
 static void
 _dispose (GObject *object)
 {
   MpdDevicesTilePrivate *priv = GET_PRIVATE (object);
 
-  g_hash_table_destroy (priv->tiles);
+  if (priv->events_id)
+  {
+    g_source_remove (priv->events_id);
+    priv->events_id = 0;
+  }
+
+  g_queue_foreach (&priv->events, (GFunc) mount_event_free, NULL);
+  g_queue_clear (&priv->events);
+
+  if (priv->cancellable)
+  {
+    g_cancellable_cancel (priv->cancellable);
+    g_object_unref (priv->cancellable);
+    priv->cancellable = NULL;
+  }
+
+  if (priv->content_types)
+  {
+    g_hash_table_destroy (priv->content_types);
+    priv->content_types = NULL;
+  }
+
+  if (priv->mounts)
+  {
+    g_hash_table_destroy (priv->mounts_by_uuid);
+    priv->mounts_by_uuid = NULL;
+    g_hash_table_destroy (priv->mounts_by_uri);
+    priv->mounts_by_uri = NULL;
+    g_hash_table_destroy (priv->mounts);
+    priv->mounts = NULL;
+  }
 
   mpd_gobject_detach (object, (GObject **) &priv->monitor);
 
@@ -575,8 +1146,24 @@ mpd_devices_tile_class_init (MpdDevicesTileClass *klass)
 
   g_type_class_add_private (klass, sizeof (MpdDevicesTilePrivate));
 
+  object_class->constructor = _constructor;
+  object_class->get_property = _get_property;
+  object_class->set_property = _set_property;
   object_class->dispose = _dispose;
 
+  /* Properties */
+
+  /* Tests pass a stand-in, the default is the system's. */
+  g_object_class_install_property (object_class,
+                                   PROP_VOLUME_MONITOR,
+                                   g_param_spec_object ("volume-monitor",
+                                                        "Volume monitor",
+                                                        "Source of mounts",
+                                                        G_TYPE_VOLUME_MONITOR,
+                                                        G_PARAM_READWRITE |
+                                                        G_PARAM_CONSTRUCT_ONLY |
+                                                        G_PARAM_STATIC_STRINGS));
+
   /* Signals */
 
   _signals[REQUEST_HIDE] = g_signal_new ("request-hide",
@@ -599,9 +1186,15 @@ mpd_devices_tile_init (MpdDevicesTile *self)
 {
   MpdDevicesTilePrivate *priv = GET_PRIVATE (self);
   ClutterActor  *tile;
-  GList *mounts;
 
-  priv->tiles = g_hash_table_new (g_direct_hash, g_direct_equal);
+  priv->mounts = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                        NULL,
+                                        (GDestroyNotify) mount_entry_free);
+  priv->mounts_by_uri = g_hash_table_new (g_str_hash, g_str_equal);
+  priv->mounts_by_uuid = g_hash_table_new (g_str_hash, g_str_equal);
+  priv->content_types = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                               g_free, g_free);
+  priv->cancellable = g_cancellable_new ();
 
   priv->vbox = mx_box_layout_new ();
   mx_box_layout_set_enable_animations (MX_BOX_LAYOUT (priv->vbox),
@@ -612,18 +1205,6 @@ mpd_devices_tile_init (MpdDevicesTile *self)
 
   tile = mpd_default_device_tile_new ();
   clutter_container_add_actor (CLUTTER_CONTAINER (priv->vbox), tile);
-
-  priv->monitor = g_volume_monitor_get ();
-  g_signal_connect (priv->monitor, "mount-added",
-                    G_CALLBACK (_monitor_mount_added_cb), self);
-  g_signal_connect (priv->monitor, "mount-changed",
-                    G_CALLBACK (_monitor_mount_changed_cb), self);
-  g_signal_connect (priv->monitor, "mount-removed",
-                    G_CALLBACK (_monitor_mount_removed_cb), self);
-
-  mounts = g_volume_monitor_get_mounts (priv->monitor);
-  g_list_foreach (mounts, (GFunc) _add_mount_cb, self);
-  g_list_free (mounts);
 }
 
 ClutterActor *
@@ -0,0 +1,420 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/statvfs.h>
+
+#include "mpd-free-space.h"
+#include "config.h"
+
+/*
+ * All paths are polled from one timer, g_timeout_add_seconds() also aligns
+ * it with the other per-second timers of the process. The interval drops
+ * while an import is running, and polling stops while the panel is hidden.
+ * A path whose statvfs() is still outstanding is not queried again. When
+ * that takes longer than QUERY_TIMEOUT_S, watches are notified that there
+ * is no value, but the path is only queried again once the thread returns,
+ * so a hung mount blocks no more than one thread. Failures are notified
+ * the same way and the next poll tries again.
+ */
+
+#define POLL_INTERVAL_S       60
+#define POLL_INTERVAL_BUSY_S  5
+#define QUERY_TIMEOUT_S       5
+
+typedef struct
+{
+  unsigned int          id;
+  MpdFreeSpaceCallback  callback;
+  void                 *data;
+} Watch;
+
+struct MpdFreeSpace_
+{
+  unsigned int   ref_count;
+  char          *path;
+  int64_t        size;
+  int64_t        available_size;
+  bool           valid;
+  bool           in_flight;
+  bool           stuck;         /* In flight past the timeout. */
+  GSList        *watches;
+};
+
+typedef struct
+{
+  MpdFreeSpace  *space;
+  unsigned int   timeout_id;
+  int            error;
+  int64_t        size;
+  int64_t        available_size;
+} Query;
+
+static GHashTable   *_spaces = NULL;    /* path -> MpdFreeSpace, unowned */
+static unsigned int  _poll_id = 0;
+static unsigned int  _poll_interval = 0;
+static unsigned int  _n_busy = 0;
+static bool          _suspended = false;
+static unsigned int  _next_watch_id = 1;
+
+static bool
+_query_done_cb (Query *query);
+
+/* Runs in a worker thread. */
+static void
+_query_cb (Query  *query,
+           void   *data)
+{
+  struct statvfs fsd = { 0, };
+
+  if (0 == statvfs (query->space->path, &fsd))
+  {
+    query->size = (int64_t) fsd.f_blocks * fsd.f_frsize;
+    query->available_size = (int64_t) fsd.f_bavail * fsd.f_frsize;
+  } else {
+    query->error = errno;
+  }
+
+  g_idle_add ((GSourceFunc) _query_done_cb, query);
+}
+
+static GThreadPool *
+get_thread_pool (void)
+{
+  static GThreadPool *_pool = NULL;
+  GError *error = NULL;
+
+  if (_pool)
+    return _pool;
+
+  if (!g_thread_supported ())
+    g_thread_init (NULL);
+
+  /* Unbounded, a thread stuck on a hung mount must not hold up others. */
+  _pool = g_thread_pool_new ((GFunc) _query_cb, NULL, -1, false, &error);
+  if (error)
+  {
+    g_critical ("%s : %s", G_STRLOC, error->message);
+    g_clear_error (&error);
+  }
+
+  return _pool;
+}
+
+/*
+ * Watches get -1 for both sizes when there is no current value.
+ */
+static void
+notify (MpdFreeSpace *self)
+{
+  int64_t  size = self->valid ? self->size : -1;
+  int64_t  available_size = self->valid ? self->available_size : -1;
+  GSList *iter;
+  GSList *next;
+
+  mpd_free_space_ref (self);
+  for (iter = self->watches; iter; iter = next)
+  {
+    Watch *watch = (Watch *) iter->data;
+    next = iter->next;
+    watch->callback (self, size, available_size, watch->data);
+  }
+  mpd_free_space_unref (self);
+}
+
+static void
+invalidate (MpdFreeSpace *self)
+{
+  self->valid = false;
+  notify (self);
+}
+
+static bool
+_query_timeout_cb (Query *query)
+{
+  MpdFreeSpace *self = query->space;
+
+  query->timeout_id = 0;
+
+  g_warning ("%s : %s: No answer after %d seconds",
+             G_STRLOC, self->path, QUERY_TIMEOUT_S);
+
+  /* It may never return, don't pile up more threads behind it. */
+  self->stuck = true;
+  invalidate (self);
+
+  return false;
+}
+
+static bool
+_query_done_cb (Query *query)
+{
+  MpdFreeSpace *self = query->space;
+
+  if (query->timeout_id)
+    g_source_remove (query->timeout_id);
+
+  if (self->stuck)
+    g_debug ("%s() %s answered after all", __FUNCTION__, self->path);
+
+  self->in_flight = false;
+  self->stuck = false;
+
+  if (query->error)
+  {
+    g_warning ("%s : %s: %s", G_STRLOC, self->path, strerror (query->error));
+    invalidate (self);
+  } else if (!self->valid ||
+             query->size != self->size ||
+             query->available_size != self->available_size) {
+    self->valid = true;
+    self->size = query->size;
+    self->available_size = query->available_size;
+    notify (self);
+  }
+
+  mpd_free_space_unref (self);
+  g_free (query);
+  return false;
+}
+
+static void
+query (MpdFreeSpace *self)
+{
+  Query   *query;
+  GError  *error = NULL;
+
+  if (self->in_flight)
+    return;
+
+  query = g_new0 (Query, 1);
+  query->space = mpd_free_space_ref (self);
+  query->timeout_id = g_timeout_add_seconds (QUERY_TIMEOUT_S,
+                                             (GSourceFunc) _query_timeout_cb,
+                                             query);
+  self->in_flight = true;
+
+  g_thread_pool_push (get_thread_pool (), query, &error);
+  if (error)
+  {
+    g_critical ("%s : %s", G_STRLOC, error->message);
+    g_clear_error (&error);
+  }
+}
+
+static void
+_query_each_cb (char const    *path,
+                MpdFreeSpace  *self,
+                void          *data)
+{
+  query (self);
+}
+
+static bool
+_poll_cb (void *data)
+{
+  g_hash_table_foreach (_spaces, (GHFunc) _query_each_cb, NULL);
+  return true;
+}
+
+static void
+reschedule (void)
+{
+  unsigned int interval = _n_busy ? POLL_INTERVAL_BUSY_S : POLL_INTERVAL_S;
+  bool         active = !_suspended &&
+                        _spaces &&
+                        g_hash_table_size (_spaces);
+
+  if (_poll_id &&
+      (!active || interval != _poll_interval))
+  {
+    g_source_remove (_poll_id);
+    _poll_id = 0;
+  }
+
+  if (0 == _poll_id &&
+      active)
+  {
+    _poll_interval = interval;
+    _poll_id = g_timeout_add_seconds (interval, (GSourceFunc) _poll_cb, NULL);
+  }
+}
+
+/*
+ * Returns the shared instance for `path', querying it right away if it's
+ * new. The value is available once the first watch notification arrives.
+ */
+MpdFreeSpace *
+mpd_free_space_open (char const *path)
+{
+  MpdFreeSpace *self;
+
+  g_return_val_if_fail (path, NULL);
+
+  if (NULL == _spaces)
+    _spaces = g_hash_table_new (g_str_hash, g_str_equal);
+
+  self = (MpdFreeSpace *) g_hash_table_lookup (_spaces, path);
+  if (self)
+    return mpd_free_space_ref (self);
+
+  self = g_new0 (MpdFreeSpace, 1);
+  self->ref_count = 1;
+  self->path = g_strdup (path);
+  g_hash_table_insert (_spaces, self->path, self);
+
+  query (self);
+  reschedule ();
+
+  return self;
+}
+
+MpdFreeSpace *
+mpd_free_space_ref (MpdFreeSpace *self)
+{
+  g_return_val_if_fail (self, NULL);
+
+  self->ref_count++;
+  return self;
+}
+
+void
+mpd_free_space_unref (MpdFreeSpace *self)
+{
+  g_return_if_fail (self);
+
+  if (--self->ref_count)
+    return;
+
+  g_hash_table_remove (_spaces, self->path);
+  reschedule ();
+
+  g_slist_foreach (self->watches, (GFunc) g_free, NULL);
+  g_slist_free (self->watches);
+  g_free (self->path);
+  g_free (self);
+}
+
+unsigned int
+mpd_free_space_add_watch (MpdFreeSpace          *self,
+                          MpdFreeSpaceCallback   callback,
+                          void                  *data)
+{
+  Watch *watch;
+
+  g_return_val_if_fail (self, 0);
+  g_return_val_if_fail (callback, 0);
+
+  watch = g_new0 (Watch, 1);
+  watch->id = _next_watch_id++;
+  watch->callback = callback;
+  watch->data = data;
+  self->watches = g_slist_append (self->watches, watch);
+
+  return watch->id;
+}
+
+void
+mpd_free_space_remove_watch (MpdFreeSpace *self,
+                             unsigned int  watch_id)
+{
+  GSList *iter;
+
+  g_return_if_fail (self);
+
+  for (iter = self->watches; iter; iter = iter->next)
+  {
+    Watch *watch = (Watch *) iter->data;
+    if (watch->id == watch_id)
+    {
+      self->watches = g_slist_delete_link (self->watches, iter);
+      g_free (watch);
+      return;
+    }
+  }
+}
+
+/*
+ * Returns false if there is no current value, either because the first
+ * query is still outstanding or the last one failed or timed out.
+ */
+bool
+mpd_free_space_get (MpdFreeSpace  *self,
+                    int64_t       *size,
+                    int64_t       *available_size)
+{
+  g_return_val_if_fail (self, false);
+
+  if (size)
+    *size = self->size;
+  if (available_size)
+    *available_size = self->available_size;
+
+  return self->valid;
+}
+
+void
+mpd_free_space_update (MpdFreeSpace *self)
+{
+  g_return_if_fail (self);
+
+  query (self);
+}
+
+/*
+ * Poll faster while something, like an import, is changing free space.
+ * Calls nest.
+ */
+void
+mpd_free_space_hold_busy (void)
+{
+  _n_busy++;
+  reschedule ();
+}
+
+void
+mpd_free_space_release_busy (void)
+{
+  g_return_if_fail (_n_busy > 0);
+
+  _n_busy--;
+  reschedule ();
+}
+
+/*
+ * Nobody looks at the numbers while the panel is hidden. Resuming
+ * refreshes all paths right away.
+ */
+void
+mpd_free_space_set_suspended (bool suspended)
+{
+  if (suspended == _suspended)
+    return;
+
+  _suspended = suspended;
+  if (!_suspended &&
+      _spaces)
+    _poll_cb (NULL);
+
+  reschedule ();
+}
+
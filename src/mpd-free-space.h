@@ -0,0 +1,83 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPD_FREE_SPACE_H
+#define MPD_FREE_SPACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Size and free space of the file system a path is on, shared by all users
+ * of the same path. statvfs() runs in a worker thread so a hung mount can
+ * not block the main loop, results are delivered through watches in the
+ * main context. A failed or timed out query is delivered too, with both
+ * sizes -1.
+ */
+
+typedef struct MpdFreeSpace_ MpdFreeSpace;
+
+typedef void (*MpdFreeSpaceCallback) (MpdFreeSpace  *space,
+                                      int64_t        size,
+                                      int64_t        available_size,
+                                      void          *data);
+
+MpdFreeSpace *
+mpd_free_space_open (char const *path);
+
+MpdFreeSpace *
+mpd_free_space_ref (MpdFreeSpace *self);
+
+void
+mpd_free_space_unref (MpdFreeSpace *self);
+
+unsigned int
+mpd_free_space_add_watch (MpdFreeSpace          *self,
+                          MpdFreeSpaceCallback   callback,
+                          void                  *data);
+
+void
+mpd_free_space_remove_watch (MpdFreeSpace *self,
+                             unsigned int  watch_id);
+
+bool
+mpd_free_space_get (MpdFreeSpace  *self,
+                    int64_t       *size,
+                    int64_t       *available_size);
+
+void
+mpd_free_space_update (MpdFreeSpace *self);
+
+void
+mpd_free_space_hold_busy (void);
+
+void
+mpd_free_space_release_busy (void);
+
+void
+mpd_free_space_set_suspended (bool suspended);
+
+G_END_DECLS
+
+#endif /* MPD_FREE_SPACE_H */
+
@@ -0,0 +1,480 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+
+#include "mpd-import-journal.h"
+#include "config.h"
+
+/*
+ * One tab separated record per line, paths escaped:
+ *   D <category> <target dir>
+ *   F <size> <source path> <target path>
+ * Records are buffered and written plus fdatasync()ed in a worker thread,
+ * once per FLUSH_RECORDS records or FLUSH_TIMEOUT_S seconds. Only one
+ * flush is in flight at a time, keeping records in order.
+ */
+
+#define FLUSH_RECORDS   64
+#define FLUSH_TIMEOUT_S 2
+
+typedef struct
+{
+  uint64_t   size;
+  char      *target_path;
+} Entry;
+
+struct MpdImportJournal_
+{
+  unsigned int   ref_count;
+  char          *path;
+  char          *root;
+  int            fd;
+  GHashTable    *entries;   /* Relative source path -> Entry */
+  char          *dirs[MPD_MEDIA_CATEGORY_LAST];
+
+  GString       *pending;
+  unsigned int   n_pending;
+  unsigned int   flush_timeout_id;
+  bool           flushing;
+};
+
+typedef struct
+{
+  int        fd;
+  GString   *buffer;
+} FlushData;
+
+static void
+entry_free (Entry *entry)
+{
+  g_free (entry->target_path);
+  g_free (entry);
+}
+
+static char *
+get_journal_path (char const *key)
+{
+  char *checksum;
+  char *filename;
+  char *path;
+
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_MD5, key, -1);
+  filename = g_strdup_printf ("%s.journal", checksum);
+  path = g_build_filename (g_get_user_cache_dir (), "meego-panel-devices",
+                           "import", filename, NULL);
+  g_free (filename);
+  g_free (checksum);
+
+  return path;
+}
+
+static char const *
+get_relative_path (MpdImportJournal *self,
+                   char const       *path)
+{
+  size_t len = strlen (self->root);
+
+  if (0 != strncmp (self->root, path, len))
+    return NULL;
+
+  path += len;
+  while (*path == G_DIR_SEPARATOR)
+    path++;
+
+  return path;
+}
+
+static void
+parse_line (MpdImportJournal *self,
+            char const       *line)
+{
+  char **fields;
+
+  fields = g_strsplit (line, "\t", 4);
+
+  if (0 == g_strcmp0 (fields[0], "D") &&
+      fields[1] && fields[2])
+  {
+    unsigned int category = g_ascii_strtoull (fields[1], NULL, 10);
+    if (category > MPD_MEDIA_CATEGORY_NONE &&
+        category < MPD_MEDIA_CATEGORY_LAST)
+    {
+      g_free (self->dirs[category]);
+      self->dirs[category] = g_strcompress (fields[2]);
+    }
+
+  } else if (0 == g_strcmp0 (fields[0], "F") &&
+             fields[1] && fields[2] && fields[3]) {
+
+    Entry *entry = g_new0 (Entry, 1);
+    entry->size = g_ascii_strtoull (fields[1], NULL, 16);
+    entry->target_path = g_strcompress (fields[3]);
+    g_hash_table_insert (self->entries, g_strcompress (fields[2]), entry);
+  }
+
+  g_strfreev (fields);
+}
+
+static void
+load (MpdImportJournal *self)
+{
+  char    *contents = NULL;
+  char   **lines;
+  GError  *error = NULL;
+  unsigned int i;
+
+  g_file_get_contents (self->path, &contents, NULL, &error);
+  if (error)
+  {
+    if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+      g_warning ("%s : %s", G_STRLOC, error->message);
+    g_clear_error (&error);
+    return;
+  }
+
+  /* A torn last line after a crash is simply not terminated, skip it. */
+  lines = g_strsplit (contents, "\n", -1);
+  for (i = 0; lines[i] && lines[i + 1]; i++)
+    parse_line (self, lines[i]);
+
+  g_strfreev (lines);
+  g_free (contents);
+}
+
+static bool
+ensure_open (MpdImportJournal *self)
+{
+  char *dirname;
+
+  if (self->fd >= 0)
+    return true;
+
+  dirname = g_path_get_dirname (self->path);
+  g_mkdir_with_parents (dirname, 0700);
+  g_free (dirname);
+
+  self->fd = open (self->path, O_WRONLY | O_APPEND | O_CREAT, 0600);
+  if (self->fd < 0)
+  {
+    g_warning ("%s : %s: %s", G_STRLOC, self->path, g_strerror (errno));
+    return false;
+  }
+
+  return true;
+}
+
+static void
+_flush_thread_cb (GSimpleAsyncResult *result,
+                  GObject            *object,
+                  GCancellable       *cancellable)
+{
+  FlushData   *data = g_simple_async_result_get_op_res_gpointer (result);
+  char const  *p = data->buffer->str;
+  size_t       len = data->buffer->len;
+
+  while (len)
+  {
+    ssize_t n = write (data->fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+    {
+      g_warning ("%s : %s", G_STRLOC, g_strerror (errno));
+      return;
+    }
+    p += n;
+    len -= n;
+  }
+
+  fdatasync (data->fd);
+}
+
+static void
+flush_data_free (FlushData *data)
+{
+  g_string_free (data->buffer, true);
+  g_free (data);
+}
+
+static void
+_flush_cb (GObject          *source,
+           GAsyncResult     *res,
+           MpdImportJournal *self)
+{
+  self->flushing = false;
+
+  /* More piled up meanwhile. A flush requested during this one was
+   * dropped along with its timeout, so write out whatever is pending. */
+  if (self->n_pending > 0)
+    mpd_import_journal_flush (self);
+
+  mpd_import_journal_unref (self);
+}
+
+static bool
+_flush_timeout_cb (MpdImportJournal *self)
+{
+  self->flush_timeout_id = 0;
+  mpd_import_journal_flush (self);
+  mpd_import_journal_unref (self);
+  return false;
+}
+
+static void
+append_record (MpdImportJournal *self,
+               char const       *record)
+{
+  g_string_append (self->pending, record);
+  self->n_pending++;
+
+  if (self->n_pending >= FLUSH_RECORDS)
+    mpd_import_journal_flush (self);
+  else if (0 == self->flush_timeout_id)
+    self->flush_timeout_id =
+      g_timeout_add_seconds (FLUSH_TIMEOUT_S,
+                             (GSourceFunc) _flush_timeout_cb,
+                             mpd_import_journal_ref (self));
+}
+
+/*
+ * Opens the journal for the volume identified by `key', loading what an
+ * earlier import recorded. The file is only created when writing to it.
+ */
+MpdImportJournal *
+mpd_import_journal_open (char const *key,
+                         char const *root)
+{
+  MpdImportJournal *self;
+
+  g_return_val_if_fail (key, NULL);
+  g_return_val_if_fail (root, NULL);
+
+  self = g_new0 (MpdImportJournal, 1);
+  self->ref_count = 1;
+  self->path = get_journal_path (key);
+  self->root = g_strdup (root);
+  self->fd = -1;
+  self->entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                         g_free, (GDestroyNotify) entry_free);
+  self->pending = g_string_new (NULL);
+
+  load (self);
+
+  return self;
+}
+
+MpdImportJournal *
+mpd_import_journal_ref (MpdImportJournal *self)
+{
+  g_return_val_if_fail (self, NULL);
+
+  self->ref_count++;
+  return self;
+}
+
+void
+mpd_import_journal_unref (MpdImportJournal *self)
+{
+  unsigned int i;
+
+  g_return_if_fail (self);
+
+  if (--self->ref_count)
+    return;
+
+  /* The timeout and flushes hold references, nothing is pending here. */
+  if (self->fd >= 0)
+    close (self->fd);
+
+  for (i = 0; i < G_N_ELEMENTS (self->dirs); i++)
+    g_free (self->dirs[i]);
+
+  g_string_free (self->pending, true);
+  g_hash_table_destroy (self->entries);
+  g_free (self->root);
+  g_free (self->path);
+  g_free (self);
+}
+
+/* Target directory used by the interrupted import, if any. */
+char const *
+mpd_import_journal_get_dir (MpdImportJournal  *self,
+                            MpdMediaCategory   category)
+{
+  g_return_val_if_fail (self, NULL);
+  g_return_val_if_fail (category < MPD_MEDIA_CATEGORY_LAST, NULL);
+
+  return self->dirs[category];
+}
+
+void
+mpd_import_journal_set_dir (MpdImportJournal  *self,
+                            MpdMediaCategory   category,
+                            char const        *path)
+{
+  char *escaped;
+  char *record;
+
+  g_return_if_fail (self);
+  g_return_if_fail (category < MPD_MEDIA_CATEGORY_LAST);
+  g_return_if_fail (path);
+
+  if (0 == g_strcmp0 (self->dirs[category], path))
+    return;
+
+  g_free (self->dirs[category]);
+  self->dirs[category] = g_strdup (path);
+
+  escaped = g_strescape (path, NULL);
+  record = g_strdup_printf ("D\t%u\t%s\n", category, escaped);
+  append_record (self, record);
+  g_free (record);
+  g_free (escaped);
+}
+
+/*
+ * Whether the file was imported by the interrupted run, and its copy is
+ * still there.
+ */
+bool
+mpd_import_journal_lookup (MpdImportJournal  *self,
+                           char const        *source_path,
+                           uint64_t           size)
+{
+  char const  *rel_path;
+  Entry       *entry;
+  struct stat  st;
+
+  g_return_val_if_fail (self, false);
+  g_return_val_if_fail (source_path, false);
+
+  rel_path = get_relative_path (self, source_path);
+  if (NULL == rel_path)
+    return false;
+
+  entry = g_hash_table_lookup (self->entries, rel_path);
+  if (NULL == entry ||
+      entry->size != size)
+    return false;
+
+  return 0 == stat (entry->target_path, &st) &&
+         (uint64_t) st.st_size == size;
+}
+
+void
+mpd_import_journal_add (MpdImportJournal  *self,
+                        char const        *source_path,
+                        char const        *target_path,
+                        uint64_t           size)
+{
+  char const  *rel_path;
+  char        *escaped_source;
+  char        *escaped_target;
+  char        *record;
+
+  g_return_if_fail (self);
+  g_return_if_fail (source_path);
+  g_return_if_fail (target_path);
+
+  rel_path = get_relative_path (self, source_path);
+  if (NULL == rel_path)
+    return;
+
+  escaped_source = g_strescape (rel_path, NULL);
+  escaped_target = g_strescape (target_path, NULL);
+  record = g_strdup_printf ("F\t%" G_GINT64_MODIFIER "x\t%s\t%s\n",
+                            size, escaped_source, escaped_target);
+  append_record (self, record);
+  g_free (record);
+  g_free (escaped_target);
+  g_free (escaped_source);
+}
+
+/* Write out and sync pending records in the background. */
+void
+mpd_import_journal_flush (MpdImportJournal *self)
+{
+  GSimpleAsyncResult  *result;
+  FlushData           *data;
+
+  g_return_if_fail (self);
+
+  if (self->flush_timeout_id)
+  {
+    g_source_remove (self->flush_timeout_id);
+    self->flush_timeout_id = 0;
+    mpd_import_journal_unref (self);
+  }
+
+  if (self->flushing ||
+      0 == self->n_pending ||
+      !ensure_open (self))
+    return;
+
+  data = g_new0 (FlushData, 1);
+  data->fd = self->fd;
+  data->buffer = self->pending;
+  self->pending = g_string_new (NULL);
+  self->n_pending = 0;
+  self->flushing = true;
+
+  result = g_simple_async_result_new (NULL,
+                                      (GAsyncReadyCallback) _flush_cb,
+                                      mpd_import_journal_ref (self),
+                                      mpd_import_journal_flush);
+  g_simple_async_result_set_op_res_gpointer (result, data,
+                                             (GDestroyNotify) flush_data_free);
+  g_simple_async_result_run_in_thread (result,
+                                       (GSimpleAsyncThreadFunc)
+                                         _flush_thread_cb,
+                                       G_PRIORITY_DEFAULT,
+                                       NULL);
+  g_object_unref (result);
+}
+
+/* The import finished, nothing to resume any more. */
+void
+mpd_import_journal_complete (MpdImportJournal *self)
+{
+  g_return_if_fail (self);
+
+  if (self->flush_timeout_id)
+  {
+    g_source_remove (self->flush_timeout_id);
+    self->flush_timeout_id = 0;
+    mpd_import_journal_unref (self);
+  }
+
+  g_string_truncate (self->pending, 0);
+  self->n_pending = 0;
+  g_hash_table_remove_all (self->entries);
+
+  if (0 != unlink (self->path) &&
+      errno != ENOENT)
+    g_warning ("%s : %s: %s", G_STRLOC, self->path, g_strerror (errno));
+}
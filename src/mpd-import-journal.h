@@ -0,0 +1,79 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPD_IMPORT_JOURNAL_H
+#define MPD_IMPORT_JOURNAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <glib.h>
+
+#include "mpd-media-scanner.h"
+
+G_BEGIN_DECLS
+
+/*
+ * Append-only record of an import in progress from one source volume,
+ * so an interrupted import resumes where it stopped. Source paths are
+ * relative to the volume's mount root, which may differ next time.
+ */
+
+typedef struct MpdImportJournal_ MpdImportJournal;
+
+MpdImportJournal *
+mpd_import_journal_open (char const *key,
+                         char const *root);
+
+MpdImportJournal *
+mpd_import_journal_ref (MpdImportJournal *self);
+
+void
+mpd_import_journal_unref (MpdImportJournal *self);
+
+char const *
+mpd_import_journal_get_dir (MpdImportJournal  *self,
+                            MpdMediaCategory   category);
+
+void
+mpd_import_journal_set_dir (MpdImportJournal  *self,
+                            MpdMediaCategory   category,
+                            char const        *path);
+
+bool
+mpd_import_journal_lookup (MpdImportJournal  *self,
+                           char const        *source_path,
+                           uint64_t           size);
+
+void
+mpd_import_journal_add (MpdImportJournal  *self,
+                        char const        *source_path,
+                        char const        *target_path,
+                        uint64_t           size);
+
+void
+mpd_import_journal_flush (MpdImportJournal *self);
+
+void
+mpd_import_journal_complete (MpdImportJournal *self);
+
+G_END_DECLS
+
+#endif /* MPD_IMPORT_JOURNAL_H */
+
@@ -0,0 +1,167 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "mpd-import-stats.h"
+#include "config.h"
+
+/* Time constant of the moving averages. */
+#define RATE_TAU_S 5.0
+
+/* Rates from very short intervals are mostly noise. */
+#define MIN_SAMPLE_INTERVAL_US 100000
+
+/*
+ * Microseconds, only differences are meaningful. Monotonic where
+ * available, so wall clock changes don't make for huge intervals.
+ */
+int64_t
+mpd_import_stats_get_time (void)
+{
+#if defined (HAVE_CLOCK_GETTIME) && defined (CLOCK_MONOTONIC)
+  struct timespec now;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return (int64_t) now.tv_sec * G_USEC_PER_SEC + now.tv_nsec / 1000;
+#else
+  GTimeVal now;
+
+  g_get_current_time (&now);
+  return (int64_t) now.tv_sec * G_USEC_PER_SEC + now.tv_usec;
+#endif
+}
+
+/*
+ * Starts over, `done_size' and `done_files' being what's done already
+ * when resuming. Those are not counted towards the rates.
+ */
+void
+mpd_import_stats_reset (MpdImportStats *self,
+                        uint64_t        total_size,
+                        unsigned int    total_files,
+                        uint64_t        done_size,
+                        unsigned int    done_files)
+{
+  g_return_if_fail (self);
+
+  memset (self, 0, sizeof (*self));
+  self->total_size = total_size;
+  self->total_files = total_files;
+  self->done_size = done_size;
+  self->done_files = done_files;
+  self->eta = -1;
+
+  self->sample_time = mpd_import_stats_get_time ();
+  self->sample_size = done_size;
+  self->sample_files = done_files;
+}
+
+static double
+average (double  rate,
+         double  sample,
+         double  weight,
+         bool    first)
+{
+  return first ? sample : rate + weight * (sample - rate);
+}
+
+/*
+ * Samples are weighted by the time they cover, so irregular sampling
+ * does not skew the rates.
+ */
+void
+mpd_import_stats_sample (MpdImportStats *self,
+                         uint64_t        done_size,
+                         unsigned int    done_files)
+{
+  int64_t  now;
+  int64_t  interval;
+  int64_t  size_delta;
+  int64_t  files_delta;
+  double   seconds;
+  double   weight;
+  bool     first;
+
+  g_return_if_fail (self);
+
+  self->done_size = done_size;
+  self->done_files = done_files;
+
+  now = mpd_import_stats_get_time ();
+  interval = now - self->sample_time;
+  if (interval < MIN_SAMPLE_INTERVAL_US)
+  {
+    /* Clock went backwards, start a new interval. */
+    if (interval < 0)
+      self->sample_time = now;
+    return;
+  }
+
+  seconds = (double) interval / G_USEC_PER_SEC;
+  /* First order approximation of 1 - e^(-t/tau), no libm needed. */
+  weight = seconds / (RATE_TAU_S + seconds);
+  first = self->byte_rate == 0.0 && self->file_rate == 0.0;
+
+  /* Partial copies stop counting when they are retried or fail, that's
+   * no negative rate. */
+  size_delta = (int64_t) done_size - (int64_t) self->sample_size;
+  files_delta = (int64_t) done_files - (int64_t) self->sample_files;
+  self->byte_rate = average (self->byte_rate,
+                             MAX (size_delta, 0) / seconds,
+                             weight, first);
+  self->file_rate = average (self->file_rate,
+                             MAX (files_delta, 0) / seconds,
+                             weight, first);
+
+  self->sample_time = now;
+  self->sample_size = done_size;
+  self->sample_files = done_files;
+
+  if (done_size >= self->total_size)
+    self->eta = 0;
+  else if (self->byte_rate >= 1.0)
+    self->eta = (int) ((self->total_size - done_size) / self->byte_rate + 0.5);
+  else
+    self->eta = -1;
+}
+
+void
+mpd_import_stats_add_latency (MpdImportStats *self,
+                              int64_t         latency_us)
+{
+  unsigned int bucket = 0;
+  int64_t      ms;
+
+  g_return_if_fail (self);
+
+  ms = latency_us / 1000;
+  while (ms > 0 &&
+         bucket < MPD_IMPORT_STATS_N_LATENCY_BUCKETS - 1)
+  {
+    ms >>= 1;
+    bucket++;
+  }
+
+  self->latency[bucket]++;
+}
+
@@ -0,0 +1,81 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPD_IMPORT_STATS_H
+#define MPD_IMPORT_STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Live counters of an import. Rates are exponentially weighted moving
+ * averages over the samples taken, so they settle within a few seconds
+ * without jumping around with every file.
+ *
+ * Copy latencies are counted in power of two buckets: bucket 0 holds
+ * copies under 1 ms, bucket i those from 2^(i-1) up to 2^i ms, the last
+ * bucket everything longer.
+ */
+
+#define MPD_IMPORT_STATS_N_LATENCY_BUCKETS 16
+
+typedef struct
+{
+  uint64_t      total_size;
+  unsigned int  total_files;
+  uint64_t      done_size;
+  unsigned int  done_files;
+  double        byte_rate;    /* Bytes per second. */
+  double        file_rate;    /* Files per second. */
+  int           eta;          /* Seconds remaining, -1 if unknown. */
+  unsigned int  latency[MPD_IMPORT_STATS_N_LATENCY_BUCKETS];
+
+  /* Private. */
+  int64_t       sample_time;
+  uint64_t      sample_size;
+  unsigned int  sample_files;
+} MpdImportStats;
+
+void
+mpd_import_stats_reset (MpdImportStats *self,
+                        uint64_t        total_size,
+                        unsigned int    total_files,
+                        uint64_t        done_size,
+                        unsigned int    done_files);
+
+void
+mpd_import_stats_sample (MpdImportStats *self,
+                         uint64_t        done_size,
+                         unsigned int    done_files);
+
+void
+mpd_import_stats_add_latency (MpdImportStats *self,
+                              int64_t         latency_us);
+
+int64_t
+mpd_import_stats_get_time (void);
+
+G_END_DECLS
+
+#endif /* MPD_IMPORT_STATS_H */
+
@@ -0,0 +1,233 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdbool.h>
+
+#include "mpd-block-stat.h"
+#include "mpd-import-stats.h"
+#include "mpd-io-meter.h"
+#include "config.h"
+
+#define SAMPLE_INTERVAL_ACTIVE_S  1
+#define SAMPLE_INTERVAL_IDLE_S    5
+
+struct MpdIoMeter_
+{
+  char                *stat_path;     /* NULL if not backed by a block device. */
+  MpdBlockStat         stat;
+  int64_t              sample_time;
+  bool                 active;
+  MpdIoMeterCallback   callback;
+  void                *data;
+};
+
+static GSList        *_meters = NULL;
+static unsigned int   _sample_id = 0;
+static unsigned int   _sample_interval = 0;
+static bool           _suspended = false;
+
+static void
+reset (MpdIoMeter *self)
+{
+  if (self->stat_path &&
+      mpd_block_stat_read (self->stat_path, &self->stat))
+  {
+    self->sample_time = mpd_import_stats_get_time ();
+  }
+}
+
+static uint64_t
+get_rate (uint64_t sectors,
+          uint64_t last_sectors,
+          int64_t  elapsed_us)
+{
+  /* Counters start over when the device is re-attached. */
+  if (sectors < last_sectors ||
+      elapsed_us <= 0)
+    return 0;
+
+  return (sectors - last_sectors) * MPD_BLOCK_STAT_SECTOR_SIZE *
+         G_USEC_PER_SEC / elapsed_us;
+}
+
+static void
+sample (MpdIoMeter *self)
+{
+  MpdBlockStat  stat;
+  int64_t       now;
+  bool          active;
+
+  if (NULL == self->stat_path ||
+      !mpd_block_stat_read (self->stat_path, &stat))
+    return;
+
+  now = mpd_import_stats_get_time ();
+  active = stat.read_sectors != self->stat.read_sectors ||
+           stat.write_sectors != self->stat.write_sectors ||
+           stat.in_flight > 0;
+
+  /* Going idle is reported once, so the numbers can be taken down. */
+  if (active || self->active)
+  {
+    int64_t elapsed_us = now - self->sample_time;
+
+    self->callback (self,
+                    get_rate (stat.read_sectors, self->stat.read_sectors,
+                              elapsed_us),
+                    get_rate (stat.write_sectors, self->stat.write_sectors,
+                              elapsed_us),
+                    stat.in_flight,
+                    self->data);
+  }
+
+  self->stat = stat;
+  self->sample_time = now;
+  self->active = active;
+}
+
+static void
+reschedule (void);
+
+static bool
+_sample_cb (void *data)
+{
+  g_slist_foreach (_meters, (GFunc) sample, NULL);
+  reschedule ();
+  return true;
+}
+
+static void
+reschedule (void)
+{
+  unsigned int   interval = SAMPLE_INTERVAL_IDLE_S;
+  GSList        *iter;
+
+  for (iter = _meters; iter; iter = iter->next)
+  {
+    MpdIoMeter *meter = (MpdIoMeter *) iter->data;
+    if (meter->active)
+    {
+      interval = SAMPLE_INTERVAL_ACTIVE_S;
+      break;
+    }
+  }
+
+  if (_sample_id &&
+      (_suspended || NULL == _meters || interval != _sample_interval))
+  {
+    g_source_remove (_sample_id);
+    _sample_id = 0;
+  }
+
+  if (0 == _sample_id &&
+      !_suspended &&
+      _meters)
+  {
+    _sample_interval = interval;
+    _sample_id = g_timeout_add_seconds (interval,
+                                        (GSourceFunc) _sample_cb,
+                                        NULL);
+  }
+}
+
+/*
+ * Paths that are not on a block device, like network shares, get a meter
+ * that never reports anything.
+ */
+MpdIoMeter *
+mpd_io_meter_new (char const          *path,
+                  MpdIoMeterCallback   callback,
+                  void                *data)
+{
+  MpdIoMeter  *self;
+
+  g_return_val_if_fail (path, NULL);
+  g_return_val_if_fail (callback, NULL);
+
+  self = g_new0 (MpdIoMeter, 1);
+  self->callback = callback;
+  self->data = data;
+
+  self->stat_path = mpd_block_stat_get_path (path);
+  if (self->stat_path)
+  {
+    reset (self);
+    _meters = g_slist_prepend (_meters, self);
+    reschedule ();
+  }
+
+  return self;
+}
+
+void
+mpd_io_meter_free (MpdIoMeter *self)
+{
+  g_return_if_fail (self);
+
+  if (self->stat_path)
+  {
+    _meters = g_slist_remove (_meters, self);
+    reschedule ();
+  }
+
+  g_free (self->stat_path);
+  g_free (self);
+}
+
+bool
+mpd_io_meter_is_active (MpdIoMeter *self)
+{
+  g_return_val_if_fail (self, false);
+
+  return self->active;
+}
+
+/*
+ * Nobody looks at the numbers while the panel is hidden. Busy meters are
+ * reported idle when suspending, and counting starts over when resuming
+ * so the first rates are not averaged over the hidden time.
+ */
+void
+mpd_io_meter_set_suspended (bool suspended)
+{
+  GSList *iter;
+
+  if (suspended == _suspended)
+    return;
+
+  _suspended = suspended;
+  for (iter = _meters; iter; iter = iter->next)
+  {
+    MpdIoMeter *meter = (MpdIoMeter *) iter->data;
+
+    if (_suspended &&
+        meter->active)
+    {
+      meter->active = false;
+      meter->callback (meter, 0, 0, 0, meter->data);
+    }
+
+    if (!_suspended)
+      reset (meter);
+  }
+
+  reschedule ();
+}
+
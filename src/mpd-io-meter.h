@@ -0,0 +1,66 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPD_IO_METER_H
+#define MPD_IO_METER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Read and write throughput of the block device a path is on, from the
+ * deltas of its /sys/dev/block/<major>:<minor>/stat. All meters share one
+ * timer, it ticks once a second while any device is busy, rarely while
+ * all are idle, and not at all while suspended.
+ */
+
+typedef struct MpdIoMeter_ MpdIoMeter;
+
+/*
+ * Invoked in the main context when the numbers change. Rates are in bytes
+ * per second, all zero once the device went idle.
+ */
+typedef void (*MpdIoMeterCallback) (MpdIoMeter   *meter,
+                                    uint64_t      read_rate,
+                                    uint64_t      write_rate,
+                                    unsigned int  in_flight,
+                                    void         *data);
+
+MpdIoMeter *
+mpd_io_meter_new (char const          *path,
+                  MpdIoMeterCallback   callback,
+                  void                *data);
+
+void
+mpd_io_meter_free (MpdIoMeter *self);
+
+bool
+mpd_io_meter_is_active (MpdIoMeter *self);
+
+void
+mpd_io_meter_set_suspended (bool suspended);
+
+G_END_DECLS
+
+#endif /* MPD_IO_METER_H */
+
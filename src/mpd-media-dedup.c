@@ -0,0 +1,556 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mpd-media-dedup.h"
+#include "mpd-media-hash.h"
+#include "config.h"
+
+/*
+ * The record is a text file in the cache dir, one imported file per line:
+ * size, quick hash, full hash (0 when not computed yet) and escaped path.
+ * It is loaded on first use and only ever grows while running; entries of
+ * files that were since removed or changed simply don't match.
+ */
+
+#define QUICK_BLOCK_SIZE  (64 << 10)
+#define FULL_BUFFER_SIZE  (1 << 20)
+
+typedef struct Entry_ Entry;
+
+struct Entry_
+{
+  uint64_t   size;
+  uint64_t   quick_hash;
+  uint64_t   full_hash;
+  char      *path;
+  Entry     *next;    /* Same size and quick hash. */
+};
+
+struct MpdMediaDedup_
+{
+  GMutex      *mutex;
+  GHashTable  *entries;   /* Entry *, chain heads */
+  bool         loaded;
+  bool         dirty;
+};
+
+typedef struct
+{
+  MpdMediaDedup *dedup;
+  char          *path;
+  uint64_t       size;
+  uint64_t       quick_hash;
+  bool           duplicate;
+} CheckData;
+
+static unsigned int
+_entry_hash (Entry const *entry)
+{
+  return (unsigned int) (entry->size ^ entry->quick_hash);
+}
+
+static gboolean
+_entry_equal (Entry const *a,
+              Entry const *b)
+{
+  return a->size == b->size &&
+         a->quick_hash == b->quick_hash;
+}
+
+static char *
+get_record_path (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), "meego-panel-devices",
+                           "imported-media", NULL);
+}
+
+static void
+set_error_from_errno (GError      **error,
+                      int           errsv,
+                      char const   *path)
+{
+  g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+               "%s: %s", path, g_strerror (errsv));
+}
+
+/* Lock must be held. */
+static bool
+insert_entry (MpdMediaDedup  *self,
+              char const     *path,
+              uint64_t        size,
+              uint64_t        quick_hash,
+              uint64_t        full_hash)
+{
+  Entry   key = { size, quick_hash, 0, NULL, NULL };
+  Entry  *head;
+  Entry  *entry;
+
+  head = g_hash_table_lookup (self->entries, &key);
+  for (entry = head; entry; entry = entry->next)
+  {
+    if (0 == strcmp (entry->path, path))
+    {
+      if (full_hash)
+        entry->full_hash = full_hash;
+      return false;
+    }
+  }
+
+  entry = g_new0 (Entry, 1);
+  entry->size = size;
+  entry->quick_hash = quick_hash;
+  entry->full_hash = full_hash;
+  entry->path = g_strdup (path);
+
+  if (head)
+  {
+    entry->next = head->next;
+    head->next = entry;
+  } else {
+    g_hash_table_insert (self->entries, entry, entry);
+  }
+
+  return true;
+}
+
+/* Lock must be held. */
+static void
+ensure_loaded (MpdMediaDedup *self)
+{
+  char     *record_path;
+  char     *contents = NULL;
+  char    **lines;
+  GError   *error = NULL;
+  unsigned int i;
+
+  if (self->loaded)
+    return;
+
+  self->loaded = true;
+
+  record_path = get_record_path ();
+  g_file_get_contents (record_path, &contents, NULL, &error);
+  g_free (record_path);
+  if (error)
+  {
+    if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+      g_warning ("%s : %s", G_STRLOC, error->message);
+    g_clear_error (&error);
+    return;
+  }
+
+  lines = g_strsplit (contents, "\n", -1);
+  for (i = 0; lines[i]; i++)
+  {
+    char      *p = lines[i];
+    uint64_t   size;
+    uint64_t   quick_hash;
+    uint64_t   full_hash;
+    char      *path;
+
+    size = g_ascii_strtoull (p, &p, 16);
+    quick_hash = g_ascii_strtoull (p, &p, 16);
+    full_hash = g_ascii_strtoull (p, &p, 16);
+    if (*p != ' ' ||
+        *(p + 1) == '\0')
+      continue;
+
+    path = g_strcompress (p + 1);
+    insert_entry (self, path, size, quick_hash, full_hash);
+    g_free (path);
+  }
+
+  g_strfreev (lines);
+  g_free (contents);
+}
+
+bool
+mpd_media_dedup_quick_hash (char const    *path,
+                            uint64_t       size,
+                            uint64_t      *hash,
+                            GCancellable  *cancellable,
+                            GError       **error)
+{
+  MpdMediaHash   state;
+  char          *buffer;
+  off_t          offsets[2];
+  unsigned int   n_blocks;
+  unsigned int   i;
+  int            fd;
+  bool           ret = true;
+
+  fd = open (path, O_RDONLY);
+  if (fd < 0)
+  {
+    set_error_from_errno (error, errno, path);
+    return false;
+  }
+
+  /* Head and tail, or everything for small files. */
+  offsets[0] = 0;
+  offsets[1] = size > QUICK_BLOCK_SIZE ? size - QUICK_BLOCK_SIZE : 0;
+  n_blocks = size > 2 * QUICK_BLOCK_SIZE ? 2 : 1;
+
+  buffer = g_malloc (2 * QUICK_BLOCK_SIZE);
+  mpd_media_hash_init (&state, size);
+  for (i = 0; i < n_blocks && ret; i++)
+  {
+    size_t  len = n_blocks > 1 ? QUICK_BLOCK_SIZE : 2 * QUICK_BLOCK_SIZE;
+    ssize_t n;
+
+    if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    {
+      ret = false;
+      break;
+    }
+
+    n = pread (fd, buffer, len, offsets[i]);
+    if (n < 0)
+    {
+      set_error_from_errno (error, errno, path);
+      ret = false;
+    } else {
+      mpd_media_hash_update (&state, buffer, n);
+    }
+  }
+
+  *hash = mpd_media_hash_finish (&state);
+
+  g_free (buffer);
+  close (fd);
+  return ret;
+}
+
+bool
+mpd_media_dedup_full_hash (char const    *path,
+                           uint64_t      *hash,
+                           GCancellable  *cancellable,
+                           GError       **error)
+{
+  MpdMediaHash   state;
+  char          *buffer;
+  ssize_t        n;
+  int            fd;
+  bool           ret = true;
+
+  fd = open (path, O_RDONLY);
+  if (fd < 0)
+  {
+    set_error_from_errno (error, errno, path);
+    return false;
+  }
+
+  buffer = g_malloc (FULL_BUFFER_SIZE);
+  mpd_media_hash_init (&state, 0);
+  for (;;)
+  {
+    if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    {
+      ret = false;
+      break;
+    }
+
+    n = read (fd, buffer, FULL_BUFFER_SIZE);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+    {
+      set_error_from_errno (error, errno, path);
+      ret = false;
+      break;
+    }
+    if (0 == n)
+      break;
+
+    mpd_media_hash_update (&state, buffer, n);
+  }
+
+  *hash = mpd_media_hash_finish (&state);
+
+  g_free (buffer);
+  close (fd);
+  return ret;
+}
+
+/*
+ * Compare against candidates with equal size and quick hash, confirming
+ * with the full hash. Candidate hashes are computed once and remembered.
+ */
+static bool
+is_duplicate (MpdMediaDedup  *self,
+              CheckData      *data,
+              GCancellable   *cancellable,
+              GError        **error)
+{
+  Entry      key = { data->size, data->quick_hash, 0, NULL, NULL };
+  Entry     *entry;
+  uint64_t   source_hash = 0;
+  bool       source_hashed = false;
+
+  g_mutex_lock (self->mutex);
+  ensure_loaded (self);
+  entry = g_hash_table_lookup (self->entries, &key);
+  g_mutex_unlock (self->mutex);
+
+  /* Entries are never freed, so walking the chain unlocked is safe. */
+  for (; entry; entry = entry->next)
+  {
+    struct stat  st;
+    uint64_t     target_hash;
+
+    if (0 != stat (entry->path, &st) ||
+        !S_ISREG (st.st_mode) ||
+        (uint64_t) st.st_size != data->size)
+      continue;
+
+    if (!source_hashed)
+    {
+      if (!mpd_media_dedup_full_hash (data->path, &source_hash,
+                                      cancellable, error))
+        return false;
+      source_hashed = true;
+    }
+
+    g_mutex_lock (self->mutex);
+    target_hash = entry->full_hash;
+    g_mutex_unlock (self->mutex);
+
+    if (0 == target_hash)
+    {
+      if (!mpd_media_dedup_full_hash (entry->path, &target_hash,
+                                      cancellable, NULL))
+        continue;
+
+      g_mutex_lock (self->mutex);
+      entry->full_hash = target_hash;
+      self->dirty = true;
+      g_mutex_unlock (self->mutex);
+    }
+
+    if (target_hash == source_hash)
+      return true;
+  }
+
+  return false;
+}
+
+static void
+_check_thread_cb (GSimpleAsyncResult *result,
+                  GObject            *object,
+                  GCancellable       *cancellable)
+{
+  CheckData *data = g_simple_async_result_get_op_res_gpointer (result);
+  GError    *error = NULL;
+
+  if (mpd_media_dedup_quick_hash (data->path, data->size, &data->quick_hash,
+                                  cancellable, &error))
+    data->duplicate = is_duplicate (data->dedup, data, cancellable, &error);
+
+  if (error)
+  {
+    g_simple_async_result_set_from_error (result, error);
+    g_clear_error (&error);
+  }
+}
+
+static void
+check_data_free (CheckData *data)
+{
+  g_free (data->path);
+  g_free (data);
+}
+
+MpdMediaDedup *
+mpd_media_dedup_get_default (void)
+{
+  static MpdMediaDedup *_self = NULL;
+
+  if (NULL == _self)
+  {
+    if (!g_thread_supported ())
+      g_thread_init (NULL);
+
+    _self = g_new0 (MpdMediaDedup, 1);
+    _self->mutex = g_mutex_new ();
+    _self->entries = g_hash_table_new ((GHashFunc) _entry_hash,
+                                       (GEqualFunc) _entry_equal);
+  }
+
+  return _self;
+}
+
+void
+mpd_media_dedup_check_async (MpdMediaDedup        *self,
+                             char const           *path,
+                             uint64_t              size,
+                             GCancellable         *cancellable,
+                             GAsyncReadyCallback   callback,
+                             void                 *data)
+{
+  GSimpleAsyncResult  *result;
+  CheckData           *check_data;
+
+  g_return_if_fail (self);
+  g_return_if_fail (path);
+
+  check_data = g_new0 (CheckData, 1);
+  check_data->dedup = self;
+  check_data->path = g_strdup (path);
+  check_data->size = size;
+
+  result = g_simple_async_result_new (NULL, callback, data,
+                                      mpd_media_dedup_check_async);
+  g_simple_async_result_set_op_res_gpointer (result, check_data,
+                                             (GDestroyNotify) check_data_free);
+  g_simple_async_result_run_in_thread (result,
+                                       (GSimpleAsyncThreadFunc)
+                                         _check_thread_cb,
+                                       G_PRIORITY_DEFAULT,
+                                       cancellable);
+  g_object_unref (result);
+}
+
+/*
+ * Returns whether the file was imported before. `quick_hash' is set either
+ * way, for passing to mpd_media_dedup_add() after importing.
+ */
+bool
+mpd_media_dedup_check_finish (MpdMediaDedup  *self,
+                              GAsyncResult   *result,
+                              uint64_t       *quick_hash,
+                              GError        **error)
+{
+  GSimpleAsyncResult  *simple = (GSimpleAsyncResult *) result;
+  CheckData           *data;
+
+  g_return_val_if_fail (g_simple_async_result_is_valid (result, NULL,
+                                          mpd_media_dedup_check_async),
+                        false);
+
+  if (g_simple_async_result_propagate_error (simple, error))
+    return false;
+
+  data = g_simple_async_result_get_op_res_gpointer (simple);
+  if (quick_hash)
+    *quick_hash = data->quick_hash;
+
+  return data->duplicate;
+}
+
+void
+mpd_media_dedup_add (MpdMediaDedup  *self,
+                     char const     *path,
+                     uint64_t        size,
+                     uint64_t        quick_hash,
+                     uint64_t        full_hash)
+{
+  g_return_if_fail (self);
+  g_return_if_fail (path);
+
+  g_mutex_lock (self->mutex);
+  ensure_loaded (self);
+  if (insert_entry (self, path, size, quick_hash, full_hash))
+    self->dirty = true;
+  g_mutex_unlock (self->mutex);
+}
+
+static void
+_replace_contents_cb (GFile         *file,
+                      GAsyncResult  *res,
+                      char          *contents)
+{
+  GError *error = NULL;
+
+  g_file_replace_contents_finish (file, res, NULL, &error);
+  if (error)
+  {
+    g_warning ("%s : %s", G_STRLOC, error->message);
+    g_clear_error (&error);
+  }
+
+  g_free (contents);
+}
+
+static void
+_append_entries_cb (Entry    *head,
+                    Entry    *value,
+                    GString  *contents)
+{
+  Entry *entry;
+
+  for (entry = head; entry; entry = entry->next)
+  {
+    char *escaped = g_strescape (entry->path, NULL);
+    g_string_append_printf (contents,
+                            "%" G_GINT64_MODIFIER "x "
+                            "%" G_GINT64_MODIFIER "x "
+                            "%" G_GINT64_MODIFIER "x %s\n",
+                            entry->size,
+                            entry->quick_hash,
+                            entry->full_hash,
+                            escaped);
+    g_free (escaped);
+  }
+}
+
+void
+mpd_media_dedup_save_async (MpdMediaDedup *self)
+{
+  GString  *contents;
+  GFile    *file;
+  char     *path;
+  char     *dirname;
+
+  g_return_if_fail (self);
+
+  g_mutex_lock (self->mutex);
+  if (!self->dirty)
+  {
+    g_mutex_unlock (self->mutex);
+    return;
+  }
+  contents = g_string_new (NULL);
+  g_hash_table_foreach (self->entries, (GHFunc) _append_entries_cb, contents);
+  self->dirty = false;
+  g_mutex_unlock (self->mutex);
+
+  path = get_record_path ();
+  dirname = g_path_get_dirname (path);
+  g_mkdir_with_parents (dirname, 0700);
+  g_free (dirname);
+
+  file = g_file_new_for_path (path);
+  g_file_replace_contents_async (file,
+                                 contents->str, contents->len,
+                                 NULL, false, G_FILE_CREATE_PRIVATE,
+                                 NULL,
+                                 (GAsyncReadyCallback) _replace_contents_cb,
+                                 contents->str);
+  g_string_free (contents, false);
+  g_object_unref (file);
+  g_free (path);
+}
@@ -0,0 +1,82 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPD_MEDIA_DEDUP_H
+#define MPD_MEDIA_DEDUP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Persistent record of files imported before, so importing the same card
+ * again skips what is already there. Files are identified by size and a
+ * hash over their first and last blocks, a full content hash confirms
+ * matches.
+ */
+
+typedef struct MpdMediaDedup_ MpdMediaDedup;
+
+MpdMediaDedup *
+mpd_media_dedup_get_default (void);
+
+void
+mpd_media_dedup_check_async (MpdMediaDedup        *self,
+                             char const           *path,
+                             uint64_t              size,
+                             GCancellable         *cancellable,
+                             GAsyncReadyCallback   callback,
+                             void                 *data);
+
+bool
+mpd_media_dedup_check_finish (MpdMediaDedup  *self,
+                              GAsyncResult   *result,
+                              uint64_t       *quick_hash,
+                              GError        **error);
+
+void
+mpd_media_dedup_add (MpdMediaDedup  *self,
+                     char const     *path,
+                     uint64_t        size,
+                     uint64_t        quick_hash,
+                     uint64_t        full_hash);
+
+void
+mpd_media_dedup_save_async (MpdMediaDedup *self);
+
+bool
+mpd_media_dedup_quick_hash (char const    *path,
+                            uint64_t       size,
+                            uint64_t      *hash,
+                            GCancellable  *cancellable,
+                            GError       **error);
+
+bool
+mpd_media_dedup_full_hash (char const    *path,
+                           uint64_t      *hash,
+                           GCancellable  *cancellable,
+                           GError       **error);
+
+G_END_DECLS
+
+#endif /* MPD_MEDIA_DEDUP_H */
+
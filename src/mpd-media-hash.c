@@ -0,0 +1,109 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+
+#include "mpd-media-hash.h"
+#include "config.h"
+
+#define PRIME_1 G_GUINT64_CONSTANT (0x9e3779b185ebca87)
+#define PRIME_2 G_GUINT64_CONSTANT (0xc2b2ae3d27d4eb4f)
+
+#define ROTL(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static inline uint64_t
+round_word (uint64_t state,
+            uint64_t word)
+{
+  state ^= ROTL (word * PRIME_2, 31) * PRIME_1;
+  return ROTL (state, 27) * PRIME_1 + PRIME_2;
+}
+
+void
+mpd_media_hash_init (MpdMediaHash *self,
+                     uint64_t      seed)
+{
+  g_return_if_fail (self);
+
+  memset (self, 0, sizeof (*self));
+  self->state = seed + PRIME_1;
+}
+
+void
+mpd_media_hash_update (MpdMediaHash *self,
+                       void const   *data,
+                       size_t        len)
+{
+  uint8_t const *p = data;
+  uint64_t       word;
+
+  g_return_if_fail (self);
+
+  self->length += len;
+
+  /* Complete a word left over from the previous update. */
+  if (self->n_tail)
+  {
+    while (self->n_tail < 8 && len)
+    {
+      self->tail[self->n_tail++] = *p++;
+      len--;
+    }
+    if (self->n_tail < 8)
+      return;
+
+    memcpy (&word, self->tail, 8);
+    self->state = round_word (self->state, word);
+    self->n_tail = 0;
+  }
+
+  while (len >= 8)
+  {
+    memcpy (&word, p, 8);
+    self->state = round_word (self->state, word);
+    p += 8;
+    len -= 8;
+  }
+
+  memcpy (self->tail, p, len);
+  self->n_tail = len;
+}
+
+uint64_t
+mpd_media_hash_finish (MpdMediaHash *self)
+{
+  uint64_t h;
+  unsigned int i;
+
+  g_return_val_if_fail (self, 0);
+
+  h = self->state ^ self->length;
+  for (i = 0; i < self->n_tail; i++)
+    h = ROTL (h ^ (self->tail[i] * PRIME_1), 11) * PRIME_2;
+
+  /* Avalanche. */
+  h ^= h >> 33;
+  h *= PRIME_2;
+  h ^= h >> 29;
+  h *= PRIME_1;
+  h ^= h >> 32;
+
+  return h;
+}
@@ -0,0 +1,58 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPD_MEDIA_HASH_H
+#define MPD_MEDIA_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Fast non-cryptographic 64 bit hash over a byte stream. The result does
+ * not depend on how the stream is split across updates.
+ */
+
+typedef struct
+{
+  uint64_t      state;
+  uint64_t      length;
+  uint8_t       tail[8];
+  unsigned int  n_tail;
+} MpdMediaHash;
+
+void
+mpd_media_hash_init (MpdMediaHash *self,
+                     uint64_t      seed);
+
+void
+mpd_media_hash_update (MpdMediaHash *self,
+                       void const   *data,
+                       size_t        len);
+
+uint64_t
+mpd_media_hash_finish (MpdMediaHash *self);
+
+G_END_DECLS
+
+#endif /* MPD_MEDIA_HASH_H */
+
@@ -0,0 +1,996 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <limits.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <gio/gio.h>
+
+#include "mpd-copy.h"
+#include "mpd-import-journal.h"
+#include "mpd-media-dedup.h"
+#include "mpd-media-importer.h"
+#include "mpd-media-thumbnailer.h"
+#include "config.h"
+
+/*
+ * Up to `max_copies' files are copied concurrently, so reading the next
+ * file from the source device overlaps with writing the previous one.
+ * Sizes and categories are taken from the scan, nothing is queried again.
+ * Each file is first looked up in the record of previous imports and
+ * skipped if it's there already.
+ *
+ * Copied data is made durable once for the whole run, by syncing the target
+ * file systems after the last copy. Only then is the import complete.
+ *
+ * Copies that don't match their source are retried a few times before
+ * the import fails.
+ *
+ * With a journal set, completed files are recorded as they land. A run
+ * interrupted by cancellation, an error or a restart then continues into
+ * the same target directories, skipping what's recorded.
+ *
+ * Optionally, thumbnails of imported images are created in the background
+ * as each copy lands.
+ */
+
+#define MAX_COPY_RETRIES 2
+
+#define DEFAULT_MAX_COPIES 3
+
+typedef struct
+{
+  char        *path;
+  GHashTable  *names;     /* Taken, including copies in flight. */
+  GHashTable  *counters;  /* Last number used per name. */
+} ImportDir;
+
+typedef struct
+{
+  unsigned int       ref_count;
+  GCancellable      *cancellable;
+  MpdMediaScanResult *media;
+  MpdImportJournal  *journal;
+  uint8_t           *done;        /* Per file, from the journal. */
+  unsigned int       next;
+  unsigned int       n_running;
+  uint64_t           total_size;
+  uint64_t           imported_size;
+  uint64_t           skipped_size;
+  unsigned int       n_files_done;
+  GSList            *copying;     /* CopyOp, copies in flight. */
+  bool               used[MPD_MEDIA_CATEGORY_LAST];
+  unsigned int       n_syncing;
+  bool               synced;
+  bool               failed;
+
+  /* NULL when superseded or the importer is gone. */
+  MpdMediaImporter  *importer;
+} ImportJob;
+
+typedef struct
+{
+  unsigned int   ref_count;
+  ImportJob     *job;
+  unsigned int   index;
+  char          *source_path;
+  uint64_t       quick_hash;
+  char          *target_name;
+  char          *target_path;
+  int volatile   copied_kib;
+  int64_t        started;
+  unsigned int   n_retries;
+} CopyOp;
+
+#define JOB_FILE(job_, index_) \
+  (&g_array_index ((job_)->media->files, MpdMediaFileInfo, (index_)))
+
+struct MpdMediaImporter_
+{
+  unsigned int                      max_copies;
+  bool                              low_impact;
+  bool                              thumbnails;
+  bool                              verify;
+  ImportDir                        *dirs[MPD_MEDIA_CATEGORY_LAST];
+  MpdImportJournal                 *journal;
+  ImportJob                        *job;
+  MpdImportStats                    stats;
+  MpdMediaImporterProgressCallback  progress_cb;
+  MpdMediaImporterErrorCallback     error_cb;
+  MpdMediaImporterFinishedCallback  finished_cb;
+  void                             *data;
+};
+
+static ImportJob *
+import_job_new (MpdMediaImporter         *importer,
+                MpdMediaScanResult const *media)
+{
+  ImportJob *job = g_new0 (ImportJob, 1);
+
+  job->ref_count = 1;
+  job->cancellable = g_cancellable_new ();
+  /* A few flat arrays, copying is cheap. */
+  job->media = mpd_media_scan_result_copy (media);
+  job->total_size = media->size;
+  job->importer = importer;
+
+  if (importer->journal)
+  {
+    unsigned int i;
+
+    job->journal = mpd_import_journal_ref (importer->journal);
+    job->done = g_new0 (uint8_t, media->files->len);
+    for (i = 0; i < media->files->len; i++)
+    {
+      MpdMediaFileInfo const *info = &g_array_index (media->files,
+                                                     MpdMediaFileInfo, i);
+      char *path = mpd_media_scan_result_get_file_path (media, i);
+
+      if (mpd_import_journal_lookup (job->journal, path, info->size))
+      {
+        job->done[i] = true;
+        job->imported_size += info->size;
+        job->n_files_done++;
+      }
+      g_free (path);
+    }
+  }
+
+  return job;
+}
+
+static ImportJob *
+import_job_ref (ImportJob *job)
+{
+  job->ref_count++;
+  return job;
+}
+
+static void
+import_job_unref (ImportJob *job)
+{
+  if (--job->ref_count)
+    return;
+
+  if (job->journal)
+  {
+    /* Interrupted, make sure what's done is on disk. */
+    mpd_import_journal_flush (job->journal);
+    mpd_import_journal_unref (job->journal);
+  }
+  g_free (job->done);
+  mpd_media_scan_result_free (job->media);
+  g_object_unref (job->cancellable);
+  g_free (job);
+}
+
+static CopyOp *
+copy_op_ref (CopyOp *op)
+{
+  op->ref_count++;
+  return op;
+}
+
+static void
+copy_op_unref (CopyOp *op)
+{
+  if (--op->ref_count)
+    return;
+
+  g_free (op->target_name);
+  g_free (op->target_path);
+  g_free (op->source_path);
+  import_job_unref (op->job);
+  g_free (op);
+}
+
+/*
+ * Names in a target directory are read once when it's first used, then
+ * tracked in memory as files are copied, so picking a free name does not
+ * touch the file system. Per name the last number used for "name (n).ext"
+ * is remembered, cameras tend to reuse the same few names.
+ */
+static ImportDir *
+import_dir_new (char const *path)
+{
+  ImportDir   *dir = g_new0 (ImportDir, 1);
+  GDir        *handle;
+  char const  *name;
+  GError      *error = NULL;
+
+  dir->path = g_strdup (path);
+  dir->names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  dir->counters = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                         g_free, NULL);
+
+  handle = g_dir_open (path, 0, &error);
+  if (error)
+  {
+    g_warning ("%s : %s", G_STRLOC, error->message);
+    g_clear_error (&error);
+    return dir;
+  }
+
+  while (NULL != (name = g_dir_read_name (handle)))
+    g_hash_table_insert (dir->names, g_strdup (name), GINT_TO_POINTER (1));
+
+  g_dir_close (handle);
+  return dir;
+}
+
+static void
+import_dir_free (ImportDir *dir)
+{
+  g_hash_table_destroy (dir->counters);
+  g_hash_table_destroy (dir->names);
+  g_free (dir->path);
+  g_free (dir);
+}
+
+/* Returns a newly allocated name, taken until released. */
+static char *
+import_dir_reserve_name (ImportDir  *dir,
+                         char const *template)
+{
+  char        *name;
+  char        *basename;
+  char const  *suffix;
+  unsigned int i;
+
+  if (!g_hash_table_lookup (dir->names, template))
+  {
+    name = g_strdup (template);
+    g_hash_table_insert (dir->names, g_strdup (name), GINT_TO_POINTER (1));
+    return name;
+  }
+
+  suffix = strrchr (template, '.');
+  if (NULL == suffix ||
+      suffix == template)
+  {
+    /* No suffix found. */
+    suffix = "";
+    basename = g_strdup (template);
+  } else {
+    basename = g_strndup (template, suffix - template);
+  }
+
+  i = GPOINTER_TO_UINT (g_hash_table_lookup (dir->counters, template));
+  do
+  {
+    name = g_strdup_printf ("%s (%u)%s", basename, ++i, suffix);
+    if (!g_hash_table_lookup (dir->names, name))
+      break;
+    g_free (name);
+  } while (true);
+
+  g_hash_table_insert (dir->counters, g_strdup (template),
+                       GUINT_TO_POINTER (i));
+  g_hash_table_insert (dir->names, g_strdup (name), GINT_TO_POINTER (1));
+  g_free (basename);
+
+  return name;
+}
+
+/* The copy failed and left nothing behind. */
+static void
+import_dir_release_name (ImportDir  *dir,
+                         char const *name)
+{
+  g_hash_table_remove (dir->names, name);
+}
+
+static ImportDir *
+ensure_import_subdir (char const   *path,
+                      GError      **error)
+{
+  GTimeVal     tv = { 0, };
+  GDate        date = { 0, };
+  char         template[PATH_MAX] = { 0, } /* whatever */;
+  GFile       *basedir;
+  GFile       *subdir;
+  char        *subdir_path;
+  ImportDir   *dir = NULL;
+  unsigned int i = 0;
+
+  /* Unset or removed by the user. */
+  if (NULL == path ||
+      !g_file_test (path, G_FILE_TEST_IS_DIR))
+  {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                 "Import directory %s does not exist",
+                 path ? path : "(none)");
+    return NULL;
+  }
+
+  g_get_current_time (&tv);
+  g_date_set_time_val (&date, &tv);
+
+  basedir = g_file_new_for_path (path);
+  g_date_strftime (template, sizeof (template), "%x", &date);
+  /* We like locale specific dir names but '/' don't work very well.
+   * so fall back to ISO date format. */
+  if (strchr (template, '/'))
+  {
+    memset (template, 0, sizeof (template));
+    g_date_strftime (template, sizeof (template), "%Y-%m-%d", &date);
+  }
+
+  subdir = g_file_get_child (basedir, template);
+  while (g_file_query_exists (subdir, NULL))
+  {
+    char *dirname = g_strdup_printf ("%s (%d)", template, ++i);
+    g_object_unref (subdir);
+    subdir = g_file_get_child (basedir, dirname);
+    g_free (dirname);
+  }
+
+  if (g_file_make_directory (subdir, NULL, error))
+  {
+    subdir_path = g_file_get_path (subdir);
+    dir = import_dir_new (subdir_path);
+    g_free (subdir_path);
+  }
+
+  g_object_unref (subdir);
+  g_object_unref (basedir);
+  return dir;
+}
+
+/*
+ * Target directories are kept for subsequent runs of the importer, and
+ * taken from the journal when resuming.
+ */
+static ImportDir *
+get_import_dir (ImportJob          *job,
+                MpdMediaCategory    category,
+                GError            **error)
+{
+  MpdMediaImporter  *self = job->importer;
+  char const        *journal_dir = NULL;
+  GUserDirectory     directory;
+
+  switch (category)
+  {
+  case MPD_MEDIA_CATEGORY_AUDIO:
+    directory = G_USER_DIRECTORY_MUSIC;
+    break;
+  case MPD_MEDIA_CATEGORY_IMAGE:
+    directory = G_USER_DIRECTORY_PICTURES;
+    break;
+  case MPD_MEDIA_CATEGORY_VIDEO:
+    directory = G_USER_DIRECTORY_VIDEOS;
+    break;
+  default:
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                 "Unhandled media category %d", category);
+    return NULL;
+  }
+
+  if (job->journal)
+    journal_dir = mpd_import_journal_get_dir (job->journal, category);
+
+  if (NULL == self->dirs[category] &&
+      journal_dir &&
+      g_file_test (journal_dir, G_FILE_TEST_IS_DIR))
+    self->dirs[category] = import_dir_new (journal_dir);
+
+  if (NULL == self->dirs[category])
+    self->dirs[category] =
+      ensure_import_subdir (g_get_user_special_dir (directory), error);
+
+  if (job->journal &&
+      self->dirs[category])
+    mpd_import_journal_set_dir (job->journal, category,
+                                self->dirs[category]->path);
+
+  return self->dirs[category];
+}
+
+static void
+report_error (ImportJob     *job,
+              GError const  *error)
+{
+  MpdMediaImporter *self = job->importer;
+
+  if (job->failed)
+    return;
+
+  /* Stop the copies still in flight. */
+  job->failed = true;
+  g_cancellable_cancel (job->cancellable);
+
+  if (self && self->error_cb)
+    self->error_cb (self, error, self->data);
+}
+
+static void
+report_progress (ImportJob *job)
+{
+  MpdMediaImporter *self = job->importer;
+
+  if (self && self->progress_cb)
+    self->progress_cb (self,
+                       job->imported_size + job->skipped_size,
+                       job->total_size,
+                       self->data);
+}
+
+/* Successfully imported and synced. */
+static void
+report_finished (ImportJob *job)
+{
+  MpdMediaImporter *self = job->importer;
+
+  report_progress (job);
+
+  if (job->journal)
+    mpd_import_journal_complete (job->journal);
+
+  if (self && self->finished_cb)
+    self->finished_cb (self, job->imported_size, job->skipped_size,
+                       self->data);
+
+  mpd_media_dedup_save_async (mpd_media_dedup_get_default ());
+}
+
+static void
+_copy_cb (GObject       *source,
+          GAsyncResult  *res,
+          CopyOp        *op);
+
+static void
+start_copy (CopyOp *op)
+{
+  ImportJob         *job = op->job;
+  MpdMediaFileInfo  *file = JOB_FILE (job, op->index);
+  ImportDir         *target_dir;
+  char              *next_path = NULL;
+  MpdCopyFlags       flags;
+  GError            *error = NULL;
+
+  target_dir = get_import_dir (job, file->category, &error);
+  if (NULL == target_dir)
+  {
+    /* Not counted as running, so the job must not finish as a success. */
+    report_error (job, error);
+    g_clear_error (&error);
+    return;
+  }
+
+  op->target_name = import_dir_reserve_name (target_dir,
+                  mpd_media_scan_result_get_file_name (job->media, op->index));
+
+  /* Hint the file queued after this one for readahead. */
+  if (op->index + 1 < job->media->files->len)
+    next_path = mpd_media_scan_result_get_file_path (job->media,
+                                                     op->index + 1);
+
+  job->n_running++;
+  job->used[file->category] = true;
+  op->target_path = g_build_filename (target_dir->path, op->target_name,
+                                      NULL);
+  op->started = mpd_import_stats_get_time ();
+  op->copied_kib = 0;
+  job->copying = g_slist_prepend (job->copying, op);
+
+  flags = MPD_COPY_FLAGS_NONE;
+  if (job->importer->low_impact)
+    flags |= MPD_COPY_FLAGS_LOW_IMPACT;
+  if (job->importer->verify)
+    flags |= MPD_COPY_FLAGS_VERIFY;
+  /* The thumbnailer reads it once copied. */
+  if (job->importer->thumbnails &&
+      MPD_MEDIA_CATEGORY_IMAGE == file->category)
+    flags |= MPD_COPY_FLAGS_KEEP_CACHED;
+
+  mpd_copy_file_async (op->source_path, op->target_path, next_path,
+                       file->size,
+                       &op->copied_kib,
+                       flags,
+                       job->cancellable,
+                       (GAsyncReadyCallback) _copy_cb,
+                       copy_op_ref (op));
+  g_free (next_path);
+}
+
+static void
+fill_pipeline (ImportJob *job);
+
+static void
+_check_cb (GObject       *source,
+           GAsyncResult  *res,
+           CopyOp        *op)
+{
+  ImportJob         *job = op->job;
+  MpdMediaFileInfo  *file = JOB_FILE (job, op->index);
+  MpdMediaDedup *dedup = mpd_media_dedup_get_default ();
+  bool           duplicate;
+  GError        *error = NULL;
+
+  job->n_running--;
+
+  duplicate = mpd_media_dedup_check_finish (dedup, res,
+                                            &op->quick_hash, &error);
+  if (error)
+  {
+    if (!job->failed)
+      g_warning ("%s : %s", G_STRLOC, error->message);
+    report_error (job, error);
+    g_clear_error (&error);
+
+  } else if (duplicate) {
+
+    g_debug ("%s() Already imported %s", __FUNCTION__, op->source_path);
+    job->skipped_size += file->size;
+    job->n_files_done++;
+    if (job->n_running ||
+        job->next < job->media->files->len)
+      report_progress (job);
+
+  } else if (!job->failed &&
+             job->importer) {
+
+    start_copy (op);
+  }
+
+  fill_pipeline (job);
+  copy_op_unref (op);
+}
+
+/* Files imported before are skipped without copying. */
+static void
+start_file (ImportJob     *job,
+            unsigned int   index)
+{
+  MpdMediaFileInfo  *file = JOB_FILE (job, index);
+  CopyOp            *op;
+
+  op = g_new0 (CopyOp, 1);
+  op->ref_count = 1;
+  op->job = import_job_ref (job);
+  op->index = index;
+  op->source_path = mpd_media_scan_result_get_file_path (job->media, index);
+
+  job->n_running++;
+  mpd_media_dedup_check_async (mpd_media_dedup_get_default (),
+                               op->source_path, file->size,
+                               job->cancellable,
+                               (GAsyncReadyCallback) _check_cb,
+                               op);
+}
+
+static void
+_sync_cb (GObject       *source,
+          GAsyncResult  *res,
+          ImportJob     *job);
+
+static void
+start_sync (ImportJob *job)
+{
+  MpdMediaImporter  *self = job->importer;
+  dev_t              devices[MPD_MEDIA_CATEGORY_LAST];
+  unsigned int       n_devices = 0;
+  unsigned int       i;
+
+  job->synced = true;
+
+  /* One sync per file system written to. */
+  for (i = 0; i < MPD_MEDIA_CATEGORY_LAST; i++)
+  {
+    struct stat    st;
+    char const    *path;
+    unsigned int   j;
+
+    if (!job->used[i] ||
+        NULL == self->dirs[i])
+      continue;
+
+    path = self->dirs[i]->path;
+    if (0 == stat (path, &st))
+    {
+      for (j = 0; j < n_devices; j++)
+        if (devices[j] == st.st_dev)
+          break;
+
+      if (j == n_devices)
+      {
+        devices[n_devices++] = st.st_dev;
+        job->n_syncing++;
+        mpd_copy_sync_async (path,
+                             (GAsyncReadyCallback) _sync_cb,
+                             import_job_ref (job));
+      }
+    }
+  }
+}
+
+static void
+finish_job (ImportJob *job)
+{
+  MpdMediaImporter *self = job->importer;
+
+  if (NULL == self ||
+      self->job != job)
+    return;
+
+  self->job = NULL;
+  import_job_unref (job);
+}
+
+static void
+fill_pipeline (ImportJob *job)
+{
+  MpdMediaImporter *self = job->importer;
+
+  while (self &&
+         !job->failed &&
+         job->n_running < self->max_copies &&
+         job->next < job->media->files->len)
+  {
+    if (job->done &&
+        job->done[job->next])
+      job->next++;
+    else
+      start_file (job, job->next++);
+  }
+
+  if (job->n_running ||
+      job->n_syncing ||
+      NULL == self ||
+      self->job != job)
+    return;
+
+  /* All copied, make it durable before calling it done. */
+  if (!job->failed &&
+      !job->synced)
+  {
+    start_sync (job);
+    if (job->n_syncing)
+      return;
+    report_finished (job);
+  }
+
+  finish_job (job);
+}
+
+static void
+_sync_cb (GObject       *source,
+          GAsyncResult  *res,
+          ImportJob     *job)
+{
+  GError *error = NULL;
+
+  job->n_syncing--;
+
+  if (!mpd_copy_sync_finish (res, &error))
+  {
+    g_warning ("%s : %s", G_STRLOC, error->message);
+    report_error (job, error);
+    g_clear_error (&error);
+  }
+
+  if (0 == job->n_syncing)
+  {
+    if (!job->failed)
+      report_finished (job);
+    finish_job (job);
+  }
+
+  import_job_unref (job);
+}
+
+static void
+_copy_cb (GObject       *source,
+          GAsyncResult  *res,
+          CopyOp        *op)
+{
+  ImportJob         *job = op->job;
+  MpdMediaFileInfo  *file = JOB_FILE (job, op->index);
+  GError            *error = NULL;
+
+  job->n_running--;
+  job->copying = g_slist_remove (job->copying, op);
+
+  if (!mpd_copy_file_finish (res, &error))
+  {
+    /* The name is free again, unless somebody else took it meanwhile. */
+    if (job->importer &&
+        !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_EXISTS))
+      import_dir_release_name (job->importer->dirs[file->category],
+                               op->target_name);
+
+    /* Flaky readers, try again. The partial target is gone already. */
+    if (g_error_matches (error, MPD_COPY_ERROR, MPD_COPY_ERROR_MISMATCH) &&
+        op->n_retries < MAX_COPY_RETRIES &&
+        !job->failed &&
+        job->importer)
+    {
+      g_warning ("%s : %s, retrying", G_STRLOC, error->message);
+      g_clear_error (&error);
+      op->n_retries++;
+      g_free (op->target_name);
+      op->target_name = NULL;
+      g_free (op->target_path);
+      op->target_path = NULL;
+      start_copy (op);
+      fill_pipeline (job);
+      copy_op_unref (op);
+      return;
+    }
+
+    if (!job->failed)
+      g_warning ("%s : %s", G_STRLOC, error->message);
+    report_error (job, error);
+    g_clear_error (&error);
+
+  } else {
+
+    mpd_media_dedup_add (mpd_media_dedup_get_default (),
+                         op->target_path, file->size, op->quick_hash, 0);
+    if (job->journal)
+      mpd_import_journal_add (job->journal,
+                              op->source_path, op->target_path, file->size);
+
+    job->imported_size += file->size;
+    job->n_files_done++;
+    if (job->importer)
+      mpd_import_stats_add_latency (&job->importer->stats,
+                                    mpd_import_stats_get_time () - op->started);
+
+    if (job->importer &&
+        job->importer->thumbnails &&
+        MPD_MEDIA_CATEGORY_IMAGE == file->category)
+      mpd_media_thumbnailer_queue (op->target_path);
+
+    /* The final progress is reported after syncing. */
+    if (job->n_running ||
+        job->next < job->media->files->len)
+      report_progress (job);
+  }
+
+  fill_pipeline (job);
+  copy_op_unref (op);
+}
+
+MpdMediaImporter *
+mpd_media_importer_new (void)
+{
+  MpdMediaImporter *self = g_new0 (MpdMediaImporter, 1);
+
+  self->max_copies = DEFAULT_MAX_COPIES;
+
+  return self;
+}
+
+void
+mpd_media_importer_free (MpdMediaImporter *self)
+{
+  unsigned int i;
+
+  g_return_if_fail (self);
+
+  if (self->job)
+  {
+    g_cancellable_cancel (self->job->cancellable);
+    self->job->importer = NULL;
+    import_job_unref (self->job);
+    self->job = NULL;
+  }
+
+  for (i = 0; i < G_N_ELEMENTS (self->dirs); i++)
+    if (self->dirs[i])
+      import_dir_free (self->dirs[i]);
+
+  if (self->journal)
+    mpd_import_journal_unref (self->journal);
+
+  g_free (self);
+}
+
+/*
+ * Journal used by subsequent runs, for resuming an interrupted import.
+ */
+void
+mpd_media_importer_set_journal (MpdMediaImporter *self,
+                                MpdImportJournal *journal)
+{
+  g_return_if_fail (self);
+
+  if (self->journal)
+    mpd_import_journal_unref (self->journal);
+
+  self->journal = journal ? mpd_import_journal_ref (journal) : NULL;
+}
+
+unsigned int
+mpd_media_importer_get_max_copies (MpdMediaImporter *self)
+{
+  g_return_val_if_fail (self, 0);
+
+  return self->max_copies;
+}
+
+/*
+ * Number of files copied concurrently, takes effect as copies complete.
+ */
+void
+mpd_media_importer_set_max_copies (MpdMediaImporter *self,
+                                   unsigned int      max_copies)
+{
+  g_return_if_fail (self);
+  g_return_if_fail (max_copies > 0);
+
+  self->max_copies = max_copies;
+  if (self->job)
+    fill_pipeline (self->job);
+}
+
+bool
+mpd_media_importer_get_low_impact (MpdMediaImporter *self)
+{
+  g_return_val_if_fail (self, false);
+
+  return self->low_impact;
+}
+
+/*
+ * Copy at low I/O priority and keep imported data from crowding out the
+ * page cache, at some cost in throughput. Takes effect with the next file.
+ */
+void
+mpd_media_importer_set_low_impact (MpdMediaImporter *self,
+                                   bool              low_impact)
+{
+  g_return_if_fail (self);
+
+  self->low_impact = low_impact;
+}
+
+bool
+mpd_media_importer_get_thumbnails (MpdMediaImporter *self)
+{
+  g_return_val_if_fail (self, false);
+
+  return self->thumbnails;
+}
+
+/*
+ * Create thumbnails of imported images, see mpd-media-thumbnailer.h.
+ * Takes effect with the next file.
+ */
+void
+mpd_media_importer_set_thumbnails (MpdMediaImporter *self,
+                                   bool              thumbnails)
+{
+  g_return_if_fail (self);
+
+  self->thumbnails = thumbnails;
+}
+
+bool
+mpd_media_importer_get_verify (MpdMediaImporter *self)
+{
+  g_return_val_if_fail (self, false);
+
+  return self->verify;
+}
+
+/*
+ * Check copies against the source as read, see MPD_COPY_FLAGS_VERIFY.
+ * Takes effect with the next file.
+ */
+void
+mpd_media_importer_set_verify (MpdMediaImporter *self,
+                               bool              verify)
+{
+  g_return_if_fail (self);
+
+  self->verify = verify;
+}
+
+void
+mpd_media_importer_start (MpdMediaImporter                  *self,
+                          MpdMediaScanResult const          *media,
+                          MpdMediaImporterProgressCallback   progress_cb,
+                          MpdMediaImporterErrorCallback      error_cb,
+                          MpdMediaImporterFinishedCallback   finished_cb,
+                          void                              *data)
+{
+  g_return_if_fail (self);
+  g_return_if_fail (media);
+
+  /* Restart if already running, the previous run is not reported. */
+  if (self->job)
+  {
+    g_cancellable_cancel (self->job->cancellable);
+    self->job->importer = NULL;
+    import_job_unref (self->job);
+    self->job = NULL;
+  }
+
+  self->progress_cb = progress_cb;
+  self->error_cb = error_cb;
+  self->finished_cb = finished_cb;
+  self->data = data;
+  self->job = import_job_new (self, media);
+  mpd_import_stats_reset (&self->stats,
+                          media->size, media->files->len,
+                          self->job->imported_size, self->job->n_files_done);
+
+  /* Resuming, account for what's done already. */
+  if (self->job->imported_size)
+    report_progress (self->job);
+
+  fill_pipeline (self->job);
+}
+
+/*
+ * Copies in flight are cancelled, this is reported through the error
+ * callback once they return.
+ */
+void
+mpd_media_importer_cancel (MpdMediaImporter *self)
+{
+  g_return_if_fail (self);
+
+  if (self->job)
+    g_cancellable_cancel (self->job->cancellable);
+}
+
+/*
+ * Takes a sample of the running import, including partially copied files,
+ * for updating the rates. Meant to be called at a steady pace.
+ */
+MpdImportStats const *
+mpd_media_importer_sample_stats (MpdMediaImporter *self)
+{
+  ImportJob *job;
+  GSList    *iter;
+  uint64_t   done_size;
+
+  g_return_val_if_fail (self, NULL);
+
+  job = self->job;
+  if (NULL == job)
+    return &self->stats;
+
+  done_size = job->imported_size + job->skipped_size;
+  for (iter = job->copying; iter; iter = iter->next)
+  {
+    CopyOp   *op = (CopyOp *) iter->data;
+    uint64_t  copied = (uint64_t) g_atomic_int_get (&op->copied_kib) << 10;
+
+    done_size += MIN (copied, JOB_FILE (job, op->index)->size);
+  }
+
+  mpd_import_stats_sample (&self->stats, done_size, job->n_files_done);
+  return &self->stats;
+}
+
+bool
+mpd_media_importer_is_running (MpdMediaImporter *self)
+{
+  g_return_val_if_fail (self, false);
+
+  return self->job != NULL;
+}
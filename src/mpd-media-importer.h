@@ -0,0 +1,114 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPD_MEDIA_IMPORTER_H
+#define MPD_MEDIA_IMPORTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <glib.h>
+
+#include "mpd-import-journal.h"
+#include "mpd-import-stats.h"
+#include "mpd-media-scanner.h"
+
+G_BEGIN_DECLS
+
+typedef struct MpdMediaImporter_ MpdMediaImporter;
+
+/*
+ * Invoked in the main context after each imported or skipped file,
+ * `imported_size' includes skipped files.
+ */
+typedef void (*MpdMediaImporterProgressCallback) (MpdMediaImporter *importer,
+                                                  uint64_t          imported_size,
+                                                  uint64_t          total_size,
+                                                  void             *data);
+
+/* Invoked once per run, the import stops after the first error. */
+typedef void (*MpdMediaImporterErrorCallback) (MpdMediaImporter *importer,
+                                               GError const     *error,
+                                               void             *data);
+
+/* Invoked when all files are imported and synced to disk. */
+typedef void (*MpdMediaImporterFinishedCallback) (MpdMediaImporter *importer,
+                                                  uint64_t          imported_size,
+                                                  uint64_t          skipped_size,
+                                                  void             *data);
+
+MpdMediaImporter *
+mpd_media_importer_new (void);
+
+void
+mpd_media_importer_free (MpdMediaImporter *self);
+
+void
+mpd_media_importer_set_journal (MpdMediaImporter *self,
+                                MpdImportJournal *journal);
+
+unsigned int
+mpd_media_importer_get_max_copies (MpdMediaImporter *self);
+
+void
+mpd_media_importer_set_max_copies (MpdMediaImporter *self,
+                                   unsigned int      max_copies);
+
+bool
+mpd_media_importer_get_low_impact (MpdMediaImporter *self);
+
+void
+mpd_media_importer_set_low_impact (MpdMediaImporter *self,
+                                   bool              low_impact);
+
+bool
+mpd_media_importer_get_thumbnails (MpdMediaImporter *self);
+
+void
+mpd_media_importer_set_thumbnails (MpdMediaImporter *self,
+                                   bool              thumbnails);
+
+bool
+mpd_media_importer_get_verify (MpdMediaImporter *self);
+
+void
+mpd_media_importer_set_verify (MpdMediaImporter *self,
+                               bool              verify);
+
+void
+mpd_media_importer_start (MpdMediaImporter                  *self,
+                          MpdMediaScanResult const          *media,
+                          MpdMediaImporterProgressCallback   progress_cb,
+                          MpdMediaImporterErrorCallback      error_cb,
+                          MpdMediaImporterFinishedCallback   finished_cb,
+                          void                              *data);
+
+void
+mpd_media_importer_cancel (MpdMediaImporter *self);
+
+MpdImportStats const *
+mpd_media_importer_sample_stats (MpdMediaImporter *self);
+
+bool
+mpd_media_importer_is_running (MpdMediaImporter *self);
+
+G_END_DECLS
+
+#endif /* MPD_MEDIA_IMPORTER_H */
+
@@ -0,0 +1,554 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+
+#include "mpd-media-index.h"
+#include "config.h"
+
+/*
+ * File layout, native byte order, everything 8-byte aligned so the
+ * mapped file can be used in place:
+ *
+ *   IndexHeader
+ *   IndexDir     [n_dirs]
+ *   IndexFile    [n_files]
+ *   char         strings[strings_size]   NUL-terminated, offset 0 is ""
+ *
+ * Files of a directory are contiguous. A directory is only trusted if it
+ * was last modified well before the index was written, otherwise changes
+ * done within the timestamp granularity of the file system could be missed.
+ */
+
+#define INDEX_MAGIC   "MPDMIDX"
+#define INDEX_VERSION 1
+
+/* FAT has 2 second mtime granularity. */
+#define MTIME_SLACK_S 2
+
+typedef struct
+{
+  char      magic[8];
+  uint32_t  version;
+  uint32_t  n_dirs;
+  uint32_t  n_files;
+  uint32_t  strings_size;
+  int64_t   created;
+  uint64_t  total_size;
+} IndexHeader;
+
+typedef struct
+{
+  int64_t   mtime;
+  uint32_t  path;
+  int32_t   parent;
+  uint32_t  first_file;
+  uint32_t  n_files;
+} IndexDir;
+
+typedef struct
+{
+  uint64_t  size;
+  uint32_t  name;
+  uint32_t  category;
+} IndexFile;
+
+struct MpdMediaIndex_
+{
+  volatile int       ref_count;
+  GMappedFile       *mapped;
+
+  IndexHeader const *header;
+  IndexDir const    *dirs;
+  IndexFile const   *files;
+  char const        *strings;
+
+  GHashTable        *dir_lookup;    /* key=path, value=index + 1 */
+  int               *first_child;
+  int               *next_sibling;
+};
+
+static char *
+get_index_path (char const *key)
+{
+  char *checksum;
+  char *filename;
+  char *path;
+
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_MD5, key, -1);
+  filename = g_strdup_printf ("%s.idx", checksum);
+  path = g_build_filename (g_get_user_cache_dir (), "meego-panel-devices",
+                           "media", filename, NULL);
+  g_free (filename);
+  g_free (checksum);
+
+  return path;
+}
+
+/*
+ * The counts in the header are checked against the file length before
+ * anything is derived from them, in 64 bits so they can't wrap around on
+ * 32 bit systems. Sets up the section pointers on success.
+ */
+static bool
+validate (MpdMediaIndex *self,
+          char const    *contents,
+          gsize          length)
+{
+  IndexHeader const *header = (IndexHeader const *) contents;
+  uint64_t           expected;
+  unsigned int       i;
+
+  if (length < sizeof (IndexHeader) ||
+      0 != memcmp (header->magic, INDEX_MAGIC, sizeof (INDEX_MAGIC)) ||
+      header->version != INDEX_VERSION)
+    return false;
+
+  expected = (uint64_t) sizeof (IndexHeader) +
+             (uint64_t) header->n_dirs * sizeof (IndexDir) +
+             (uint64_t) header->n_files * sizeof (IndexFile) +
+             header->strings_size;
+  if (expected != (uint64_t) length ||
+      0 == header->strings_size)
+    return false;
+
+  self->header = header;
+  self->dirs = (IndexDir const *) (contents + sizeof (IndexHeader));
+  self->files = (IndexFile const *) (self->dirs + header->n_dirs);
+  self->strings = (char const *) (self->files + header->n_files);
+
+  if (self->strings[header->strings_size - 1] != '\0')
+    return false;
+
+  for (i = 0; i < header->n_dirs; i++)
+  {
+    IndexDir const *dir = &self->dirs[i];
+    if (dir->path >= header->strings_size ||
+        dir->parent < -1 ||
+        dir->parent >= (int32_t) i ||
+        dir->first_file > header->n_files ||
+        dir->n_files > header->n_files - dir->first_file)
+      return false;
+  }
+
+  for (i = 0; i < header->n_files; i++)
+  {
+    IndexFile const *file = &self->files[i];
+    if (file->name >= header->strings_size ||
+        file->category >= MPD_MEDIA_CATEGORY_LAST)
+      return false;
+  }
+
+  return true;
+}
+
+MpdMediaIndex *
+mpd_media_index_open (char const *key)
+{
+  MpdMediaIndex *self;
+  GMappedFile   *mapped;
+  char const    *contents;
+  char          *path;
+  GError        *error = NULL;
+  unsigned int   i;
+
+  g_return_val_if_fail (key, NULL);
+
+  path = get_index_path (key);
+  mapped = g_mapped_file_new (path, false, &error);
+  if (error)
+  {
+    if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+      g_warning ("%s : %s", G_STRLOC, error->message);
+    g_clear_error (&error);
+    g_free (path);
+    return NULL;
+  }
+
+  self = g_new0 (MpdMediaIndex, 1);
+  self->ref_count = 1;
+  self->mapped = mapped;
+
+  contents = g_mapped_file_get_contents (mapped);
+  if (!validate (self, contents, g_mapped_file_get_length (mapped)))
+  {
+    g_warning ("%s : Discarding invalid media index %s", G_STRLOC, path);
+    g_mapped_file_unref (mapped);
+    g_free (self);
+    g_unlink (path);
+    g_free (path);
+    return NULL;
+  }
+  g_free (path);
+
+  /* Lookup tables, read-only from here on. */
+  self->dir_lookup = g_hash_table_new (g_str_hash, g_str_equal);
+  self->first_child = g_new (int, self->header->n_dirs);
+  self->next_sibling = g_new (int, self->header->n_dirs);
+  for (i = 0; i < self->header->n_dirs; i++)
+  {
+    self->first_child[i] = -1;
+    self->next_sibling[i] = -1;
+  }
+
+  /* Children end up in reverse order, that's fine. */
+  for (i = 0; i < self->header->n_dirs; i++)
+  {
+    IndexDir const *dir = &self->dirs[i];
+
+    g_hash_table_insert (self->dir_lookup,
+                         (char *) &self->strings[dir->path],
+                         GINT_TO_POINTER (i + 1));
+    if (dir->parent >= 0)
+    {
+      self->next_sibling[i] = self->first_child[dir->parent];
+      self->first_child[dir->parent] = i;
+    }
+  }
+
+  return self;
+}
+
+MpdMediaIndex *
+mpd_media_index_ref (MpdMediaIndex *self)
+{
+  g_return_val_if_fail (self, NULL);
+
+  g_atomic_int_inc (&self->ref_count);
+  return self;
+}
+
+void
+mpd_media_index_unref (MpdMediaIndex *self)
+{
+  g_return_if_fail (self);
+
+  if (g_atomic_int_dec_and_test (&self->ref_count))
+  {
+    g_hash_table_destroy (self->dir_lookup);
+    g_free (self->first_child);
+    g_free (self->next_sibling);
+    g_mapped_file_unref (self->mapped);
+    g_free (self);
+  }
+}
+
+int
+mpd_media_index_lookup_dir (MpdMediaIndex *self,
+                            char const    *path)
+{
+  g_return_val_if_fail (self, -1);
+
+  return GPOINTER_TO_INT (g_hash_table_lookup (self->dir_lookup, path)) - 1;
+}
+
+bool
+mpd_media_index_dir_is_current (MpdMediaIndex *self,
+                                int            dir,
+                                int64_t        mtime)
+{
+  g_return_val_if_fail (self, false);
+  g_return_val_if_fail (dir >= 0 && dir < (int) self->header->n_dirs, false);
+
+  return mtime == self->dirs[dir].mtime &&
+         mtime + MTIME_SLACK_S < self->header->created;
+}
+
+void
+mpd_media_index_dir_get_files (MpdMediaIndex *self,
+                               int            dir,
+                               unsigned int  *first_file,
+                               unsigned int  *n_files)
+{
+  g_return_if_fail (self);
+  g_return_if_fail (dir >= 0 && dir < (int) self->header->n_dirs);
+
+  *first_file = self->dirs[dir].first_file;
+  *n_files = self->dirs[dir].n_files;
+}
+
+int
+mpd_media_index_dir_get_first_child (MpdMediaIndex *self,
+                                     int            dir)
+{
+  g_return_val_if_fail (self, -1);
+  g_return_val_if_fail (dir >= 0 && dir < (int) self->header->n_dirs, -1);
+
+  return self->first_child[dir];
+}
+
+int
+mpd_media_index_dir_get_next_sibling (MpdMediaIndex *self,
+                                      int            dir)
+{
+  g_return_val_if_fail (self, -1);
+  g_return_val_if_fail (dir >= 0 && dir < (int) self->header->n_dirs, -1);
+
+  return self->next_sibling[dir];
+}
+
+char const *
+mpd_media_index_dir_get_path (MpdMediaIndex *self,
+                              int            dir)
+{
+  g_return_val_if_fail (self, NULL);
+  g_return_val_if_fail (dir >= 0 && dir < (int) self->header->n_dirs, NULL);
+
+  return &self->strings[self->dirs[dir].path];
+}
+
+char const *
+mpd_media_index_file_get_name (MpdMediaIndex    *self,
+                               unsigned int      file,
+                               uint64_t         *size,
+                               MpdMediaCategory *category)
+{
+  g_return_val_if_fail (self, NULL);
+  g_return_val_if_fail (file < self->header->n_files, NULL);
+
+  if (size)
+    *size = self->files[file].size;
+  if (category)
+    *category = self->files[file].category;
+
+  return &self->strings[self->files[file].name];
+}
+
+MpdMediaScanResult *
+mpd_media_index_to_result (MpdMediaIndex *self,
+                           char const    *root)
+{
+  MpdMediaScanResult  *result;
+  unsigned int         i;
+
+  g_return_val_if_fail (self, NULL);
+  g_return_val_if_fail (root, NULL);
+
+  result = mpd_media_scan_result_new ();
+
+  for (i = 0; i < self->header->n_dirs; i++)
+  {
+    IndexDir const  *dir = &self->dirs[i];
+    char            *dir_path;
+    unsigned int     j;
+
+    dir_path = g_build_filename (root, &self->strings[dir->path], NULL);
+    mpd_media_scan_result_add_dir (result, dir_path, dir->mtime);
+
+    for (j = dir->first_file; j < dir->first_file + dir->n_files; j++)
+    {
+      IndexFile const *file = &self->files[j];
+      mpd_media_scan_result_add_file (result,
+                                      &self->strings[file->name],
+                                      file->size,
+                                      file->category);
+    }
+
+    g_free (dir_path);
+  }
+
+  result->n_dirs_reused = result->dirs->len;
+
+  return result;
+}
+
+static uint32_t
+add_string (GString     *strings,
+            char const  *string)
+{
+  uint32_t offset = strings->len;
+
+  g_string_append_len (strings, string, strlen (string) + 1);
+
+  return offset;
+}
+
+static char const *
+get_relative_path (char const *root,
+                   char const *path)
+{
+  size_t len = strlen (root);
+
+  if (0 != strncmp (root, path, len))
+    return NULL;
+
+  path += len;
+  while (*path == G_DIR_SEPARATOR)
+    path++;
+
+  return path;
+}
+
+static int
+_compare_scan_dir_cb (MpdMediaScanDir const     **a,
+                      MpdMediaScanDir const     **b,
+                      MpdMediaScanResult const   *result)
+{
+  return strcmp (result->strings->str + (*a)->path,
+                 result->strings->str + (*b)->path);
+}
+
+static void
+_replace_contents_cb (GFile         *file,
+                      GAsyncResult  *res,
+                      char          *contents)
+{
+  GError *error = NULL;
+
+  g_file_replace_contents_finish (file, res, NULL, &error);
+  if (error)
+  {
+    g_warning ("%s : %s", G_STRLOC, error->message);
+    g_clear_error (&error);
+  }
+
+  g_free (contents);
+}
+
+void
+mpd_media_index_save_async (char const          *key,
+                            char const          *root,
+                            MpdMediaScanResult  *result)
+{
+  IndexHeader    header = { { 0, }, };
+  GHashTable    *dir_lookup;
+  GPtrArray     *scan_dirs;
+  GArray        *dirs;
+  GArray        *files;
+  GString       *strings;
+  GString       *contents;
+  GFile         *file;
+  char          *path;
+  char          *dirname;
+  unsigned int   i;
+
+  g_return_if_fail (key);
+  g_return_if_fail (root);
+  g_return_if_fail (result);
+
+  dir_lookup = g_hash_table_new (g_str_hash, g_str_equal);
+  dirs = g_array_sized_new (false, true, sizeof (IndexDir), result->dirs->len);
+  files = g_array_sized_new (false, true, sizeof (IndexFile),
+                             result->files->len);
+  strings = g_string_new (NULL);
+  add_string (strings, "");
+
+  /* Workers finish in any order, sorting puts parents before children. */
+  scan_dirs = g_ptr_array_sized_new (result->dirs->len);
+  for (i = 0; i < result->dirs->len; i++)
+    g_ptr_array_add (scan_dirs,
+                     &g_array_index (result->dirs, MpdMediaScanDir, i));
+  g_ptr_array_sort_with_data (scan_dirs,
+                              (GCompareDataFunc) _compare_scan_dir_cb,
+                              result);
+
+  for (i = 0; i < scan_dirs->len; i++)
+  {
+    MpdMediaScanDir const *scan_dir = g_ptr_array_index (scan_dirs, i);
+    IndexDir     dir = { 0, };
+    char        *scan_path = result->strings->str + scan_dir->path;
+    char const  *rel_path;
+    unsigned int j;
+
+    rel_path = get_relative_path (root, scan_path);
+    if (NULL == rel_path)
+      continue;
+
+    dirname = g_path_get_dirname (scan_path);
+    dir.parent = GPOINTER_TO_INT (g_hash_table_lookup (dir_lookup,
+                                                       dirname)) - 1;
+    g_free (dirname);
+    if (dir.parent < 0 && *rel_path)
+      continue;
+
+    dir.mtime = scan_dir->mtime;
+    dir.path = add_string (strings, rel_path);
+    dir.first_file = files->len;
+    dir.n_files = scan_dir->n_files;
+
+    for (j = scan_dir->first_file;
+         j < scan_dir->first_file + scan_dir->n_files;
+         j++)
+    {
+      MpdMediaFileInfo const *info = &g_array_index (result->files,
+                                                     MpdMediaFileInfo, j);
+      IndexFile   index_file = { 0, };
+
+      index_file.size = info->size;
+      index_file.category = info->category;
+      index_file.name = add_string (strings,
+                                    result->strings->str + info->name);
+      g_array_append_val (files, index_file);
+    }
+
+    g_hash_table_insert (dir_lookup, scan_path,
+                         GINT_TO_POINTER (dirs->len + 1));
+    g_array_append_val (dirs, dir);
+  }
+
+  /* Pad the string table so the file size stays 8-byte aligned. */
+  while (strings->len % 8)
+    g_string_append_c (strings, '\0');
+
+  memcpy (header.magic, INDEX_MAGIC, sizeof (INDEX_MAGIC));
+  header.version = INDEX_VERSION;
+  header.n_dirs = dirs->len;
+  header.n_files = files->len;
+  header.strings_size = strings->len;
+  header.created = time (NULL);
+  header.total_size = result->size;
+
+  contents = g_string_sized_new (sizeof (header) +
+                                 dirs->len * sizeof (IndexDir) +
+                                 files->len * sizeof (IndexFile) +
+                                 strings->len);
+  g_string_append_len (contents, (char const *) &header, sizeof (header));
+  g_string_append_len (contents, dirs->data, dirs->len * sizeof (IndexDir));
+  g_string_append_len (contents, files->data, files->len * sizeof (IndexFile));
+  g_string_append_len (contents, strings->str, strings->len);
+
+  g_hash_table_destroy (dir_lookup);
+  g_ptr_array_free (scan_dirs, true);
+  g_array_free (dirs, true);
+  g_array_free (files, true);
+  g_string_free (strings, true);
+
+  path = get_index_path (key);
+  dirname = g_path_get_dirname (path);
+  g_mkdir_with_parents (dirname, 0700);
+  g_free (dirname);
+
+  file = g_file_new_for_path (path);
+  g_file_replace_contents_async (file,
+                                 contents->str, contents->len,
+                                 NULL, false, G_FILE_CREATE_PRIVATE,
+                                 NULL,
+                                 (GAsyncReadyCallback) _replace_contents_cb,
+                                 contents->str);
+  g_string_free (contents, false);
+  g_object_unref (file);
+  g_free (path);
+}
+
@@ -0,0 +1,92 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPD_MEDIA_INDEX_H
+#define MPD_MEDIA_INDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <glib.h>
+
+#include "mpd-media-scanner.h"
+
+G_BEGIN_DECLS
+
+/*
+ * On-disk media index of a volume, keyed by volume UUID or label.
+ * Directory paths are relative to the mount root, "" being the root itself.
+ * Reading is safe from multiple threads.
+ */
+
+MpdMediaIndex *
+mpd_media_index_open (char const *key);
+
+MpdMediaIndex *
+mpd_media_index_ref (MpdMediaIndex *self);
+
+void
+mpd_media_index_unref (MpdMediaIndex *self);
+
+int
+mpd_media_index_lookup_dir (MpdMediaIndex *self,
+                            char const    *path);
+
+bool
+mpd_media_index_dir_is_current (MpdMediaIndex *self,
+                                int            dir,
+                                int64_t        mtime);
+
+void
+mpd_media_index_dir_get_files (MpdMediaIndex *self,
+                               int            dir,
+                               unsigned int  *first_file,
+                               unsigned int  *n_files);
+
+int
+mpd_media_index_dir_get_first_child (MpdMediaIndex *self,
+                                     int            dir);
+
+int
+mpd_media_index_dir_get_next_sibling (MpdMediaIndex *self,
+                                      int            dir);
+
+char const *
+mpd_media_index_dir_get_path (MpdMediaIndex *self,
+                              int            dir);
+
+char const *
+mpd_media_index_file_get_name (MpdMediaIndex    *self,
+                               unsigned int      file,
+                               uint64_t         *size,
+                               MpdMediaCategory *category);
+
+MpdMediaScanResult *
+mpd_media_index_to_result (MpdMediaIndex *self,
+                           char const    *root);
+
+void
+mpd_media_index_save_async (char const          *key,
+                            char const          *root,
+                            MpdMediaScanResult  *result);
+
+G_END_DECLS
+
+#endif /* MPD_MEDIA_INDEX_H */
+
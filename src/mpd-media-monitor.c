@@ -0,0 +1,458 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+
+#include "mpd-media-monitor.h"
+#include "mpd-media-type.h"
+#include "config.h"
+
+/*
+ * Events are collected for COALESCE_MS before the changed directories
+ * are reported, a camera writing a burst of pictures causes one update.
+ * Files that are known not to be media by name are ignored. If the kernel
+ * queue overflows, events were lost and a full scan is asked for.
+ *
+ * Every watch pins kernel memory and the per-user limit is shared with
+ * other applications, so at most MAX_WATCHES are used. Further
+ * directories are polled for mtime changes in a worker thread.
+ */
+
+#define WATCH_MASK (IN_CREATE | IN_CLOSE_WRITE | IN_DELETE | \
+                    IN_MOVED_FROM | IN_MOVED_TO | \
+                    IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+#define MAX_WATCHES     4096
+#define COALESCE_MS     1000
+#define POLL_INTERVAL_S 30
+
+struct MpdMediaMonitor_
+{
+  int                       fd;
+  unsigned int              io_watch_id;
+  GHashTable               *paths;      /* path -> wd, owns the paths */
+  GHashTable               *watches;    /* wd -> path */
+  GHashTable               *polled;     /* path -> mtime */
+  GHashTable               *dirty;
+  bool                      overflow;
+  unsigned int              coalesce_id;
+  unsigned int              poll_id;
+  GCancellable             *poll_cancellable;  /* Of the poll running. */
+  MpdMediaMonitorCallback   callback;
+  void                     *data;
+};
+
+typedef struct
+{
+  MpdMediaMonitor *monitor;
+  GCancellable    *cancellable;
+  GPtrArray       *paths;
+  GArray          *mtimes;
+  GPtrArray       *changed;
+} PollData;
+
+static bool
+_coalesce_timeout_cb (MpdMediaMonitor *self)
+{
+  GPtrArray       *dirty;
+  GHashTableIter   iter;
+  char            *path;
+
+  self->coalesce_id = 0;
+
+  dirty = g_ptr_array_sized_new (g_hash_table_size (self->dirty));
+  g_hash_table_iter_init (&iter, self->dirty);
+  while (g_hash_table_iter_next (&iter, (void **) &path, NULL))
+    g_ptr_array_add (dirty, path);
+
+  g_debug ("%s() %u directories changed%s", __FUNCTION__, dirty->len,
+           self->overflow ? ", events lost" : "");
+
+  self->callback (self, self->overflow ? NULL : dirty, self->data);
+
+  g_ptr_array_free (dirty, true);
+  g_hash_table_remove_all (self->dirty);
+  self->overflow = false;
+
+  return false;
+}
+
+static void
+mark_dirty (MpdMediaMonitor *self,
+            char const      *path)
+{
+  if (path &&
+      NULL == g_hash_table_lookup (self->dirty, path))
+    g_hash_table_insert (self->dirty, g_strdup (path), GINT_TO_POINTER (true));
+
+  if (0 == self->coalesce_id)
+    self->coalesce_id = g_timeout_add (COALESCE_MS,
+                                       (GSourceFunc) _coalesce_timeout_cb,
+                                       self);
+}
+
+static void
+unwatch (MpdMediaMonitor  *self,
+         int               wd)
+{
+  char *path = g_hash_table_lookup (self->watches, GINT_TO_POINTER (wd));
+
+  g_hash_table_remove (self->watches, GINT_TO_POINTER (wd));
+  if (path)
+    g_hash_table_remove (self->paths, path);
+}
+
+static void
+handle_event (MpdMediaMonitor             *self,
+              struct inotify_event const  *event)
+{
+  char const        *path;
+  MpdMediaCategory   category;
+
+  if (event->mask & IN_Q_OVERFLOW)
+  {
+    self->overflow = true;
+    mark_dirty (self, NULL);
+    return;
+  }
+
+  path = g_hash_table_lookup (self->watches, GINT_TO_POINTER (event->wd));
+  if (NULL == path)
+    return;
+
+  if (event->mask & IN_IGNORED)
+  {
+    /* Removed or unmounted, the watch is gone. */
+    mark_dirty (self, path);
+    unwatch (self, event->wd);
+    return;
+  }
+
+  if (event->len &&
+      !(event->mask & IN_ISDIR) &&
+      mpd_media_type_lookup_name (event->name, &category) &&
+      MPD_MEDIA_CATEGORY_NONE == category)
+    return;
+
+  /* Trash and the like, not scanned either. */
+  if (event->len &&
+      (event->mask & IN_ISDIR) &&
+      event->name[0] == '.')
+    return;
+
+  mark_dirty (self, path);
+}
+
+static bool
+_inotify_cb (GIOChannel       *channel,
+             GIOCondition      condition,
+             MpdMediaMonitor  *self)
+{
+  char     buffer[4096]
+             __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+  ssize_t  n;
+
+  for (;;)
+  {
+    char const *ptr;
+
+    n = read (self->fd, buffer, sizeof (buffer));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+
+    for (ptr = buffer; ptr < buffer + n; )
+    {
+      struct inotify_event const *event = (struct inotify_event const *) ptr;
+
+      handle_event (self, event);
+      ptr += sizeof (struct inotify_event) + event->len;
+    }
+  }
+
+  if (n < 0 &&
+      errno != EAGAIN)
+  {
+    g_warning ("%s : %s", G_STRLOC, strerror (errno));
+    self->io_watch_id = 0;
+    return false;
+  }
+
+  return true;
+}
+
+static void
+poll_data_free (PollData *data)
+{
+  g_object_unref (data->cancellable);
+  g_ptr_array_foreach (data->paths, (GFunc) g_free, NULL);
+  g_ptr_array_free (data->paths, true);
+  g_array_free (data->mtimes, true);
+  g_ptr_array_free (data->changed, true);
+  g_free (data);
+}
+
+static void
+_poll_thread_cb (GSimpleAsyncResult *result,
+                 GObject            *object,
+                 GCancellable       *cancellable)
+{
+  PollData      *data = g_simple_async_result_get_op_res_gpointer (result);
+  unsigned int   i;
+
+  for (i = 0; i < data->paths->len; i++)
+  {
+    char const  *path = g_ptr_array_index (data->paths, i);
+    struct stat  st;
+
+    if (g_cancellable_is_cancelled (cancellable))
+      break;
+
+    /* Gone counts as changed, too. */
+    if (0 != stat (path, &st) ||
+        (int64_t) st.st_mtime != g_array_index (data->mtimes, int64_t, i))
+      g_ptr_array_add (data->changed, (void *) path);
+  }
+}
+
+static void
+_poll_cb (GObject       *source,
+          GAsyncResult  *res,
+          void          *unused)
+{
+  PollData      *data;
+  unsigned int   i;
+
+  data = g_simple_async_result_get_op_res_gpointer (
+                                        G_SIMPLE_ASYNC_RESULT (res));
+
+  /* The monitor may be gone. */
+  if (g_cancellable_is_cancelled (data->cancellable))
+    return;
+
+  data->monitor->poll_cancellable = NULL;
+
+  for (i = 0; i < data->changed->len; i++)
+    mark_dirty (data->monitor, g_ptr_array_index (data->changed, i));
+}
+
+static bool
+_poll_timeout_cb (MpdMediaMonitor *self)
+{
+  GSimpleAsyncResult  *result;
+  PollData            *data;
+  GHashTableIter       iter;
+  char                *path;
+  int64_t             *mtime;
+
+  if (self->poll_cancellable)
+    return true;
+
+  data = g_new0 (PollData, 1);
+  data->monitor = self;
+  data->cancellable = g_cancellable_new ();
+  data->paths = g_ptr_array_new ();
+  data->mtimes = g_array_new (false, false, sizeof (int64_t));
+  data->changed = g_ptr_array_new ();
+
+  g_hash_table_iter_init (&iter, self->polled);
+  while (g_hash_table_iter_next (&iter, (void **) &path, (void **) &mtime))
+  {
+    g_ptr_array_add (data->paths, g_strdup (path));
+    g_array_append_val (data->mtimes, *mtime);
+  }
+
+  self->poll_cancellable = data->cancellable;
+
+  result = g_simple_async_result_new (NULL,
+                                      (GAsyncReadyCallback) _poll_cb, NULL,
+                                      _poll_timeout_cb);
+  g_simple_async_result_set_op_res_gpointer (result, data,
+                                             (GDestroyNotify) poll_data_free);
+  g_simple_async_result_run_in_thread (result,
+                                       (GSimpleAsyncThreadFunc)
+                                         _poll_thread_cb,
+                                       G_PRIORITY_LOW,
+                                       data->cancellable);
+  g_object_unref (result);
+
+  return true;
+}
+
+MpdMediaMonitor *
+mpd_media_monitor_new (MpdMediaMonitorCallback   callback,
+                       void                     *data)
+{
+  MpdMediaMonitor *self;
+
+  g_return_val_if_fail (callback, NULL);
+
+  self = g_new0 (MpdMediaMonitor, 1);
+  self->callback = callback;
+  self->data = data;
+  self->paths = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  self->watches = g_hash_table_new (g_direct_hash, g_direct_equal);
+  self->polled = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                        g_free, g_free);
+  self->dirty = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  self->fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+  if (self->fd < 0)
+  {
+    g_warning ("%s : %s", G_STRLOC, strerror (errno));
+  } else {
+    GIOChannel *channel = g_io_channel_unix_new (self->fd);
+    self->io_watch_id = g_io_add_watch (channel, G_IO_IN,
+                                        (GIOFunc) _inotify_cb, self);
+    g_io_channel_unref (channel);
+  }
+
+  return self;
+}
+
+void
+mpd_media_monitor_free (MpdMediaMonitor *self)
+{
+  g_return_if_fail (self);
+
+  if (self->io_watch_id)
+    g_source_remove (self->io_watch_id);
+  if (self->fd >= 0)
+    close (self->fd);
+  if (self->coalesce_id)
+    g_source_remove (self->coalesce_id);
+  if (self->poll_id)
+    g_source_remove (self->poll_id);
+  if (self->poll_cancellable)
+    g_cancellable_cancel (self->poll_cancellable);
+
+  g_hash_table_destroy (self->watches);
+  g_hash_table_destroy (self->paths);
+  g_hash_table_destroy (self->polled);
+  g_hash_table_destroy (self->dirty);
+  g_free (self);
+}
+
+/*
+ * Brings the watched set in line with the directories of `media', the
+ * latest scan result.
+ */
+void
+mpd_media_monitor_watch (MpdMediaMonitor          *self,
+                         MpdMediaScanResult const *media)
+{
+  GHashTable      *current;
+  GHashTableIter   iter;
+  char            *path;
+  void            *value;
+  unsigned int     i;
+
+  g_return_if_fail (self);
+  g_return_if_fail (media);
+
+  current = g_hash_table_new (g_str_hash, g_str_equal);
+
+  for (i = 0; i < media->dirs->len; i++)
+  {
+    MpdMediaScanDir const *dir = &g_array_index (media->dirs,
+                                                 MpdMediaScanDir, i);
+    int64_t               *mtime;
+    int                    wd = -1;
+
+    path = media->strings->str + dir->path;
+    g_hash_table_insert (current, path, path);
+
+    if (g_hash_table_lookup (self->paths, path))
+      continue;
+
+    mtime = g_hash_table_lookup (self->polled, path);
+    if (mtime)
+    {
+      *mtime = dir->mtime;
+      continue;
+    }
+
+    if (self->fd >= 0 &&
+        g_hash_table_size (self->watches) < MAX_WATCHES)
+    {
+      wd = inotify_add_watch (self->fd, path, WATCH_MASK);
+      if (wd < 0 &&
+          errno != ENOSPC)
+        g_warning ("%s : %s: %s", G_STRLOC, path, strerror (errno));
+    }
+
+    if (wd >= 0)
+    {
+      char *key = g_strdup (path);
+      g_hash_table_insert (self->paths, key, GINT_TO_POINTER (wd));
+      g_hash_table_insert (self->watches, GINT_TO_POINTER (wd), key);
+    } else {
+      mtime = g_new (int64_t, 1);
+      *mtime = dir->mtime;
+      g_hash_table_insert (self->polled, g_strdup (path), mtime);
+    }
+  }
+
+  /* Drop what's no longer there. */
+  g_hash_table_iter_init (&iter, self->paths);
+  while (g_hash_table_iter_next (&iter, (void **) &path, &value))
+  {
+    if (NULL == g_hash_table_lookup (current, path))
+    {
+      inotify_rm_watch (self->fd, GPOINTER_TO_INT (value));
+      g_hash_table_remove (self->watches, value);
+      g_hash_table_iter_remove (&iter);
+    }
+  }
+
+  g_hash_table_iter_init (&iter, self->polled);
+  while (g_hash_table_iter_next (&iter, (void **) &path, NULL))
+  {
+    if (NULL == g_hash_table_lookup (current, path))
+      g_hash_table_iter_remove (&iter);
+  }
+
+  g_hash_table_destroy (current);
+
+  if (g_hash_table_size (self->polled) &&
+      0 == self->poll_id)
+  {
+    self->poll_id = g_timeout_add_seconds (POLL_INTERVAL_S,
+                                           (GSourceFunc) _poll_timeout_cb,
+                                           self);
+  } else if (0 == g_hash_table_size (self->polled) &&
+             self->poll_id) {
+    g_source_remove (self->poll_id);
+    self->poll_id = 0;
+  }
+
+  g_debug ("%s() %u watched, %u polled", __FUNCTION__,
+           g_hash_table_size (self->watches),
+           g_hash_table_size (self->polled));
+}
+
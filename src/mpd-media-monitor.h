@@ -0,0 +1,62 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPD_MEDIA_MONITOR_H
+#define MPD_MEDIA_MONITOR_H
+
+#include <stdbool.h>
+#include <glib.h>
+
+#include "mpd-media-scanner.h"
+
+G_BEGIN_DECLS
+
+/*
+ * Watches the directories of a scan result for changes with inotify and
+ * reports the directories that need to be enumerated again, coalesced.
+ * Beyond a maximum number of watches, directories are checked for mtime
+ * changes periodically instead.
+ */
+
+typedef struct MpdMediaMonitor_ MpdMediaMonitor;
+
+/*
+ * `dirty' holds the full paths of changed directories, or is NULL if
+ * changes were lost and everything needs scanning again.
+ */
+typedef void (*MpdMediaMonitorCallback) (MpdMediaMonitor  *monitor,
+                                         GPtrArray const  *dirty,
+                                         void             *data);
+
+MpdMediaMonitor *
+mpd_media_monitor_new (MpdMediaMonitorCallback   callback,
+                       void                     *data);
+
+void
+mpd_media_monitor_free (MpdMediaMonitor *self);
+
+void
+mpd_media_monitor_watch (MpdMediaMonitor          *self,
+                         MpdMediaScanResult const *media);
+
+G_END_DECLS
+
+#endif /* MPD_MEDIA_MONITOR_H */
+
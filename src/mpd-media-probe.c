@@ -0,0 +1,277 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "mpd-media-probe.h"
+#include "mpd-media-type.h"
+#include "config.h"
+
+/*
+ * Directories in the volume root that usually hold media, searched before
+ * anything else. DCIM is where cameras and phones put pictures and videos,
+ * MISC is used by some phones for audio.
+ */
+static char const *_priority_dirs[] = {
+  "DCIM",
+  "Music",
+  "Pictures",
+  "Videos",
+  "MISC",
+  NULL
+};
+
+/* Camera layouts like DCIM/100CANON are two levels deep. */
+#define MAX_DEPTH 4
+#define MAX_DIRS  256
+
+typedef struct
+{
+  char          *path;
+  unsigned int   depth;
+  bool           priority;
+} ProbeDir;
+
+typedef struct
+{
+  char                *root;
+  MpdMediaProbeResult  ret;
+} ProbeData;
+
+static void
+probe_data_free (ProbeData *data)
+{
+  g_free (data->root);
+  g_free (data);
+}
+
+static void
+probe_dir_free (ProbeDir *dir)
+{
+  g_free (dir->path);
+  g_free (dir);
+}
+
+static bool
+is_priority_dir (char const *name)
+{
+  unsigned int i;
+
+  /* FAT volumes come with any capitalisation. */
+  for (i = 0; _priority_dirs[i]; i++)
+    if (0 == g_ascii_strcasecmp (name, _priority_dirs[i]))
+      return true;
+
+  return false;
+}
+
+static bool
+is_dir (char const    *dir_path,
+        struct dirent *entry)
+{
+  struct stat  st;
+  char        *path;
+  bool         ret;
+
+#ifdef _DIRENT_HAVE_D_TYPE
+  if (entry->d_type != DT_UNKNOWN)
+    return entry->d_type == DT_DIR;
+#endif
+
+  /* Symlinks are not followed, they could loop. */
+  path = g_build_filename (dir_path, entry->d_name, NULL);
+  ret = 0 == lstat (path, &st) && S_ISDIR (st.st_mode);
+  g_free (path);
+
+  return ret;
+}
+
+/*
+ * Classifies the files in `dir' by name and queues its subdirectories.
+ * Those of the root that usually hold media, and everything below them,
+ * go to `priority'. Returns true on the first media file.
+ */
+static bool
+probe_dir (ProbeDir       *dir,
+           GQueue         *priority,
+           GQueue         *queue,
+           bool           *inconclusive)
+{
+  DIR           *handle;
+  struct dirent *entry;
+  bool           found = false;
+
+  handle = opendir (dir->path);
+  if (NULL == handle)
+  {
+    g_warning ("%s : %s: %s", G_STRLOC, dir->path, strerror (errno));
+    return false;
+  }
+
+  while (!found &&
+         NULL != (entry = readdir (handle)))
+  {
+    char const        *name = entry->d_name;
+    MpdMediaCategory   category;
+
+    /* Also skips "." and "..", "dot" directories are used for trash. */
+    if (name[0] == '.')
+      continue;
+
+    if (is_dir (dir->path, entry))
+    {
+      ProbeDir *subdir;
+
+      if (dir->depth + 1 > MAX_DEPTH)
+      {
+        *inconclusive = true;
+        continue;
+      }
+
+      subdir = g_new0 (ProbeDir, 1);
+      subdir->path = g_build_filename (dir->path, name, NULL);
+      subdir->depth = dir->depth + 1;
+      subdir->priority = dir->priority ||
+                         (0 == dir->depth && is_priority_dir (name));
+      if (subdir->priority)
+        g_queue_push_tail (priority, subdir);
+      else
+        g_queue_push_tail (queue, subdir);
+
+    } else if (mpd_media_type_lookup_name (name, &category)) {
+
+      found = category != MPD_MEDIA_CATEGORY_NONE;
+
+    } else {
+
+      /* Only sniffing could tell. */
+      *inconclusive = true;
+    }
+  }
+
+  closedir (handle);
+  return found;
+}
+
+static void
+_probe_thread_cb (GSimpleAsyncResult *result,
+                  GObject            *object,
+                  GCancellable       *cancellable)
+{
+  ProbeData     *data = g_simple_async_result_get_op_res_gpointer (result);
+  GQueue         priority = G_QUEUE_INIT;
+  GQueue         queue = G_QUEUE_INIT;
+  ProbeDir      *dir;
+  unsigned int   n_dirs = 0;
+  bool           inconclusive = false;
+  bool           found = false;
+  GError        *error = NULL;
+
+  dir = g_new0 (ProbeDir, 1);
+  dir->path = g_strdup (data->root);
+  g_queue_push_tail (&queue, dir);
+
+  while (!found &&
+         !g_cancellable_set_error_if_cancelled (cancellable, &error))
+  {
+    dir = g_queue_pop_head (&priority);
+    if (NULL == dir)
+      dir = g_queue_pop_head (&queue);
+    if (NULL == dir)
+      break;
+
+    if (n_dirs++ == MAX_DIRS)
+    {
+      inconclusive = true;
+      probe_dir_free (dir);
+      break;
+    }
+
+    found = probe_dir (dir, &priority, &queue, &inconclusive);
+    probe_dir_free (dir);
+  }
+
+  while (NULL != (dir = g_queue_pop_head (&priority)))
+    probe_dir_free (dir);
+  while (NULL != (dir = g_queue_pop_head (&queue)))
+    probe_dir_free (dir);
+
+  if (error)
+  {
+    g_simple_async_result_set_from_error (result, error);
+    g_clear_error (&error);
+  } else if (found) {
+    data->ret = MPD_MEDIA_PROBE_FOUND;
+  } else if (inconclusive) {
+    data->ret = MPD_MEDIA_PROBE_INCONCLUSIVE;
+  } else {
+    data->ret = MPD_MEDIA_PROBE_NONE;
+  }
+}
+
+void
+mpd_media_probe_async (char const           *root,
+                       GCancellable         *cancellable,
+                       GAsyncReadyCallback   callback,
+                       void                 *data)
+{
+  GSimpleAsyncResult  *result;
+  ProbeData           *probe_data;
+
+  g_return_if_fail (root);
+
+  probe_data = g_new0 (ProbeData, 1);
+  probe_data->root = g_strdup (root);
+
+  result = g_simple_async_result_new (NULL, callback, data,
+                                      mpd_media_probe_async);
+  g_simple_async_result_set_op_res_gpointer (result, probe_data,
+                                             (GDestroyNotify) probe_data_free);
+  g_simple_async_result_run_in_thread (result,
+                                       (GSimpleAsyncThreadFunc)
+                                         _probe_thread_cb,
+                                       G_PRIORITY_DEFAULT,
+                                       cancellable);
+  g_object_unref (result);
+}
+
+MpdMediaProbeResult
+mpd_media_probe_finish (GAsyncResult  *result,
+                        GError       **error)
+{
+  GSimpleAsyncResult  *simple = (GSimpleAsyncResult *) result;
+  ProbeData           *data;
+
+  g_return_val_if_fail (g_simple_async_result_is_valid (result, NULL,
+                                                        mpd_media_probe_async),
+                        MPD_MEDIA_PROBE_INCONCLUSIVE);
+
+  if (g_simple_async_result_propagate_error (simple, error))
+    return MPD_MEDIA_PROBE_INCONCLUSIVE;
+
+  data = g_simple_async_result_get_op_res_gpointer (simple);
+  return data->ret;
+}
+
@@ -0,0 +1,56 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPD_MEDIA_PROBE_H
+#define MPD_MEDIA_PROBE_H
+
+#include <stdbool.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Quick check whether a volume holds any media, without enumerating all
+ * of it. Well-known media directories are searched first, breadth-first
+ * and to a limited depth, files are only classified by name. The search
+ * stops at the first media file.
+ */
+
+typedef enum
+{
+  MPD_MEDIA_PROBE_NONE = 0,     /* Searched everything, no media. */
+  MPD_MEDIA_PROBE_FOUND,
+  MPD_MEDIA_PROBE_INCONCLUSIVE  /* Limits hit, or files not known by name. */
+} MpdMediaProbeResult;
+
+void
+mpd_media_probe_async (char const           *root,
+                       GCancellable         *cancellable,
+                       GAsyncReadyCallback   callback,
+                       void                 *data);
+
+MpdMediaProbeResult
+mpd_media_probe_finish (GAsyncResult  *result,
+                        GError       **error);
+
+G_END_DECLS
+
+#endif /* MPD_MEDIA_PROBE_H */
+
@@ -0,0 +1,809 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <gio/gio.h>
+
+#include "mpd-media-index.h"
+#include "mpd-media-scanner.h"
+#include "mpd-media-type.h"
+#include "config.h"
+
+/*
+ * Directories are enumerated on a small shared thread pool, one work item
+ * per directory. Workers collect their findings locally and merge them into
+ * the job under the lock once per directory. When the last pending directory
+ * is done the aggregated result is handed to the main context.
+ *
+ * If an index from a previous scan is set, directories whose mtime did not
+ * change are taken from the index rather than enumerated.
+ *
+ * An update starts from a previous result and only enumerates the given
+ * directories, plus subdirectories not in that result. Directories that
+ * turn out to be gone are dropped along with everything below them.
+ */
+
+#define MAX_THREADS 4
+
+typedef struct
+{
+  volatile int         ref_count;
+  GMutex              *mutex;
+  GCancellable        *cancellable;
+  volatile int         pending;
+
+  char                *root;
+  MpdMediaIndex       *index;
+  MpdMediaScanResult  *result;
+
+  /* Updates only. Paths already accounted for, read-only once started,
+   * and directories found gone, under the lock. */
+  GHashTable          *known;
+  GPtrArray           *gone;
+
+  /* Main context only. */
+  MpdMediaScanner     *scanner;
+} ScanJob;
+
+typedef struct
+{
+  ScanJob *job;
+  char    *path;
+} ScanItem;
+
+struct MpdMediaScanner_
+{
+  char                    *path;
+  MpdMediaIndex           *index;
+  ScanJob                 *job;
+  MpdMediaScannerCallback  callback;
+  void                    *data;
+};
+
+static void
+_scan_dir_cb (ScanItem  *item,
+              void      *data);
+
+static GThreadPool *
+get_thread_pool (void)
+{
+  static GThreadPool *_pool = NULL;
+  GError *error = NULL;
+
+  if (_pool)
+    return _pool;
+
+  if (!g_thread_supported ())
+    g_thread_init (NULL);
+
+  _pool = g_thread_pool_new ((GFunc) _scan_dir_cb, NULL,
+                             MAX_THREADS, false, &error);
+  if (error)
+  {
+    g_critical ("%s : %s", G_STRLOC, error->message);
+    g_clear_error (&error);
+  }
+
+  return _pool;
+}
+
+MpdMediaScanResult *
+mpd_media_scan_result_new (void)
+{
+  MpdMediaScanResult *self = g_new0 (MpdMediaScanResult, 1);
+
+  self->files = g_array_new (false, false, sizeof (MpdMediaFileInfo));
+  self->dirs = g_array_new (false, false, sizeof (MpdMediaScanDir));
+  self->strings = g_string_new (NULL);
+
+  return self;
+}
+
+MpdMediaScanResult *
+mpd_media_scan_result_copy (MpdMediaScanResult const *self)
+{
+  MpdMediaScanResult *copy;
+
+  g_return_val_if_fail (self, NULL);
+
+  copy = g_new0 (MpdMediaScanResult, 1);
+  *copy = *self;
+
+  copy->files = g_array_sized_new (false, false, sizeof (MpdMediaFileInfo),
+                                   self->files->len);
+  g_array_append_vals (copy->files, self->files->data, self->files->len);
+  copy->dirs = g_array_sized_new (false, false, sizeof (MpdMediaScanDir),
+                                  self->dirs->len);
+  g_array_append_vals (copy->dirs, self->dirs->data, self->dirs->len);
+  copy->strings = g_string_new_len (self->strings->str, self->strings->len);
+
+  return copy;
+}
+
+static uint32_t
+add_string (MpdMediaScanResult  *self,
+            char const          *string)
+{
+  uint32_t offset = self->strings->len;
+
+  g_string_append_len (self->strings, string, strlen (string) + 1);
+
+  return offset;
+}
+
+void
+mpd_media_scan_result_add_dir (MpdMediaScanResult *self,
+                               char const         *path,
+                               int64_t             mtime)
+{
+  MpdMediaScanDir dir;
+
+  g_return_if_fail (self);
+
+  dir.path = add_string (self, path);
+  dir.mtime = mtime;
+  dir.first_file = self->files->len;
+  dir.n_files = 0;
+  g_array_append_val (self->dirs, dir);
+}
+
+/* Adds to the most recently added directory. */
+void
+mpd_media_scan_result_add_file (MpdMediaScanResult *self,
+                                char const         *name,
+                                uint64_t            size,
+                                MpdMediaCategory    category)
+{
+  MpdMediaFileInfo info;
+
+  g_return_if_fail (self);
+  g_return_if_fail (self->dirs->len);
+
+  info.size = size;
+  info.category = category;
+  info.dir = self->dirs->len - 1;
+  info.name = add_string (self, name);
+  g_array_append_val (self->files, info);
+
+  g_array_index (self->dirs, MpdMediaScanDir, info.dir).n_files++;
+  self->counts[category]++;
+  self->sizes[category] += size;
+  self->size += size;
+}
+
+char const *
+mpd_media_scan_result_get_dir_path (MpdMediaScanResult const *self,
+                                    unsigned int              dir)
+{
+  g_return_val_if_fail (self, NULL);
+  g_return_val_if_fail (dir < self->dirs->len, NULL);
+
+  return self->strings->str +
+         g_array_index (self->dirs, MpdMediaScanDir, dir).path;
+}
+
+char const *
+mpd_media_scan_result_get_file_name (MpdMediaScanResult const *self,
+                                     unsigned int              file)
+{
+  g_return_val_if_fail (self, NULL);
+  g_return_val_if_fail (file < self->files->len, NULL);
+
+  return self->strings->str +
+         g_array_index (self->files, MpdMediaFileInfo, file).name;
+}
+
+/* Returns a newly allocated full path. */
+char *
+mpd_media_scan_result_get_file_path (MpdMediaScanResult const *self,
+                                     unsigned int              file)
+{
+  MpdMediaFileInfo const *info;
+
+  g_return_val_if_fail (self, NULL);
+  g_return_val_if_fail (file < self->files->len, NULL);
+
+  info = &g_array_index (self->files, MpdMediaFileInfo, file);
+
+  return g_build_filename (mpd_media_scan_result_get_dir_path (self, info->dir),
+                           self->strings->str + info->name,
+                           NULL);
+}
+
+void
+mpd_media_scan_result_free (MpdMediaScanResult *self)
+{
+  g_return_if_fail (self);
+
+  g_array_free (self->files, true);
+  g_array_free (self->dirs, true);
+  g_string_free (self->strings, true);
+  g_free (self);
+}
+
+static ScanJob *
+scan_job_new (MpdMediaScanner *scanner)
+{
+  ScanJob *job = g_new0 (ScanJob, 1);
+
+  job->ref_count = 1;
+  job->mutex = g_mutex_new ();
+  job->cancellable = g_cancellable_new ();
+  job->root = g_strdup (scanner->path);
+  job->index = scanner->index ? mpd_media_index_ref (scanner->index) : NULL;
+  job->result = mpd_media_scan_result_new ();
+  job->scanner = scanner;
+
+  return job;
+}
+
+static ScanJob *
+scan_job_ref (ScanJob *job)
+{
+  g_atomic_int_inc (&job->ref_count);
+  return job;
+}
+
+static void
+scan_job_unref (ScanJob *job)
+{
+  if (g_atomic_int_dec_and_test (&job->ref_count))
+  {
+    if (job->result)
+      mpd_media_scan_result_free (job->result);
+    if (job->index)
+      mpd_media_index_unref (job->index);
+    if (job->known)
+      g_hash_table_destroy (job->known);
+    if (job->gone)
+    {
+      g_ptr_array_foreach (job->gone, (GFunc) g_free, NULL);
+      g_ptr_array_free (job->gone, true);
+    }
+    g_free (job->root);
+    g_object_unref (job->cancellable);
+    g_mutex_free (job->mutex);
+    g_free (job);
+  }
+}
+
+/*
+ * Classify by extension first, then by the name-based content type, and
+ * only sniff file contents if neither tells.
+ */
+static MpdMediaCategory
+classify (ScanJob    *job,
+          char const *dir_path,
+          GFileInfo  *info)
+{
+  MpdMediaCategory   category;
+  char const        *content_type;
+  char              *path;
+  GFile             *file;
+  GFileInfo         *sniffed;
+  GError            *error = NULL;
+
+  if (mpd_media_type_lookup_name (g_file_info_get_name (info), &category))
+    return category;
+
+  content_type = g_file_info_get_attribute_string (info,
+                              G_FILE_ATTRIBUTE_STANDARD_FAST_CONTENT_TYPE);
+  if (!mpd_media_type_is_generic (content_type))
+    return mpd_media_type_classify_content_type (content_type);
+
+  path = g_build_filename (dir_path, g_file_info_get_name (info), NULL);
+  file = g_file_new_for_path (path);
+  g_free (path);
+  sniffed = g_file_query_info (file, G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE,
+                               G_FILE_QUERY_INFO_NONE,
+                               job->cancellable, &error);
+  g_object_unref (file);
+  if (error)
+  {
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+      g_warning ("%s : %s", G_STRLOC, error->message);
+    g_clear_error (&error);
+    return MPD_MEDIA_CATEGORY_NONE;
+  }
+
+  category = mpd_media_type_classify_content_type (
+                g_file_info_get_content_type (sniffed));
+  g_object_unref (sniffed);
+
+  return category;
+}
+
+static bool
+is_below (char const *path,
+          char const *dir)
+{
+  size_t len = strlen (dir);
+
+  return 0 == strncmp (path, dir, len) &&
+         (path[len] == '\0' || path[len] == G_DIR_SEPARATOR);
+}
+
+/* Returns a copy of `result' without the directories in `gone'. */
+static MpdMediaScanResult *
+prune_result (MpdMediaScanResult const  *result,
+              GPtrArray const           *gone)
+{
+  MpdMediaScanResult  *pruned = mpd_media_scan_result_new ();
+  unsigned int         i;
+  unsigned int         j;
+
+  for (i = 0; i < result->dirs->len; i++)
+  {
+    MpdMediaScanDir const *dir = &g_array_index (result->dirs,
+                                                 MpdMediaScanDir, i);
+    char const            *path = result->strings->str + dir->path;
+    bool                   keep = true;
+
+    for (j = 0; keep && j < gone->len; j++)
+      keep = !is_below (path, g_ptr_array_index (gone, j));
+    if (!keep)
+      continue;
+
+    mpd_media_scan_result_add_dir (pruned, path, dir->mtime);
+    for (j = dir->first_file; j < dir->first_file + dir->n_files; j++)
+    {
+      MpdMediaFileInfo const *info = &g_array_index (result->files,
+                                                     MpdMediaFileInfo, j);
+      mpd_media_scan_result_add_file (pruned,
+                                      result->strings->str + info->name,
+                                      info->size,
+                                      info->category);
+    }
+  }
+  pruned->n_dirs_reused = result->n_dirs_reused;
+
+  return pruned;
+}
+
+static bool
+_job_done_cb (ScanJob *job)
+{
+  MpdMediaScanner     *self = job->scanner;
+  MpdMediaScanResult  *result;
+
+  /* Cancelled or superseded, nobody is interested any more. */
+  if (g_cancellable_is_cancelled (job->cancellable) ||
+      NULL == self ||
+      self->job != job)
+    return false;
+
+  if (job->gone &&
+      job->gone->len)
+  {
+    result = prune_result (job->result, job->gone);
+    mpd_media_scan_result_free (job->result);
+  } else {
+    result = job->result;
+  }
+  job->result = NULL;
+
+  self->job = NULL;
+  scan_job_unref (job);
+
+  g_debug ("%s() %s: %u files, %u dirs (%u unchanged), %"
+           G_GUINT64_FORMAT " bytes",
+           __FUNCTION__, self->path,
+           result->files->len, result->dirs->len, result->n_dirs_reused,
+           result->size);
+
+  if (self->callback)
+    self->callback (self, result, self->data);
+  else
+    mpd_media_scan_result_free (result);
+
+  return false;
+}
+
+static void
+push_dir (ScanJob     *job,
+          char const  *path)
+{
+  ScanItem *item = g_new0 (ScanItem, 1);
+
+  item->job = scan_job_ref (job);
+  item->path = g_strdup (path);
+
+  g_atomic_int_inc (&job->pending);
+  g_thread_pool_push (get_thread_pool (), item, NULL);
+}
+
+static void
+pop_dir (ScanJob *job)
+{
+  if (g_atomic_int_dec_and_test (&job->pending))
+  {
+    g_idle_add_full (G_PRIORITY_DEFAULT_IDLE,
+                     (GSourceFunc) _job_done_cb,
+                     scan_job_ref (job),
+                     (GDestroyNotify) scan_job_unref);
+  }
+}
+
+static char const *
+get_relative_path (ScanJob    *job,
+                   char const *path)
+{
+  path += strlen (job->root);
+  while (*path == G_DIR_SEPARATOR)
+    path++;
+
+  return path;
+}
+
+/*
+ * Take the directory's files from the index and queue its subdirectories,
+ * which may or may not have changed themselves.
+ */
+static void
+reuse_dir (ScanJob            *job,
+           char const         *path,
+           int                 dir,
+           MpdMediaScanResult *local)
+{
+  unsigned int  first_file;
+  unsigned int  n_files;
+  unsigned int  i;
+  int           child;
+
+  mpd_media_index_dir_get_files (job->index, dir, &first_file, &n_files);
+  for (i = first_file; i < first_file + n_files; i++)
+  {
+    char const        *name;
+    uint64_t           size;
+    MpdMediaCategory   category;
+
+    name = mpd_media_index_file_get_name (job->index, i, &size, &category);
+    mpd_media_scan_result_add_file (local, name, size, category);
+  }
+
+  for (child = mpd_media_index_dir_get_first_child (job->index, dir);
+       child >= 0;
+       child = mpd_media_index_dir_get_next_sibling (job->index, child))
+  {
+    char *subpath = g_build_filename (job->root,
+                                      mpd_media_index_dir_get_path (job->index,
+                                                                    child),
+                                      NULL);
+    push_dir (job, subpath);
+    g_free (subpath);
+  }
+}
+
+static void
+enumerate_dir (ScanJob            *job,
+               char const         *path,
+               MpdMediaScanResult *local)
+{
+  GFile               *dir;
+  GFileEnumerator     *enumerator;
+  GFileInfo           *info;
+  GError              *error = NULL;
+
+  dir = g_file_new_for_path (path);
+  enumerator = g_file_enumerate_children (dir, MPD_MEDIA_TYPE_FAST_ATTRIBUTES,
+                                          G_FILE_QUERY_INFO_NONE,
+                                          job->cancellable, &error);
+  g_object_unref (dir);
+  if (error)
+  {
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+      g_warning ("%s : %s", G_STRLOC, error->message);
+    g_clear_error (&error);
+    return;
+  }
+
+  while (NULL != (info = g_file_enumerator_next_file (enumerator,
+                                                      job->cancellable,
+                                                      &error)))
+  {
+    char const *name = g_file_info_get_name (info);
+
+    /* Do not recurse into "dot" directories, they are use for trash. */
+    if (G_FILE_TYPE_DIRECTORY == g_file_info_get_file_type (info))
+    {
+      if (name[0] != '.')
+      {
+        char *subpath = g_build_filename (path, name, NULL);
+        if (NULL == job->known ||
+            NULL == g_hash_table_lookup (job->known, subpath))
+          push_dir (job, subpath);
+        g_free (subpath);
+      }
+
+    } else {
+
+      MpdMediaCategory category = classify (job, path, info);
+
+      if (category != MPD_MEDIA_CATEGORY_NONE)
+      {
+        mpd_media_scan_result_add_file (local,
+                                        name,
+                                        g_file_info_get_size (info),
+                                        category);
+      }
+    }
+
+    g_object_unref (info);
+  }
+
+  if (error)
+  {
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+      g_warning ("%s : %s", G_STRLOC, error->message);
+    g_clear_error (&error);
+  }
+
+  g_object_unref (enumerator);
+}
+
+/* Append the single directory of `local' with its files in bulk. */
+static void
+merge_result (ScanJob            *job,
+              MpdMediaScanResult *local)
+{
+  MpdMediaScanResult  *result = job->result;
+  MpdMediaScanDir      dir;
+  uint32_t             offset;
+  uint32_t             dir_index;
+  unsigned int         i;
+
+  offset = result->strings->len;
+  dir_index = result->dirs->len;
+  g_string_append_len (result->strings, local->strings->str,
+                       local->strings->len);
+
+  dir = g_array_index (local->dirs, MpdMediaScanDir, 0);
+  dir.path += offset;
+  dir.first_file = result->files->len;
+  g_array_append_val (result->dirs, dir);
+
+  for (i = 0; i < local->files->len; i++)
+  {
+    MpdMediaFileInfo info = g_array_index (local->files, MpdMediaFileInfo, i);
+
+    info.dir = dir_index;
+    info.name += offset;
+    g_array_append_val (result->files, info);
+  }
+
+  for (i = 0; i < MPD_MEDIA_CATEGORY_LAST; i++)
+  {
+    result->counts[i] += local->counts[i];
+    result->sizes[i] += local->sizes[i];
+  }
+  result->size += local->size;
+  result->n_dirs_reused += local->n_dirs_reused;
+}
+
+static void
+_scan_dir_cb (ScanItem  *item,
+              void      *data)
+{
+  ScanJob             *job = item->job;
+  MpdMediaScanResult  *local;
+  struct stat          st;
+  int                  dir = -1;
+
+  if (g_cancellable_is_cancelled (job->cancellable))
+    goto bail;
+
+  if (0 != stat (item->path, &st))
+  {
+    if (job->gone)
+    {
+      g_mutex_lock (job->mutex);
+      g_ptr_array_add (job->gone, g_strdup (item->path));
+      g_mutex_unlock (job->mutex);
+    }
+    goto bail;
+  }
+
+  local = mpd_media_scan_result_new ();
+  mpd_media_scan_result_add_dir (local, item->path, st.st_mtime);
+
+  if (job->index)
+    dir = mpd_media_index_lookup_dir (job->index,
+                                      get_relative_path (job, item->path));
+
+  if (dir >= 0 &&
+      mpd_media_index_dir_is_current (job->index, dir, st.st_mtime))
+  {
+    reuse_dir (job, item->path, dir, local);
+    local->n_dirs_reused++;
+  } else {
+    enumerate_dir (job, item->path, local);
+  }
+
+  /* Merge. */
+  g_mutex_lock (job->mutex);
+  if (job->result)
+    merge_result (job, local);
+  g_mutex_unlock (job->mutex);
+
+  mpd_media_scan_result_free (local);
+
+bail:
+  pop_dir (job);
+  scan_job_unref (job);
+  g_free (item->path);
+  g_free (item);
+}
+
+MpdMediaScanner *
+mpd_media_scanner_new (char const *path)
+{
+  MpdMediaScanner *self;
+
+  g_return_val_if_fail (path, NULL);
+
+  self = g_new0 (MpdMediaScanner, 1);
+  self->path = g_strdup (path);
+
+  return self;
+}
+
+void
+mpd_media_scanner_free (MpdMediaScanner *self)
+{
+  g_return_if_fail (self);
+
+  mpd_media_scanner_cancel (self);
+  if (self->index)
+    mpd_media_index_unref (self->index);
+  g_free (self->path);
+  g_free (self);
+}
+
+/*
+ * Index from a previous scan, used by subsequent runs.
+ */
+void
+mpd_media_scanner_set_index (MpdMediaScanner *self,
+                             MpdMediaIndex   *index)
+{
+  g_return_if_fail (self);
+
+  if (self->index)
+    mpd_media_index_unref (self->index);
+
+  self->index = index ? mpd_media_index_ref (index) : NULL;
+}
+
+void
+mpd_media_scanner_start (MpdMediaScanner          *self,
+                         MpdMediaScannerCallback   callback,
+                         void                     *data)
+{
+  g_return_if_fail (self);
+
+  if (!g_file_test (self->path, G_FILE_TEST_IS_DIR))
+  {
+    g_warning ("%s : %s is not a directory", G_STRLOC, self->path);
+    return;
+  }
+
+  /* Restart if already running. */
+  mpd_media_scanner_cancel (self);
+
+  self->callback = callback;
+  self->data = data;
+  self->job = scan_job_new (self);
+
+  push_dir (self->job, self->path);
+}
+
+/*
+ * Re-enumerates only the directories in `dirty', taking everything else
+ * from `base'. Meant for applying changes reported by file system
+ * monitoring, the index is not consulted.
+ */
+void
+mpd_media_scanner_update (MpdMediaScanner           *self,
+                          MpdMediaScanResult const  *base,
+                          GPtrArray const           *dirty,
+                          MpdMediaScannerCallback    callback,
+                          void                      *data)
+{
+  ScanJob       *job;
+  unsigned int   i;
+  unsigned int   j;
+
+  g_return_if_fail (self);
+  g_return_if_fail (base);
+  g_return_if_fail (dirty && dirty->len);
+
+  /* Restart if already running. */
+  mpd_media_scanner_cancel (self);
+
+  self->callback = callback;
+  self->data = data;
+  self->job = job = scan_job_new (self);
+
+  if (job->index)
+  {
+    mpd_media_index_unref (job->index);
+    job->index = NULL;
+  }
+  job->known = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  job->gone = g_ptr_array_new ();
+
+  for (i = 0; i < dirty->len; i++)
+    g_hash_table_insert (job->known,
+                         g_strdup (g_ptr_array_index (dirty, i)),
+                         GINT_TO_POINTER (true));
+
+  /* Nothing runs yet, no need to lock. */
+  for (i = 0; i < base->dirs->len; i++)
+  {
+    MpdMediaScanDir const *dir = &g_array_index (base->dirs,
+                                                 MpdMediaScanDir, i);
+    char const            *path = base->strings->str + dir->path;
+
+    if (g_hash_table_lookup (job->known, path))
+      continue;
+    g_hash_table_insert (job->known, g_strdup (path), GINT_TO_POINTER (true));
+
+    mpd_media_scan_result_add_dir (job->result, path, dir->mtime);
+    for (j = dir->first_file; j < dir->first_file + dir->n_files; j++)
+    {
+      MpdMediaFileInfo const *info = &g_array_index (base->files,
+                                                     MpdMediaFileInfo, j);
+      mpd_media_scan_result_add_file (job->result,
+                                      base->strings->str + info->name,
+                                      info->size,
+                                      info->category);
+    }
+    job->result->n_dirs_reused++;
+  }
+
+  for (i = 0; i < dirty->len; i++)
+    push_dir (job, g_ptr_array_index (dirty, i));
+}
+
+void
+mpd_media_scanner_cancel (MpdMediaScanner *self)
+{
+  g_return_if_fail (self);
+
+  if (self->job)
+  {
+    g_cancellable_cancel (self->job->cancellable);
+    self->job->scanner = NULL;
+    scan_job_unref (self->job);
+    self->job = NULL;
+  }
+}
+
+bool
+mpd_media_scanner_is_running (MpdMediaScanner *self)
+{
+  g_return_val_if_fail (self, false);
+
+  return self->job != NULL;
+}
+
@@ -0,0 +1,148 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPD_MEDIA_SCANNER_H
+#define MPD_MEDIA_SCANNER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+  MPD_MEDIA_CATEGORY_NONE = 0,
+  MPD_MEDIA_CATEGORY_AUDIO,
+  MPD_MEDIA_CATEGORY_IMAGE,
+  MPD_MEDIA_CATEGORY_VIDEO,
+
+  MPD_MEDIA_CATEGORY_LAST
+} MpdMediaCategory;
+
+typedef struct
+{
+  uint64_t          size;
+  MpdMediaCategory  category;
+  uint32_t          dir;      /* Index into `dirs' */
+  uint32_t          name;     /* Offset of the basename in `strings' */
+} MpdMediaFileInfo;
+
+/* Media files of a directory are stored contiguously in the result. */
+typedef struct
+{
+  uint32_t       path;        /* Offset of the full path in `strings' */
+  int64_t        mtime;
+  unsigned int   first_file;
+  unsigned int   n_files;
+} MpdMediaScanDir;
+
+/*
+ * Aggregated outcome of a scan, this is all that is handed back to the
+ * main context. Directory paths are stored once and files refer to them,
+ * all strings live in one buffer.
+ */
+typedef struct
+{
+  GArray        *files;     /* MpdMediaFileInfo */
+  GArray        *dirs;      /* MpdMediaScanDir */
+  GString       *strings;   /* NUL terminated paths and basenames */
+  uint64_t       size;      /* Sum of all media file sizes. */
+  unsigned int   counts[MPD_MEDIA_CATEGORY_LAST];
+  uint64_t       sizes[MPD_MEDIA_CATEGORY_LAST];
+  unsigned int   n_dirs_reused;
+} MpdMediaScanResult;
+
+MpdMediaScanResult *
+mpd_media_scan_result_new (void);
+
+MpdMediaScanResult *
+mpd_media_scan_result_copy (MpdMediaScanResult const *self);
+
+void
+mpd_media_scan_result_add_dir (MpdMediaScanResult *self,
+                               char const         *path,
+                               int64_t             mtime);
+
+void
+mpd_media_scan_result_add_file (MpdMediaScanResult *self,
+                                char const         *name,
+                                uint64_t            size,
+                                MpdMediaCategory    category);
+
+char const *
+mpd_media_scan_result_get_dir_path (MpdMediaScanResult const *self,
+                                    unsigned int              dir);
+
+char const *
+mpd_media_scan_result_get_file_name (MpdMediaScanResult const *self,
+                                     unsigned int              file);
+
+char *
+mpd_media_scan_result_get_file_path (MpdMediaScanResult const *self,
+                                     unsigned int              file);
+
+void
+mpd_media_scan_result_free (MpdMediaScanResult *self);
+
+typedef struct MpdMediaIndex_ MpdMediaIndex;
+
+typedef struct MpdMediaScanner_ MpdMediaScanner;
+
+/*
+ * Invoked in the main context once the scan is done. Ownership of `result'
+ * is transferred to the callee.
+ */
+typedef void (*MpdMediaScannerCallback) (MpdMediaScanner    *scanner,
+                                         MpdMediaScanResult *result,
+                                         void               *data);
+
+MpdMediaScanner *
+mpd_media_scanner_new (char const *path);
+
+void
+mpd_media_scanner_free (MpdMediaScanner *self);
+
+void
+mpd_media_scanner_set_index (MpdMediaScanner *self,
+                             MpdMediaIndex   *index);
+
+void
+mpd_media_scanner_start (MpdMediaScanner          *self,
+                         MpdMediaScannerCallback   callback,
+                         void                     *data);
+
+void
+mpd_media_scanner_update (MpdMediaScanner           *self,
+                          MpdMediaScanResult const  *base,
+                          GPtrArray const           *dirty,
+                          MpdMediaScannerCallback    callback,
+                          void                      *data);
+
+void
+mpd_media_scanner_cancel (MpdMediaScanner *self);
+
+bool
+mpd_media_scanner_is_running (MpdMediaScanner *self);
+
+G_END_DECLS
+
+#endif /* MPD_MEDIA_SCANNER_H */
+
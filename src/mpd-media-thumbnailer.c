@@ -0,0 +1,567 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <glib/gstdio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "mpd-media-thumbnailer.h"
+#include "config.h"
+
+/*
+ * The image is read into memory once, right after the copy while it's
+ * still cached. Most camera JPEGs carry a small preview in their Exif
+ * data which is enough for the normal size, so only those without get
+ * decoded. Decoding asks the loader for the large size up front, which
+ * lets the JPEG loader scale in the DCT domain instead of producing the
+ * full resolution image. The normal size is then box filtered from the
+ * large one.
+ *
+ * One thread only, thumbnails are a nicety and mustn't compete with
+ * imports and the UI on single core machines.
+ */
+
+#define MAX_THREADS     1
+#define MAX_FILE_SIZE   (32 * 1024 * 1024)
+
+#define NORMAL_SIZE     128
+#define LARGE_SIZE      256
+
+#define EXIF_TAG_ORIENTATION            0x0112
+#define EXIF_TAG_JPEG_INTERCHANGE       0x0201
+#define EXIF_TAG_JPEG_INTERCHANGE_LEN   0x0202
+
+static void
+_thumbnail_cb (char *path,
+               void *data);
+
+static GThreadPool *
+get_thread_pool (void)
+{
+  static GThreadPool *_pool = NULL;
+  GError *error = NULL;
+
+  if (_pool)
+    return _pool;
+
+  if (!g_thread_supported ())
+    g_thread_init (NULL);
+
+  _pool = g_thread_pool_new ((GFunc) _thumbnail_cb, NULL,
+                             MAX_THREADS, false, &error);
+  if (error)
+  {
+    g_critical ("%s : %s", G_STRLOC, error->message);
+    g_clear_error (&error);
+  }
+
+  return _pool;
+}
+
+static unsigned int
+read_u16 (uint8_t const *p,
+          bool           big_endian)
+{
+  return big_endian ? (p[0] << 8) | p[1] :
+                      p[0] | (p[1] << 8);
+}
+
+static uint32_t
+read_u32 (uint8_t const *p,
+          bool           big_endian)
+{
+  return big_endian ?
+          ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3] :
+          p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/*
+ * TIFF structure of the Exif segment, if the file is a JPEG that has one.
+ */
+static bool
+find_exif (uint8_t const  *data,
+           size_t          len,
+           uint8_t const **tiff,
+           size_t         *tiff_len)
+{
+  size_t p = 2;
+
+  if (len < 4 || data[0] != 0xff || data[1] != 0xd8)
+    return false;
+
+  while (p + 4 <= len)
+  {
+    unsigned int marker;
+    unsigned int seg_len;
+
+    if (data[p] != 0xff)
+      return false;
+
+    marker = data[p + 1];
+    if (marker == 0xff)
+    {
+      /* Fill byte. */
+      p++;
+      continue;
+    }
+
+    /* Start of scan or end of image, there's no more metadata. */
+    if (marker == 0xda || marker == 0xd9)
+      return false;
+
+    seg_len = read_u16 (data + p + 2, true);
+    if (seg_len < 2 || p + 2 + seg_len > len)
+      return false;
+
+    if (marker == 0xe1 &&
+        seg_len >= 16 &&
+        0 == memcmp (data + p + 4, "Exif\0\0", 6))
+    {
+      *tiff = data + p + 10;
+      *tiff_len = seg_len - 8;
+      return true;
+    }
+
+    p += 2 + seg_len;
+  }
+
+  return false;
+}
+
+/*
+ * Integer value of a SHORT or LONG entry in the directory at `ifd'.
+ */
+static bool
+lookup_tag (uint8_t const *tiff,
+            size_t         len,
+            bool           big_endian,
+            uint32_t       ifd,
+            unsigned int   tag,
+            uint32_t      *value)
+{
+  unsigned int n_entries;
+  unsigned int i;
+
+  if (ifd < 8 || ifd > len - 2)
+    return false;
+
+  n_entries = read_u16 (tiff + ifd, big_endian);
+  if (n_entries > (len - ifd - 2) / 12)
+    return false;
+
+  for (i = 0; i < n_entries; i++)
+  {
+    uint8_t const *entry = tiff + ifd + 2 + i * 12;
+
+    if (read_u16 (entry, big_endian) != tag)
+      continue;
+
+    switch (read_u16 (entry + 2, big_endian))
+    {
+    case 3:
+      *value = read_u16 (entry + 8, big_endian);
+      return true;
+    case 4:
+      *value = read_u32 (entry + 8, big_endian);
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  return false;
+}
+
+static uint32_t
+get_next_ifd (uint8_t const *tiff,
+              size_t         len,
+              bool           big_endian,
+              uint32_t       ifd)
+{
+  unsigned int  n_entries;
+  size_t        next;
+
+  if (ifd < 8 || ifd > len - 2)
+    return 0;
+
+  n_entries = read_u16 (tiff + ifd, big_endian);
+  next = ifd + 2 + (size_t) n_entries * 12;
+  if (next > len - 4)
+    return 0;
+
+  return read_u32 (tiff + next, big_endian);
+}
+
+/*
+ * Embedded preview, it is stored in the second directory. The orientation
+ * of the main image applies to it as well.
+ */
+static bool
+get_exif_thumbnail (uint8_t const  *data,
+                    size_t          len,
+                    uint8_t const **thumb,
+                    size_t         *thumb_len,
+                    unsigned int   *orientation)
+{
+  uint8_t const *tiff;
+  size_t         tiff_len;
+  bool           big_endian;
+  uint32_t       ifd0;
+  uint32_t       ifd1;
+  uint32_t       offset;
+  uint32_t       size;
+  uint32_t       value;
+
+  if (!find_exif (data, len, &tiff, &tiff_len))
+    return false;
+
+  if (0 == memcmp (tiff, "MM", 2))
+    big_endian = true;
+  else if (0 == memcmp (tiff, "II", 2))
+    big_endian = false;
+  else
+    return false;
+
+  if (read_u16 (tiff + 2, big_endian) != 42)
+    return false;
+
+  ifd0 = read_u32 (tiff + 4, big_endian);
+  *orientation = 1;
+  if (lookup_tag (tiff, tiff_len, big_endian, ifd0,
+                  EXIF_TAG_ORIENTATION, &value) &&
+      value >= 1 && value <= 8)
+    *orientation = value;
+
+  ifd1 = get_next_ifd (tiff, tiff_len, big_endian, ifd0);
+  if (0 == ifd1 ||
+      !lookup_tag (tiff, tiff_len, big_endian, ifd1,
+                   EXIF_TAG_JPEG_INTERCHANGE, &offset) ||
+      !lookup_tag (tiff, tiff_len, big_endian, ifd1,
+                   EXIF_TAG_JPEG_INTERCHANGE_LEN, &size))
+    return false;
+
+  if (size < 4 || offset > tiff_len || size > tiff_len - offset)
+    return false;
+
+  *thumb = tiff + offset;
+  *thumb_len = size;
+  return true;
+}
+
+/*
+ * Same transformations as gdk_pixbuf_apply_embedded_orientation(), for
+ * pixbufs that didn't get the option from their loader.
+ */
+static GdkPixbuf *
+apply_orientation (GdkPixbuf    *pixbuf,
+                   unsigned int  orientation)
+{
+  GdkPixbuf *rotated;
+  GdkPixbuf *oriented;
+
+  switch (orientation)
+  {
+  case 2:
+    return gdk_pixbuf_flip (pixbuf, true);
+  case 3:
+    return gdk_pixbuf_rotate_simple (pixbuf, GDK_PIXBUF_ROTATE_UPSIDEDOWN);
+  case 4:
+    return gdk_pixbuf_flip (pixbuf, false);
+  case 5:
+  case 7:
+    rotated = gdk_pixbuf_rotate_simple (pixbuf, GDK_PIXBUF_ROTATE_CLOCKWISE);
+    oriented = gdk_pixbuf_flip (rotated, orientation == 5);
+    g_object_unref (rotated);
+    return oriented;
+  case 6:
+    return gdk_pixbuf_rotate_simple (pixbuf, GDK_PIXBUF_ROTATE_CLOCKWISE);
+  case 8:
+    return gdk_pixbuf_rotate_simple (pixbuf,
+                                     GDK_PIXBUF_ROTATE_COUNTERCLOCKWISE);
+  default:
+    return g_object_ref (pixbuf);
+  }
+}
+
+static void
+fit_size (int  size,
+          int *width,
+          int *height)
+{
+  if (*width <= size && *height <= size)
+    return;
+
+  if (*width > *height)
+  {
+    *height = MAX (1, (int) ((int64_t) *height * size / *width));
+    *width = size;
+  } else {
+    *width = MAX (1, (int) ((int64_t) *width * size / *height));
+    *height = size;
+  }
+}
+
+static void
+_size_prepared_cb (GdkPixbufLoader  *loader,
+                   int               width,
+                   int               height,
+                   void             *size)
+{
+  int w = width;
+  int h = height;
+
+  fit_size (GPOINTER_TO_INT (size), &w, &h);
+  if (w != width || h != height)
+    gdk_pixbuf_loader_set_size (loader, w, h);
+}
+
+/*
+ * Decode `data', no larger than `size' unless that is 0.
+ */
+static GdkPixbuf *
+load_pixbuf (uint8_t const  *data,
+             size_t          len,
+             int             size,
+             GError        **error)
+{
+  GdkPixbufLoader *loader;
+  GdkPixbuf       *pixbuf = NULL;
+
+  loader = gdk_pixbuf_loader_new ();
+  if (size)
+    g_signal_connect (loader, "size-prepared",
+                      G_CALLBACK (_size_prepared_cb), GINT_TO_POINTER (size));
+
+  if (gdk_pixbuf_loader_write (loader, data, len, error) &&
+      gdk_pixbuf_loader_close (loader, error))
+  {
+    pixbuf = gdk_pixbuf_loader_get_pixbuf (loader);
+    if (pixbuf)
+      pixbuf = gdk_pixbuf_apply_embedded_orientation (pixbuf);
+  } else {
+    gdk_pixbuf_loader_close (loader, NULL);
+  }
+
+  g_object_unref (loader);
+  return pixbuf;
+}
+
+/*
+ * GDK_INTERP_TILES is a box filter when shrinking.
+ */
+static GdkPixbuf *
+fit_pixbuf (GdkPixbuf *pixbuf,
+            int        size)
+{
+  int width = gdk_pixbuf_get_width (pixbuf);
+  int height = gdk_pixbuf_get_height (pixbuf);
+
+  fit_size (size, &width, &height);
+  if (width == gdk_pixbuf_get_width (pixbuf) &&
+      height == gdk_pixbuf_get_height (pixbuf))
+    return g_object_ref (pixbuf);
+
+  return gdk_pixbuf_scale_simple (pixbuf, width, height, GDK_INTERP_TILES);
+}
+
+/*
+ * Written to a temporary file and renamed into place, so readers never
+ * see a partial thumbnail.
+ */
+static bool
+save_thumbnail (GdkPixbuf   *pixbuf,
+                char const  *uri,
+                char const  *mtime,
+                bool         large,
+                GError     **error)
+{
+  char  *thumb_path;
+  char  *thumb_dir;
+  char  *tmp_path;
+  int    fd;
+  bool   ret = false;
+
+  thumb_path = mpd_media_thumbnailer_get_thumbnail_path (uri, large);
+  thumb_dir = g_path_get_dirname (thumb_path);
+  tmp_path = g_strdup_printf ("%s.XXXXXX", thumb_path);
+
+  if (g_mkdir_with_parents (thumb_dir, 0700) < 0)
+  {
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                 "Could not create \"%s\": %s",
+                 thumb_dir, g_strerror (errno));
+    goto bail;
+  }
+
+  fd = g_mkstemp (tmp_path);
+  if (fd < 0)
+  {
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                 "Could not create \"%s\": %s",
+                 tmp_path, g_strerror (errno));
+    goto bail;
+  }
+  close (fd);
+
+  if (!gdk_pixbuf_save (pixbuf, tmp_path, "png", error,
+                        "tEXt::Thumb::URI", uri,
+                        "tEXt::Thumb::MTime", mtime,
+                        "tEXt::Software", PACKAGE_NAME,
+                        NULL))
+  {
+    g_unlink (tmp_path);
+    goto bail;
+  }
+
+  if (g_rename (tmp_path, thumb_path) < 0)
+  {
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                 "Could not rename \"%s\": %s",
+                 tmp_path, g_strerror (errno));
+    g_unlink (tmp_path);
+    goto bail;
+  }
+
+  ret = true;
+
+bail:
+  g_free (tmp_path);
+  g_free (thumb_dir);
+  g_free (thumb_path);
+  return ret;
+}
+
+static void
+_thumbnail_cb (char *path,
+               void *data)
+{
+  struct stat    st;
+  char          *contents = NULL;
+  gsize          len;
+  char          *uri = NULL;
+  char          *mtime = NULL;
+  uint8_t const *thumb_data;
+  size_t         thumb_len;
+  unsigned int   orientation;
+  GdkPixbuf     *pixbuf;
+  GdkPixbuf     *normal;
+  GError        *error = NULL;
+
+  if (g_stat (path, &st) < 0 ||
+      !S_ISREG (st.st_mode) ||
+      st.st_size > MAX_FILE_SIZE)
+    goto bail;
+
+  if (!g_file_get_contents (path, &contents, &len, &error))
+    goto bail;
+
+  uri = g_filename_to_uri (path, NULL, &error);
+  if (NULL == uri)
+    goto bail;
+
+  mtime = g_strdup_printf ("%ld", (long) st.st_mtime);
+
+  /* Embedded preview first, if it's big enough. */
+  if (get_exif_thumbnail ((uint8_t const *) contents, len,
+                          &thumb_data, &thumb_len, &orientation))
+  {
+    GdkPixbuf *thumb = load_pixbuf (thumb_data, thumb_len, 0, NULL);
+
+    if (thumb &&
+        MAX (gdk_pixbuf_get_width (thumb),
+             gdk_pixbuf_get_height (thumb)) >= NORMAL_SIZE)
+    {
+      pixbuf = apply_orientation (thumb, orientation);
+      normal = fit_pixbuf (pixbuf, NORMAL_SIZE);
+      save_thumbnail (normal, uri, mtime, false, &error);
+      g_object_unref (normal);
+      g_object_unref (pixbuf);
+      g_object_unref (thumb);
+      goto bail;
+    }
+
+    if (thumb)
+      g_object_unref (thumb);
+  }
+
+  pixbuf = load_pixbuf ((uint8_t const *) contents, len, LARGE_SIZE, &error);
+  if (NULL == pixbuf)
+    goto bail;
+
+  if (save_thumbnail (pixbuf, uri, mtime, true, &error))
+  {
+    normal = fit_pixbuf (pixbuf, NORMAL_SIZE);
+    save_thumbnail (normal, uri, mtime, false, &error);
+    g_object_unref (normal);
+  }
+  g_object_unref (pixbuf);
+
+bail:
+  if (error)
+  {
+    g_warning ("%s : %s", G_STRLOC, error->message);
+    g_clear_error (&error);
+  }
+  g_free (mtime);
+  g_free (uri);
+  g_free (contents);
+  g_free (path);
+}
+
+/*
+ * Create thumbnails for the image at `path' in the background.
+ */
+void
+mpd_media_thumbnailer_queue (char const *path)
+{
+  g_return_if_fail (path);
+
+  g_thread_pool_push (get_thread_pool (), g_strdup (path), NULL);
+}
+
+/*
+ * Location of the thumbnail for `uri' in the cache, normal or large size.
+ */
+char *
+mpd_media_thumbnailer_get_thumbnail_path (char const  *uri,
+                                          bool         large)
+{
+  char *md5;
+  char *name;
+  char *path;
+
+  g_return_val_if_fail (uri, NULL);
+
+  md5 = g_compute_checksum_for_string (G_CHECKSUM_MD5, uri, -1);
+  name = g_strdup_printf ("%s.png", md5);
+  path = g_build_filename (g_get_home_dir (), ".thumbnails",
+                           large ? "large" : "normal", name, NULL);
+  g_free (name);
+  g_free (md5);
+
+  return path;
+}
+
@@ -0,0 +1,45 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPD_MEDIA_THUMBNAILER_H
+#define MPD_MEDIA_THUMBNAILER_H
+
+#include <stdbool.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Thumbnails of imported images in the shared cache, as described by the
+ * freedesktop.org thumbnail managing standard, so viewers find them ready.
+ * Work is queued to a background thread, failures are only logged.
+ */
+
+void
+mpd_media_thumbnailer_queue (char const *path);
+
+char *
+mpd_media_thumbnailer_get_thumbnail_path (char const  *uri,
+                                          bool         large);
+
+G_END_DECLS
+
+#endif /* MPD_MEDIA_THUMBNAILER_H */
+
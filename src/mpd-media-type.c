@@ -0,0 +1,228 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "mpd-media-type.h"
+#include "config.h"
+
+/*
+ * Extensions found on cameras, phones and music players. Known non-media
+ * files are listed too, so they are skipped without falling back to
+ * content sniffing.
+ */
+static struct
+{
+  char const        *extension;
+  MpdMediaCategory   category;
+} const _extensions[] = {
+  /* Audio */
+  { "aac",  MPD_MEDIA_CATEGORY_AUDIO },
+  { "aif",  MPD_MEDIA_CATEGORY_AUDIO },
+  { "aiff", MPD_MEDIA_CATEGORY_AUDIO },
+  { "amr",  MPD_MEDIA_CATEGORY_AUDIO },
+  { "ape",  MPD_MEDIA_CATEGORY_AUDIO },
+  { "flac", MPD_MEDIA_CATEGORY_AUDIO },
+  { "m4a",  MPD_MEDIA_CATEGORY_AUDIO },
+  { "m4b",  MPD_MEDIA_CATEGORY_AUDIO },
+  { "mid",  MPD_MEDIA_CATEGORY_AUDIO },
+  { "midi", MPD_MEDIA_CATEGORY_AUDIO },
+  { "mka",  MPD_MEDIA_CATEGORY_AUDIO },
+  { "mp2",  MPD_MEDIA_CATEGORY_AUDIO },
+  { "mp3",  MPD_MEDIA_CATEGORY_AUDIO },
+  { "mpc",  MPD_MEDIA_CATEGORY_AUDIO },
+  { "oga",  MPD_MEDIA_CATEGORY_AUDIO },
+  { "ogg",  MPD_MEDIA_CATEGORY_AUDIO },
+  { "opus", MPD_MEDIA_CATEGORY_AUDIO },
+  { "ra",   MPD_MEDIA_CATEGORY_AUDIO },
+  { "spx",  MPD_MEDIA_CATEGORY_AUDIO },
+  { "wav",  MPD_MEDIA_CATEGORY_AUDIO },
+  { "wma",  MPD_MEDIA_CATEGORY_AUDIO },
+  { "wv",   MPD_MEDIA_CATEGORY_AUDIO },
+  /* Image */
+  { "arw",  MPD_MEDIA_CATEGORY_IMAGE },
+  { "bmp",  MPD_MEDIA_CATEGORY_IMAGE },
+  { "cr2",  MPD_MEDIA_CATEGORY_IMAGE },
+  { "crw",  MPD_MEDIA_CATEGORY_IMAGE },
+  { "dng",  MPD_MEDIA_CATEGORY_IMAGE },
+  { "gif",  MPD_MEDIA_CATEGORY_IMAGE },
+  { "jpe",  MPD_MEDIA_CATEGORY_IMAGE },
+  { "jpeg", MPD_MEDIA_CATEGORY_IMAGE },
+  { "jpg",  MPD_MEDIA_CATEGORY_IMAGE },
+  { "mpo",  MPD_MEDIA_CATEGORY_IMAGE },
+  { "nef",  MPD_MEDIA_CATEGORY_IMAGE },
+  { "orf",  MPD_MEDIA_CATEGORY_IMAGE },
+  { "pef",  MPD_MEDIA_CATEGORY_IMAGE },
+  { "png",  MPD_MEDIA_CATEGORY_IMAGE },
+  { "raf",  MPD_MEDIA_CATEGORY_IMAGE },
+  { "rw2",  MPD_MEDIA_CATEGORY_IMAGE },
+  { "srw",  MPD_MEDIA_CATEGORY_IMAGE },
+  { "svg",  MPD_MEDIA_CATEGORY_IMAGE },
+  { "tif",  MPD_MEDIA_CATEGORY_IMAGE },
+  { "tiff", MPD_MEDIA_CATEGORY_IMAGE },
+  { "webp", MPD_MEDIA_CATEGORY_IMAGE },
+  { "x3f",  MPD_MEDIA_CATEGORY_IMAGE },
+  /* Video */
+  { "3g2",  MPD_MEDIA_CATEGORY_VIDEO },
+  { "3gp",  MPD_MEDIA_CATEGORY_VIDEO },
+  { "asf",  MPD_MEDIA_CATEGORY_VIDEO },
+  { "avi",  MPD_MEDIA_CATEGORY_VIDEO },
+  { "divx", MPD_MEDIA_CATEGORY_VIDEO },
+  { "flv",  MPD_MEDIA_CATEGORY_VIDEO },
+  { "m2t",  MPD_MEDIA_CATEGORY_VIDEO },
+  { "m2ts", MPD_MEDIA_CATEGORY_VIDEO },
+  { "m4v",  MPD_MEDIA_CATEGORY_VIDEO },
+  { "mkv",  MPD_MEDIA_CATEGORY_VIDEO },
+  { "mod",  MPD_MEDIA_CATEGORY_VIDEO },
+  { "mov",  MPD_MEDIA_CATEGORY_VIDEO },
+  { "mp4",  MPD_MEDIA_CATEGORY_VIDEO },
+  { "mpeg", MPD_MEDIA_CATEGORY_VIDEO },
+  { "mpg",  MPD_MEDIA_CATEGORY_VIDEO },
+  { "mts",  MPD_MEDIA_CATEGORY_VIDEO },
+  { "ogv",  MPD_MEDIA_CATEGORY_VIDEO },
+  { "tod",  MPD_MEDIA_CATEGORY_VIDEO },
+  { "vob",  MPD_MEDIA_CATEGORY_VIDEO },
+  { "webm", MPD_MEDIA_CATEGORY_VIDEO },
+  { "wmv",  MPD_MEDIA_CATEGORY_VIDEO },
+  /* Known not to be media. */
+  { "bak",  MPD_MEDIA_CATEGORY_NONE },
+  { "bin",  MPD_MEDIA_CATEGORY_NONE },
+  { "cfg",  MPD_MEDIA_CATEGORY_NONE },
+  { "ctg",  MPD_MEDIA_CATEGORY_NONE },
+  { "dat",  MPD_MEDIA_CATEGORY_NONE },
+  { "db",   MPD_MEDIA_CATEGORY_NONE },
+  { "doc",  MPD_MEDIA_CATEGORY_NONE },
+  { "exe",  MPD_MEDIA_CATEGORY_NONE },
+  { "htm",  MPD_MEDIA_CATEGORY_NONE },
+  { "html", MPD_MEDIA_CATEGORY_NONE },
+  { "ind",  MPD_MEDIA_CATEGORY_NONE },
+  { "inf",  MPD_MEDIA_CATEGORY_NONE },
+  { "ini",  MPD_MEDIA_CATEGORY_NONE },
+  { "log",  MPD_MEDIA_CATEGORY_NONE },
+  { "lnk",  MPD_MEDIA_CATEGORY_NONE },
+  { "m3u",  MPD_MEDIA_CATEGORY_NONE },
+  { "pdf",  MPD_MEDIA_CATEGORY_NONE },
+  { "pls",  MPD_MEDIA_CATEGORY_NONE },
+  { "thm",  MPD_MEDIA_CATEGORY_NONE },
+  { "tmp",  MPD_MEDIA_CATEGORY_NONE },
+  { "txt",  MPD_MEDIA_CATEGORY_NONE },
+  { "xml",  MPD_MEDIA_CATEGORY_NONE },
+  { "zip",  MPD_MEDIA_CATEGORY_NONE }
+};
+
+/* Longest extension in the table. */
+#define MAX_EXTENSION_LEN 4
+
+static GHashTable *
+get_extension_table (void)
+{
+  static volatile gsize _table = 0;
+
+  if (g_once_init_enter (&_table))
+  {
+    GHashTable    *table;
+    unsigned int   i;
+
+    table = g_hash_table_new (g_str_hash, g_str_equal);
+    for (i = 0; i < G_N_ELEMENTS (_extensions); i++)
+    {
+      /* Store category + 1 so NONE is distinguishable from a miss. */
+      g_hash_table_insert (table,
+                           (char *) _extensions[i].extension,
+                           GUINT_TO_POINTER (_extensions[i].category + 1));
+    }
+
+    g_once_init_leave (&_table, (gsize) table);
+  }
+
+  return (GHashTable *) _table;
+}
+
+/*
+ * Classify by file name only. Returns false if the extension is unknown and
+ * the content type needs to be looked at.
+ */
+bool
+mpd_media_type_lookup_name (char const        *name,
+                            MpdMediaCategory  *category)
+{
+  char const    *extension;
+  char           key[MAX_EXTENSION_LEN + 1];
+  unsigned int   value;
+  size_t         len;
+  unsigned int   i;
+
+  g_return_val_if_fail (name, false);
+  g_return_val_if_fail (category, false);
+
+  extension = strrchr (name, '.');
+  if (NULL == extension ||
+      extension == name)
+    return false;
+
+  extension++;
+  len = strlen (extension);
+  if (0 == len ||
+      len > MAX_EXTENSION_LEN)
+    return false;
+
+  for (i = 0; i < len; i++)
+    key[i] = g_ascii_tolower (extension[i]);
+  key[len] = '\0';
+
+  value = GPOINTER_TO_UINT (g_hash_table_lookup (get_extension_table (), key));
+  if (0 == value)
+    return false;
+
+  *category = value - 1;
+  return true;
+}
+
+MpdMediaCategory
+mpd_media_type_classify_content_type (char const *content_type)
+{
+  if (NULL == content_type)
+    return MPD_MEDIA_CATEGORY_NONE;
+
+  if (g_str_has_prefix (content_type, "audio/"))
+    return MPD_MEDIA_CATEGORY_AUDIO;
+
+  if (g_str_has_prefix (content_type, "image/"))
+    return MPD_MEDIA_CATEGORY_IMAGE;
+
+  if (g_str_has_prefix (content_type, "video/"))
+    return MPD_MEDIA_CATEGORY_VIDEO;
+
+  return MPD_MEDIA_CATEGORY_NONE;
+}
+
+/*
+ * Whether a content type guessed from the name alone says nothing, so the
+ * file's content needs to be sniffed.
+ */
+bool
+mpd_media_type_is_generic (char const *content_type)
+{
+  return NULL == content_type ||
+         0 == strcmp (content_type, "application/octet-stream") ||
+         0 == strcmp (content_type, "text/plain");
+}
+
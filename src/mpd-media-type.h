@@ -0,0 +1,49 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPD_MEDIA_TYPE_H
+#define MPD_MEDIA_TYPE_H
+
+#include <stdbool.h>
+#include <glib.h>
+
+#include "mpd-media-scanner.h"
+
+G_BEGIN_DECLS
+
+/* Attributes needed to classify enumerated files without sniffing. */
+#define MPD_MEDIA_TYPE_FAST_ATTRIBUTES \
+          "standard::name,standard::type,standard::size," \
+          "standard::fast-content-type"
+
+bool
+mpd_media_type_lookup_name (char const        *name,
+                            MpdMediaCategory  *category);
+
+MpdMediaCategory
+mpd_media_type_classify_content_type (char const *content_type);
+
+bool
+mpd_media_type_is_generic (char const *content_type);
+
+G_END_DECLS
+
+#endif /* MPD_MEDIA_TYPE_H */
+
@@ -24,6 +24,8 @@
 
 #include "mpd-computer-pane.h"
 #include "mpd-devices-pane.h"
+#include "mpd-free-space.h"
+#include "mpd-io-meter.h"
 #include "mpd-shell.h"
 #include "mpd-shell-defines.h"
 #include "config.h"
@@ -166,6 +168,22 @@ mpd_shell_new (void)
 }
 
 
+static void
+_panel_show_cb (MplPanelClient  *client,
+                MpdShell        *self)
+{
+  mpd_free_space_set_suspended (false);
+  mpd_io_meter_set_suspended (false);
+}
+
+static void
+_panel_hide_cb (MplPanelClient  *client,
+                MpdShell        *self)
+{
+  mpd_free_space_set_suspended (true);
+  mpd_io_meter_set_suspended (true);
+}
+
 void
 mpd_shell_set_client (MpdShell *self, MplPanelClient *client)
 {
@@ -173,5 +191,11 @@ mpd_shell_set_client (MpdShell *self, MplPanelClient *client)
 
   priv->panel_client = client;
 
+  /* Disk usage and throughput are not looked at while hidden. */
+  g_signal_connect (client, "show",
+                    G_CALLBACK (_panel_show_cb), self);
+  g_signal_connect (client, "hide",
+                    G_CALLBACK (_panel_hide_cb), self);
+
   mpd_devices_pane_set_client (priv->pane, client);
 }
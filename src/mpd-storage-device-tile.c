@@ -26,6 +26,7 @@
 #include <libnotify/notify.h>
 
 #include "mpd-gobject.h"
+#include "mpd-io-meter.h"
 #include "mpd-shell-defines.h"
 #include "mpd-storage-device.h"
 #include "mpd-storage-device-tile.h"
@@ -36,10 +37,6 @@ static void
 mpd_storage_device_tile_set_icon_file (MpdStorageDeviceTile  *self,
                                        char const            *icon_file);
 static void
-mpd_storage_device_tile_set_mime_type (MpdStorageDeviceTile *self,
-                                       char const           *mime_type);
-
-static void
 mpd_storage_device_tile_set_mount_point (MpdStorageDeviceTile  *self,
                                          char const            *mount_point);
 
@@ -96,6 +93,8 @@ typedef struct
   char                      *mount_point;
   char                      *name;
   MpdStorageDevice          *storage;
+  MpdIoMeter                *io_meter;
+  char                      *io_text;
   bool                       storage_has_media;
   GArray                    *processes;
   MplPanelClient            *panel_client;
@@ -114,6 +113,24 @@ mpd_storage_device_tile_error_quark (void)
   return _quark;
 }
 
+static void
+update_import_label (MpdStorageDeviceTile *self)
+{
+  MpdStorageDeviceTilePrivate *priv = GET_PRIVATE (self);
+
+  if (NULL == priv->import)
+    return;
+
+  /* FIXME: import button should only be active if the import app is available,
+   * otherwise show an error. */
+  if (0 == g_strcmp0 ("x-content/image-dcf", priv->mime_type))
+  {
+    mx_button_set_label (MX_BUTTON (priv->import), _("Import photos"));
+  } else {
+    mx_button_set_label (MX_BUTTON (priv->import), _("Import media"));
+  }
+}
+
 static void
 update (MpdStorageDeviceTile *self)
 {
@@ -123,6 +140,13 @@ update (MpdStorageDeviceTile *self)
   int64_t        available_size = -1;
 
   markup = mpd_storage_device_tile_get_title (self);
+  if (priv->io_text)
+  {
+    char *title = markup;
+    markup = g_strdup_printf ("%s\n<span color='%s'>%s</span>",
+                              title, TEXT_COLOR, priv->io_text);
+    g_free (title);
+  }
   clutter_text_set_markup (GET_CLUTTER_TEXT (priv->label),
                            markup);
   g_free (markup);
@@ -156,6 +180,34 @@ _storage_size_notify_cb (MpdStorageDevice     *storage,
   update (self);
 }
 
+static void
+_io_meter_cb (MpdIoMeter            *meter,
+              uint64_t               read_rate,
+              uint64_t               write_rate,
+              unsigned int           in_flight,
+              MpdStorageDeviceTile  *self)
+{
+  MpdStorageDeviceTilePrivate *priv = GET_PRIVATE (self);
+
+  g_free (priv->io_text);
+  priv->io_text = NULL;
+
+  if (read_rate || write_rate || in_flight)
+  {
+    char *read_text = g_format_size_for_display (read_rate);
+    char *write_text = g_format_size_for_display (write_rate);
+    priv->io_text = g_strdup_printf (_("Reading %s/s, writing %s/s, "
+                                       "%u pending"),
+                                     read_text,
+                                     write_text,
+                                     in_flight);
+    g_free (read_text);
+    g_free (write_text);
+  }
+
+  update (self);
+}
+
 static bool
 launch_gthumb_import (MpdStorageDeviceTile  *self,
                       GError               **error)
@@ -342,6 +394,9 @@ _constructor (GType                  type,
                       G_CALLBACK (_storage_size_notify_cb), self);
       g_signal_connect (priv->storage, "notify::available-size",
                       G_CALLBACK (_storage_size_notify_cb), self);
+      priv->io_meter = mpd_io_meter_new (path,
+                                         (MpdIoMeterCallback) _io_meter_cb,
+                                         self);
       g_free (path);
     }
 
@@ -354,14 +409,7 @@ _constructor (GType                  type,
     self = NULL;
   }
 
-  /* FIXME: import button should only be active if the import app is available,
-   * otherwise show an error. */
-  if (0 == g_strcmp0 ("x-content/image-dcf", priv->mime_type))
-  {
-    mx_button_set_label (MX_BUTTON (priv->import), _("Import photos"));
-  } else {
-    mx_button_set_label (MX_BUTTON (priv->import), _("Import media"));
-  }
+  update_import_label (self);
 
   return (GObject *) self;
 }
@@ -466,6 +514,18 @@ _dispose (GObject *object)
     priv->name = NULL;
   }
 
+  if (priv->io_meter)
+  {
+    mpd_io_meter_free (priv->io_meter);
+    priv->io_meter = NULL;
+  }
+
+  if (priv->io_text)
+  {
+    g_free (priv->io_text);
+    priv->io_text = NULL;
+  }
+
   mpd_gobject_detach (object, (GObject **) &priv->storage);
 
   G_OBJECT_CLASS (mpd_storage_device_tile_parent_class)->dispose (object);
@@ -503,7 +563,7 @@ mpd_storage_device_tile_class_init (MpdStorageDeviceTileClass *klass)
                                                         "Device mime type",
                                                         NULL,
                                                         param_flags |
-                                                        G_PARAM_CONSTRUCT_ONLY));
+                                                        G_PARAM_CONSTRUCT));
   g_object_class_install_property (object_class,
                                    PROP_MOUNT_POINT,
                                    g_param_spec_string ("mount-point",
@@ -745,7 +805,11 @@ mpd_storage_device_tile_get_mime_type (MpdStorageDeviceTile *self)
   return priv->mime_type;
 }
 
-static void
+/*
+ * The content type may only be known after the tile is shown, it decides
+ * which application imports.
+ */
+void
 mpd_storage_device_tile_set_mime_type (MpdStorageDeviceTile *self,
                                        char const           *mime_type)
 {
@@ -766,6 +830,7 @@ mpd_storage_device_tile_set_mime_type (MpdStorageDeviceTile *self,
       priv->mime_type = g_strdup (mime_type);
     }
 
+    update_import_label (self);
     g_object_notify (G_OBJECT (self), "mime-type");
   }
 }
@@ -897,7 +962,10 @@ mpd_storage_device_tile_show_message (MpdStorageDeviceTile  *self,
                                              NULL);
 }
 
-void
+/*
+ * Returns the id of the timeout source calling `function', if any.
+ */
+unsigned int
 mpd_storage_device_tile_show_message_full (MpdStorageDeviceTile  *self,
                                            char const            *message,
                                            bool                   replace_buttons,
@@ -907,7 +975,7 @@ mpd_storage_device_tile_show_message_full (MpdStorageDeviceTile  *self,
 {
   MpdStorageDeviceTilePrivate *priv = GET_PRIVATE (self);
 
-  g_return_if_fail (MPD_IS_STORAGE_DEVICE_TILE (self));
+  g_return_val_if_fail (MPD_IS_STORAGE_DEVICE_TILE (self), 0);
 
   if (priv->message == NULL)
   {
@@ -937,8 +1005,10 @@ mpd_storage_device_tile_show_message_full (MpdStorageDeviceTile  *self,
 
   if (timeout_s)
   {
-    g_timeout_add_seconds (timeout_s, function, data);
+    return g_timeout_add_seconds (timeout_s, function, data);
   }
+
+  return 0;
 }
 
 void
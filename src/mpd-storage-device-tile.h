@@ -70,6 +70,10 @@ mpd_storage_device_tile_get_icon_file (MpdStorageDeviceTile *self);
 char const *
 mpd_storage_device_tile_get_mime_type (MpdStorageDeviceTile *self);
 
+void
+mpd_storage_device_tile_set_mime_type (MpdStorageDeviceTile *self,
+                                       char const           *mime_type);
+
 char const *
 mpd_storage_device_tile_get_mount_point (MpdStorageDeviceTile *self);
 
@@ -84,7 +88,7 @@ mpd_storage_device_tile_show_message (MpdStorageDeviceTile  *self,
                                       char const            *message,
                                       bool                   replace_buttons);
 
-void
+unsigned int
 mpd_storage_device_tile_show_message_full (MpdStorageDeviceTile  *self,
                                            char const            *message,
                                            bool                   replace_buttons,
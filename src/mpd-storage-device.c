@@ -18,14 +18,19 @@
  * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
-#include <errno.h>
 #include <stdbool.h>
 #include <string.h>
-#include <sys/statvfs.h>
 
 #include <gio/gio.h>
 
+#include "mpd-free-space.h"
 #include "mpd-gobject.h"
+#include "mpd-import-journal.h"
+#include "mpd-media-importer.h"
+#include "mpd-media-index.h"
+#include "mpd-media-monitor.h"
+#include "mpd-media-probe.h"
+#include "mpd-media-scanner.h"
 #include "mpd-storage-device.h"
 #include "config.h"
 
@@ -47,6 +52,14 @@ enum
   PROP_0,
 
   PROP_AVAILABLE_SIZE,
+  PROP_IMPORT_BYTE_RATE,
+  PROP_IMPORT_COPIES,
+  PROP_IMPORT_ETA,
+  PROP_IMPORT_FILE_RATE,
+  PROP_IMPORT_LOW_IMPACT,
+  PROP_IMPORT_SKIPPED_SIZE,
+  PROP_IMPORT_THUMBNAILS,
+  PROP_IMPORT_VERIFY,
   PROP_PATH,
   PROP_SIZE,
 #if 0
@@ -61,6 +74,7 @@ enum
   HAS_MEDIA,
   IMPORT_PROGRESS,
   IMPORT_ERROR,
+  IMPORT_FINISHED,
 
   LAST_SIGNAL
 };
@@ -70,46 +84,135 @@ typedef struct
   int64_t        available_size;
   char          *path;
   int64_t        size;
-  unsigned int   update_timeout_id;
-
-  GSList        *dir_stack;
-  GSList        *media_files;
-  uint64_t       media_files_size;
-
-  /* During import */
-  GFile         *pictures_dir;
-  GFile         *music_dir;
-  GFile         *videos_dir;
-  uint64_t       imported_size;
-  GCancellable  *cancellable;
+  MpdFreeSpace  *space;
+  unsigned int   space_watch_id;
+  bool           has_media_pending;
+
+  char                *volume_key;
+  MpdMediaScanner     *scanner;
+  MpdMediaScanResult  *media;
+  GCancellable        *probe_cancellable;
+  unsigned int         scan_timeout_id;
+  MpdMediaMonitor     *monitor;
+  GHashTable          *changed_dirs;  /* Reported while scanning. */
+  bool                 changes_lost;
+  int                  has_media;   /* Last announced, -1 if none yet. */
+
+  MpdMediaImporter    *importer;
+  unsigned int         import_copies;
+  bool                 import_low_impact;
+  bool                 import_thumbnails;
+  bool                 import_verify;
+  uint64_t             import_skipped_size;
+  bool                 import_pending;    /* Waiting for the scan. */
+  bool                 import_busy;
+  unsigned int         import_progress_id;
+  float                import_progress;
+  MpdImportStats       import_stats;
 } MpdStorageDevicePrivate;
 
+/* Progress and rates are updated at this pace, not per file. */
+#define IMPORT_PROGRESS_INTERVAL_MS 250
+
+/* After a probe, the scan that installs the monitor waits this long, out
+ * of the way of other volumes being probed. */
+#define SCAN_DELAY_S 10
+
 static unsigned int _signals[LAST_SIGNAL] = { 0, };
 
 static void
-update (MpdStorageDevice *self)
+has_media (MpdStorageDevice *self);
+
+static void
+_space_cb (MpdFreeSpace     *space,
+           int64_t           size,
+           int64_t           available_size,
+           MpdStorageDevice *self)
 {
   MpdStorageDevicePrivate *priv = GET_PRIVATE (self);
-  struct statvfs fsd = { 0, };
 
-  if (0 == statvfs (priv->path, &fsd))
+  /* Keep the last known sizes when the query failed. */
+  if (size >= 0)
   {
-    mpd_storage_device_set_size (self, (int64_t)
-                                 fsd.f_blocks * fsd.f_frsize);
-    mpd_storage_device_set_available_size (self, (int64_t)
-                                           fsd.f_bavail * fsd.f_frsize);
-  } else {
-    g_warning ("%s : %s", G_STRLOC, strerror (errno));
+    mpd_storage_device_set_size (self, size);
+    mpd_storage_device_set_available_size (self, available_size);
+  }
+
+  /* Go ahead without the size then, the volume key may lack it. */
+  if (priv->has_media_pending)
+  {
+    priv->has_media_pending = false;
+    has_media (self);
+  }
+}
+
+static void
+update_import_stats (MpdStorageDevice *self)
+{
+  MpdStorageDevicePrivate *priv = GET_PRIVATE (self);
+  MpdImportStats const *stats;
+  MpdImportStats        old;
+  float                 progress;
+
+  stats = mpd_media_importer_sample_stats (priv->importer);
+  old = priv->import_stats;
+  priv->import_stats = *stats;
+
+  g_object_freeze_notify (G_OBJECT (self));
+  if (stats->byte_rate != old.byte_rate)
+    g_object_notify (G_OBJECT (self), "import-byte-rate");
+  if (stats->file_rate != old.file_rate)
+    g_object_notify (G_OBJECT (self), "import-file-rate");
+  if (stats->eta != old.eta)
+    g_object_notify (G_OBJECT (self), "import-eta");
+  g_object_thaw_notify (G_OBJECT (self));
+
+  progress = stats->total_size ?
+               (float) stats->done_size / stats->total_size :
+               1.0;
+  if (progress != priv->import_progress)
+  {
+    priv->import_progress = progress;
+    g_signal_emit_by_name (self, "import-progress", progress);
   }
 }
 
 static bool
-_update_timeout_cb (MpdStorageDevice *self)
+_import_progress_timeout_cb (MpdStorageDevice *self)
 {
-  update (self);
+  update_import_stats (self);
   return true;
 }
 
+/*
+ * While importing, progress is reported from a timer, and free space is
+ * polled faster.
+ */
+static void
+set_import_busy (MpdStorageDevice *self,
+                 bool              busy)
+{
+  MpdStorageDevicePrivate *priv = GET_PRIVATE (self);
+
+  if (busy == priv->import_busy)
+    return;
+
+  priv->import_busy = busy;
+  if (busy)
+  {
+    mpd_free_space_hold_busy ();
+    priv->import_progress = -1;
+    priv->import_progress_id =
+                  g_timeout_add (IMPORT_PROGRESS_INTERVAL_MS,
+                                 (GSourceFunc) _import_progress_timeout_cb,
+                                 self);
+  } else {
+    mpd_free_space_release_busy ();
+    g_source_remove (priv->import_progress_id);
+    priv->import_progress_id = 0;
+  }
+}
+
 static GObject *
 _constructor (GType                  type,
               unsigned int           n_properties,
@@ -122,11 +225,20 @@ _constructor (GType                  type,
 
   if (priv->path)
   {
-    update (self);
-    priv->update_timeout_id =
-                  g_timeout_add_seconds (60,
-                                         (GSourceFunc) _update_timeout_cb,
-                                         self);
+    int64_t size;
+    int64_t available_size;
+
+    /* Shared with other users of the path, it may have a value already. */
+    priv->space = mpd_free_space_open (priv->path);
+    priv->space_watch_id = mpd_free_space_add_watch (priv->space,
+                                                     (MpdFreeSpaceCallback)
+                                                       _space_cb,
+                                                     self);
+    if (mpd_free_space_get (priv->space, &size, &available_size))
+    {
+      mpd_storage_device_set_size (self, size);
+      mpd_storage_device_set_available_size (self, available_size);
+    }
   } else {
     g_critical ("%s : No mount path set", G_STRLOC);
   }
@@ -148,6 +260,46 @@ _get_property (GObject      *object,
                        mpd_storage_device_get_available_size (
                         MPD_STORAGE_DEVICE (object)));
     break;
+  case PROP_IMPORT_BYTE_RATE:
+    g_value_set_double (value,
+                        mpd_storage_device_get_import_byte_rate (
+                          MPD_STORAGE_DEVICE (object)));
+    break;
+  case PROP_IMPORT_COPIES:
+    g_value_set_uint (value,
+                      mpd_storage_device_get_import_copies (
+                        MPD_STORAGE_DEVICE (object)));
+    break;
+  case PROP_IMPORT_ETA:
+    g_value_set_int (value,
+                     mpd_storage_device_get_import_eta (
+                       MPD_STORAGE_DEVICE (object)));
+    break;
+  case PROP_IMPORT_FILE_RATE:
+    g_value_set_double (value,
+                        mpd_storage_device_get_import_file_rate (
+                          MPD_STORAGE_DEVICE (object)));
+    break;
+  case PROP_IMPORT_LOW_IMPACT:
+    g_value_set_boolean (value,
+                         mpd_storage_device_get_import_low_impact (
+                           MPD_STORAGE_DEVICE (object)));
+    break;
+  case PROP_IMPORT_SKIPPED_SIZE:
+    g_value_set_uint64 (value,
+                        mpd_storage_device_get_import_skipped_size (
+                          MPD_STORAGE_DEVICE (object)));
+    break;
+  case PROP_IMPORT_THUMBNAILS:
+    g_value_set_boolean (value,
+                         mpd_storage_device_get_import_thumbnails (
+                           MPD_STORAGE_DEVICE (object)));
+    break;
+  case PROP_IMPORT_VERIFY:
+    g_value_set_boolean (value,
+                         mpd_storage_device_get_import_verify (
+                           MPD_STORAGE_DEVICE (object)));
+    break;
   case PROP_PATH:
     g_value_set_string (value, priv->path);
     break;
@@ -191,6 +343,22 @@ _set_property (GObject      *object,
     mpd_storage_device_set_available_size (MPD_STORAGE_DEVICE (object),
                                            g_value_get_int64 (value));
     break;
+  case PROP_IMPORT_COPIES:
+    mpd_storage_device_set_import_copies (MPD_STORAGE_DEVICE (object),
+                                          g_value_get_uint (value));
+    break;
+  case PROP_IMPORT_LOW_IMPACT:
+    mpd_storage_device_set_import_low_impact (MPD_STORAGE_DEVICE (object),
+                                              g_value_get_boolean (value));
+    break;
+  case PROP_IMPORT_THUMBNAILS:
+    mpd_storage_device_set_import_thumbnails (MPD_STORAGE_DEVICE (object),
+                                              g_value_get_boolean (value));
+    break;
+  case PROP_IMPORT_VERIFY:
+    mpd_storage_device_set_import_verify (MPD_STORAGE_DEVICE (object),
+                                          g_value_get_boolean (value));
+    break;
   case PROP_PATH:
     /* Construct-only */
     priv->path = g_value_dup_string (value);
@@ -215,41 +383,62 @@ _dispose (GObject *object)
     priv->path = NULL;
   }
 
-  if (priv->update_timeout_id)
+  if (priv->space)
   {
-    g_source_remove (priv->update_timeout_id);
-    priv->update_timeout_id = 0;
+    mpd_free_space_remove_watch (priv->space, priv->space_watch_id);
+    mpd_free_space_unref (priv->space);
+    priv->space = NULL;
   }
 
-  if (priv->media_files)
+  set_import_busy (MPD_STORAGE_DEVICE (object), false);
+
+  if (priv->volume_key)
   {
-    g_slist_foreach (priv->media_files, (GFunc) g_free, NULL);
-    g_slist_free (priv->media_files);
-    priv->media_files = NULL;
+    g_free (priv->volume_key);
+    priv->volume_key = NULL;
   }
 
-  if (priv->pictures_dir)
+  if (priv->probe_cancellable)
   {
-    g_object_unref (priv->pictures_dir);
-    priv->pictures_dir = NULL;
+    g_cancellable_cancel (priv->probe_cancellable);
+    g_object_unref (priv->probe_cancellable);
+    priv->probe_cancellable = NULL;
   }
 
-  if (priv->music_dir)
+  if (priv->scan_timeout_id)
   {
-    g_object_unref (priv->music_dir);
-    priv->music_dir = NULL;
+    g_source_remove (priv->scan_timeout_id);
+    priv->scan_timeout_id = 0;
   }
 
-  if (priv->videos_dir)
+  if (priv->monitor)
   {
-    g_object_unref (priv->videos_dir);
-    priv->videos_dir = NULL;
+    mpd_media_monitor_free (priv->monitor);
+    priv->monitor = NULL;
   }
 
-  if (priv->cancellable)
+  if (priv->changed_dirs)
   {
-    g_object_unref (priv->cancellable);
-    priv->cancellable = NULL;
+    g_hash_table_destroy (priv->changed_dirs);
+    priv->changed_dirs = NULL;
+  }
+
+  if (priv->scanner)
+  {
+    mpd_media_scanner_free (priv->scanner);
+    priv->scanner = NULL;
+  }
+
+  if (priv->media)
+  {
+    mpd_media_scan_result_free (priv->media);
+    priv->media = NULL;
+  }
+
+  if (priv->importer)
+  {
+    mpd_media_importer_free (priv->importer);
+    priv->importer = NULL;
   }
 
   G_OBJECT_CLASS (mpd_storage_device_parent_class)->dispose (object);
@@ -280,6 +469,86 @@ mpd_storage_device_class_init (MpdStorageDeviceClass *klass)
                                                        -1, G_MAXINT64, -1,
                                                        param_flags |
                                                        G_PARAM_CONSTRUCT));
+  g_object_class_install_property (object_class,
+                                   PROP_IMPORT_BYTE_RATE,
+                                   g_param_spec_double ("import-byte-rate",
+                                                        "Import byte rate",
+                                                        "Bytes per second "
+                                                        "imported, moving "
+                                                        "average",
+                                                        0, G_MAXDOUBLE, 0,
+                                                        G_PARAM_READABLE |
+                                                        G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (object_class,
+                                   PROP_IMPORT_COPIES,
+                                   g_param_spec_uint ("import-copies",
+                                                      "Import copies",
+                                                      "Files copied concurrently "
+                                                      "during import",
+                                                      1, 16, 3,
+                                                      param_flags |
+                                                      G_PARAM_CONSTRUCT));
+  g_object_class_install_property (object_class,
+                                   PROP_IMPORT_ETA,
+                                   g_param_spec_int ("import-eta",
+                                                     "Import ETA",
+                                                     "Estimated seconds until "
+                                                     "the import is done, -1 "
+                                                     "if unknown",
+                                                     -1, G_MAXINT, -1,
+                                                     G_PARAM_READABLE |
+                                                     G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (object_class,
+                                   PROP_IMPORT_FILE_RATE,
+                                   g_param_spec_double ("import-file-rate",
+                                                        "Import file rate",
+                                                        "Files per second "
+                                                        "imported, moving "
+                                                        "average",
+                                                        0, G_MAXDOUBLE, 0,
+                                                        G_PARAM_READABLE |
+                                                        G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (object_class,
+                                   PROP_IMPORT_LOW_IMPACT,
+                                   g_param_spec_boolean ("import-low-impact",
+                                                         "Import low impact",
+                                                         "Import at low I/O "
+                                                         "priority, without "
+                                                         "filling the page "
+                                                         "cache",
+                                                         true,
+                                                         param_flags |
+                                                         G_PARAM_CONSTRUCT));
+  g_object_class_install_property (object_class,
+                                   PROP_IMPORT_SKIPPED_SIZE,
+                                   g_param_spec_uint64 ("import-skipped-size",
+                                                        "Import skipped size",
+                                                        "Bytes not copied by "
+                                                        "the last import "
+                                                        "because they were "
+                                                        "imported before",
+                                                        0, G_MAXUINT64, 0,
+                                                        G_PARAM_READABLE |
+                                                        G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (object_class,
+                                   PROP_IMPORT_THUMBNAILS,
+                                   g_param_spec_boolean ("import-thumbnails",
+                                                         "Import thumbnails",
+                                                         "Create thumbnails "
+                                                         "of imported images",
+                                                         true,
+                                                         param_flags |
+                                                         G_PARAM_CONSTRUCT));
+  g_object_class_install_property (object_class,
+                                   PROP_IMPORT_VERIFY,
+                                   g_param_spec_boolean ("import-verify",
+                                                         "Import verify",
+                                                         "Read imported files "
+                                                         "back and compare "
+                                                         "them with the source",
+                                                         true,
+                                                         param_flags |
+                                                         G_PARAM_CONSTRUCT));
   g_object_class_install_property (object_class,
                                    PROP_PATH,
                                    g_param_spec_string ("path",
@@ -342,11 +611,22 @@ mpd_storage_device_class_init (MpdStorageDeviceClass *klass)
                                          0, NULL, NULL,
                                          g_cclosure_marshal_VOID__POINTER,
                                          G_TYPE_NONE, 1, G_TYPE_POINTER);
+
+  _signals[IMPORT_FINISHED] = g_signal_new ("import-finished",
+                                            G_TYPE_FROM_CLASS (klass),
+                                            G_SIGNAL_RUN_LAST,
+                                            0, NULL, NULL,
+                                            g_cclosure_marshal_VOID__VOID,
+                                            G_TYPE_NONE, 0);
 }
 
 static void
 mpd_storage_device_init (MpdStorageDevice *self)
 {
+  MpdStorageDevicePrivate *priv = GET_PRIVATE (self);
+
+  priv->has_media = -1;
+  priv->import_stats.eta = -1;
 }
 
 MpdStorageDevice *
@@ -407,6 +687,171 @@ mpd_storage_device_set_available_size (MpdStorageDevice *self,
   }
 }
 
+unsigned int
+mpd_storage_device_get_import_copies (MpdStorageDevice *self)
+{
+  MpdStorageDevicePrivate *priv = GET_PRIVATE (self);
+
+  g_return_val_if_fail (MPD_IS_STORAGE_DEVICE (self), 0);
+
+  return priv->import_copies;
+}
+
+void
+mpd_storage_device_set_import_copies (MpdStorageDevice *self,
+                                      unsigned int      import_copies)
+{
+  MpdStorageDevicePrivate *priv = GET_PRIVATE (self);
+
+  g_return_if_fail (MPD_IS_STORAGE_DEVICE (self));
+
+  if (import_copies != priv->import_copies)
+  {
+    priv->import_copies = import_copies;
+    if (priv->importer)
+      mpd_media_importer_set_max_copies (priv->importer, import_copies);
+    g_object_notify (G_OBJECT (self), "import-copies");
+  }
+}
+
+bool
+mpd_storage_device_get_import_low_impact (MpdStorageDevice *self)
+{
+  MpdStorageDevicePrivate *priv = GET_PRIVATE (self);
+
+  g_return_val_if_fail (MPD_IS_STORAGE_DEVICE (self), false);
+
+  return priv->import_low_impact;
+}
+
+void
+mpd_storage_device_set_import_low_impact (MpdStorageDevice *self,
+                                          bool              low_impact)
+{
+  MpdStorageDevicePrivate *priv = GET_PRIVATE (self);
+
+  g_return_if_fail (MPD_IS_STORAGE_DEVICE (self));
+
+  if (low_impact != priv->import_low_impact)
+  {
+    priv->import_low_impact = low_impact;
+    if (priv->importer)
+      mpd_media_importer_set_low_impact (priv->importer, low_impact);
+    g_object_notify (G_OBJECT (self), "import-low-impact");
+  }
+}
+
+bool
+mpd_storage_device_get_import_thumbnails (MpdStorageDevice *self)
+{
+  MpdStorageDevicePrivate *priv = GET_PRIVATE (self);
+
+  g_return_val_if_fail (MPD_IS_STORAGE_DEVICE (self), false);
+
+  return priv->import_thumbnails;
+}
+
+void
+mpd_storage_device_set_import_thumbnails (MpdStorageDevice *self,
+                                          bool              thumbnails)
+{
+  MpdStorageDevicePrivate *priv = GET_PRIVATE (self);
+
+  g_return_if_fail (MPD_IS_STORAGE_DEVICE (self));
+
+  if (thumbnails != priv->import_thumbnails)
+  {
+    priv->import_thumbnails = thumbnails;
+    if (priv->importer)
+      mpd_media_importer_set_thumbnails (priv->importer, thumbnails);
+    g_object_notify (G_OBJECT (self), "import-thumbnails");
+  }
+}
+
+bool
+mpd_storage_device_get_import_verify (MpdStorageDevice *self)
+{
+  MpdStorageDevicePrivate *priv = GET_PRIVATE (self);
+
+  g_return_val_if_fail (MPD_IS_STORAGE_DEVICE (self), false);
+
+  return priv->import_verify;
+}
+
+void
+mpd_storage_device_set_import_verify (MpdStorageDevice *self,
+                                      bool              verify)
+{
+  MpdStorageDevicePrivate *priv = GET_PRIVATE (self);
+
+  g_return_if_fail (MPD_IS_STORAGE_DEVICE (self));
+
+  if (verify != priv->import_verify)
+  {
+    priv->import_verify = verify;
+    if (priv->importer)
+      mpd_media_importer_set_verify (priv->importer, verify);
+    g_object_notify (G_OBJECT (self), "import-verify");
+  }
+}
+
+uint64_t
+mpd_storage_device_get_import_skipped_size (MpdStorageDevice *self)
+{
+  MpdStorageDevicePrivate *priv = GET_PRIVATE (self);
+
+  g_return_val_if_fail (MPD_IS_STORAGE_DEVICE (self), 0);
+
+  return priv->import_skipped_size;
+}
+
+double
+mpd_storage_device_get_import_byte_rate (MpdStorageDevice *self)
+{
+  MpdStorageDevicePrivate *priv = GET_PRIVATE (self);
+
+  g_return_val_if_fail (MPD_IS_STORAGE_DEVICE (self), 0);
+
+  return priv->import_stats.byte_rate;
+}
+
+double
+mpd_storage_device_get_import_file_rate (MpdStorageDevice *self)
+{
+  MpdStorageDevicePrivate *priv = GET_PRIVATE (self);
+
+  g_return_val_if_fail (MPD_IS_STORAGE_DEVICE (self), 0);
+
+  return priv->import_stats.file_rate;
+}
+
+int
+mpd_storage_device_get_import_eta (MpdStorageDevice *self)
+{
+  MpdStorageDevicePrivate *priv = GET_PRIVATE (self);
+
+  g_return_val_if_fail (MPD_IS_STORAGE_DEVICE (self), -1);
+
+  return priv->import_stats.eta;
+}
+
+/*
+ * Copy latencies of the current or last import, see MpdImportStats for
+ * the bucket layout.
+ */
+unsigned int const *
+mpd_storage_device_get_import_latency_histogram (MpdStorageDevice *self,
+                                                 unsigned int     *n_buckets)
+{
+  MpdStorageDevicePrivate *priv = GET_PRIVATE (self);
+
+  g_return_val_if_fail (MPD_IS_STORAGE_DEVICE (self), NULL);
+
+  if (n_buckets)
+    *n_buckets = G_N_ELEMENTS (priv->import_stats.latency);
+  return priv->import_stats.latency;
+}
+
 char const *
 mpd_storage_device_get_path (MpdStorageDevice *self)
 {
@@ -417,8 +862,6 @@ mpd_storage_device_get_path (MpdStorageDevice *self)
   return priv->path;
 }
 
-#if 0 /* Volume crawling code etc. */
-
 #define MPD_STORAGE_DEVICE_ERROR mpd_storage_device_error_quark()
 
 static GQuark
@@ -430,6 +873,8 @@ mpd_storage_device_error_quark (void)
   return _quark;
 }
 
+#if 0 /* Needs udisks. */
+
 char const *
 mpd_storage_device_get_label (MpdStorageDevice *self)
 {
@@ -470,415 +915,378 @@ mpd_storage_device_get_vendor (MpdStorageDevice *self)
 #endif
 }
 
-static void
-push_dir_async (MpdStorageDevice  *self,
-                GFile             *dir);
-
-static GFile *
-file_new_for_path (char const *path)
-{
-  g_debug ("%s() %s", __FUNCTION__, path);
-  return g_file_new_for_path (path);
-}
-
-static void
-file_destroy (GFile *file)
-{
-  char *path;
-
-  path = g_file_get_path (file);
-  g_debug ("%s() %s (%d)", __FUNCTION__, path,  G_OBJECT (file)->ref_count);
-  g_free (path);
-
-  g_object_unref (file);
-}
+#endif
 
-static void
-enumerate_dir (MpdStorageDevice  *self)
+/*
+ * Identify the volume for the media index, prefer the file system UUID.
+ * Labels like "NO NAME" are common, so the volume size is mixed in.
+ */
+static char *
+get_volume_key (MpdStorageDevice *self)
 {
   MpdStorageDevicePrivate *priv = GET_PRIVATE (self);
-  GFileEnumerator *enumerator;
-  GFileInfo       *info;
-  GError          *error = NULL;
+  GFile   *file;
+  GMount  *mount;
+  GVolume *volume;
+  char    *key = NULL;
 
-  g_return_if_fail (priv->dir_stack);
-  enumerator = G_FILE_ENUMERATOR (priv->dir_stack->data);
-  g_return_if_fail (G_IS_FILE_ENUMERATOR (enumerator));
+  file = g_file_new_for_path (priv->path);
+  mount = g_file_find_enclosing_mount (file, NULL, NULL);
+  g_object_unref (file);
+  if (NULL == mount)
+    return NULL;
 
-  while (NULL !=
-         (info = g_file_enumerator_next_file (enumerator, NULL, &error)))
+  key = g_mount_get_uuid (mount);
+  volume = g_mount_get_volume (mount);
+  if (volume)
   {
-    char const *content_type = g_file_info_get_content_type (info);
-    char const *name = g_file_info_get_name (info);
-
-    /* Debug */
-    char *indent = g_strnfill (g_slist_length (priv->dir_stack), ' ');
-    g_debug ("%s%s %s", indent, name, content_type);
-    g_free (indent);
+    if (NULL == key)
+      key = g_volume_get_identifier (volume, G_VOLUME_IDENTIFIER_KIND_UUID);
 
-    /* Do not recurse into "dot" directories, they are use for trash. */
-    if (0 == g_strcmp0 ("inode/directory", content_type) &&
-        name[0] != '.')
+    if (NULL == key)
     {
-      char const *path = g_object_get_data (G_OBJECT (enumerator), "path");
-      char *subpath = g_build_filename (path, name, NULL);
-      GFile *subdir = file_new_for_path (subpath);
-
-      /* Push and recurse. */
-      push_dir_async (self, subdir);
-
-      file_destroy (subdir);
-      g_free (subpath);
-      break;
-
-    } else if (g_str_has_prefix (content_type, "audio/") ||
-               g_str_has_prefix (content_type, "image/") ||
-               g_str_has_prefix (content_type, "video/")) {
-
-      /* Media found. */
-      char const *path = g_object_get_data (G_OBJECT (enumerator), "path");
-      char *filename = g_build_filename (path, name, NULL);
-      priv->media_files = g_slist_prepend (priv->media_files, filename);
-      priv->media_files_size += g_file_info_get_size (info);
+      char *label = g_volume_get_identifier (volume,
+                                             G_VOLUME_IDENTIFIER_KIND_LABEL);
+      if (label)
+        key = g_strdup_printf ("%s:%" G_GINT64_FORMAT, label, priv->size);
+      g_free (label);
     }
 
-    g_object_unref (info);
+    g_object_unref (volume);
   }
 
-  if (info)
-  {
-    /* Broke out of loop, not done yet. */
-    g_object_unref (info);
-
-  } else {
+  g_object_unref (mount);
+  return key;
+}
 
-    /* Directory finished, pop. */
-    g_object_unref (enumerator);
-    priv->dir_stack = g_slist_delete_link (priv->dir_stack, priv->dir_stack);
-    if (priv->dir_stack)
-    {
-      enumerate_dir (self);
-    } else {
-      /* Done iterating. */
-      g_signal_emit_by_name (self, "has-media", (bool) priv->media_files);
-    }
-  }
+static bool
+start_import (MpdStorageDevice  *self,
+              GError           **error);
 
-  if (error)
-  {
-    g_critical ("%s : %s", G_STRLOC, error->message);
-    g_clear_error (&error);
-  }
-}
+static void
+_scanner_cb (MpdMediaScanner    *scanner,
+             MpdMediaScanResult *result,
+             MpdStorageDevice   *self);
 
+/*
+ * Rescan what changed since the last scan, only the affected directories
+ * unless changes were lost.
+ */
 static void
-_push_dir_cb (GFile             *file,
-              GAsyncResult      *res,
-              MpdStorageDevice  *self)
+apply_changes (MpdStorageDevice *self)
 {
   MpdStorageDevicePrivate *priv = GET_PRIVATE (self);
-  GFileEnumerator *enumerator;
-  GError          *error = NULL;
+  GPtrArray       *dirs;
+  GHashTableIter   iter;
+  char            *path;
 
-  g_return_if_fail (G_IS_FILE (file));
+  if (priv->changes_lost)
+  {
+    priv->changes_lost = false;
+    g_hash_table_remove_all (priv->changed_dirs);
+    mpd_media_scanner_start (priv->scanner,
+                             (MpdMediaScannerCallback) _scanner_cb,
+                             self);
+    return;
+  }
 
-  /* Debug */
-  char *indent = g_strnfill (g_slist_length (priv->dir_stack), ' ');
-  char *path = g_file_get_path (file);
-  g_debug ("%s%s", indent, path);
-  g_free (path);
-  g_free (indent);
+  if (NULL == priv->media ||
+      0 == g_hash_table_size (priv->changed_dirs))
+    return;
 
-  enumerator = g_file_enumerate_children_finish (file, res, &error);
-  if (error)
+  dirs = g_ptr_array_new_with_free_func (g_free);
+  g_hash_table_iter_init (&iter, priv->changed_dirs);
+  while (g_hash_table_iter_next (&iter, (void **) &path, NULL))
   {
-    g_critical ("%s : %s", G_STRLOC, error->message);
-    g_clear_error (&error);
-    return;
+    g_ptr_array_add (dirs, path);
+    g_hash_table_iter_steal (&iter);
   }
 
-  /* g_file_enumerator_get_container () fails on us. */
-  g_object_set_data_full (G_OBJECT (enumerator), "path",
-                          g_file_get_path (file), g_free);
-  priv->dir_stack = g_slist_prepend (priv->dir_stack,
-                                     g_object_ref (enumerator));
-  enumerate_dir (self);
-  g_object_unref (enumerator);
+  mpd_media_scanner_update (priv->scanner, priv->media, dirs,
+                            (MpdMediaScannerCallback) _scanner_cb,
+                            self);
+  g_ptr_array_free (dirs, true);
 }
 
 static void
-push_dir_async (MpdStorageDevice  *self,
-                GFile             *dir)
+_monitor_cb (MpdMediaMonitor  *monitor,
+             GPtrArray const  *dirty,
+             MpdStorageDevice *self)
 {
-  char *path;
-  bool  is_dir;
-
-  path = g_file_get_path (dir);
-  is_dir = g_file_test (path, G_FILE_TEST_IS_DIR);
-  g_free (path);
-  g_return_if_fail (is_dir);
-
-  g_file_enumerate_children_async (dir, "standard", G_FILE_QUERY_INFO_NONE,
-                                   G_PRIORITY_DEFAULT, NULL,
-                                   (GAsyncReadyCallback) _push_dir_cb,
-                                   self);
+  MpdStorageDevicePrivate *priv = GET_PRIVATE (self);
+  unsigned int i;
+
+  if (NULL == dirty)
+    priv->changes_lost = true;
+  else
+    for (i = 0; i < dirty->len; i++)
+      g_hash_table_insert (priv->changed_dirs,
+                           g_strdup (g_ptr_array_index (dirty, i)),
+                           GINT_TO_POINTER (true));
+
+  /* A scan running now may have missed them, apply once it's done. */
+  if (!mpd_media_scanner_is_running (priv->scanner))
+    apply_changes (self);
 }
 
-void
-mpd_storage_device_has_media_async (MpdStorageDevice *self)
+/* Only changes are announced. */
+static void
+announce_has_media (MpdStorageDevice *self,
+                    bool              has_media)
 {
   MpdStorageDevicePrivate *priv = GET_PRIVATE (self);
-  GFile *dir;
 
-  g_return_if_fail (MPD_IS_STORAGE_DEVICE (self));
+  if ((int) has_media == priv->has_media)
+    return;
 
-  dir = file_new_for_path (priv->path);
-  push_dir_async (self, dir);
-  file_destroy (dir);
+  priv->has_media = has_media;
+  g_signal_emit_by_name (self, "has-media", has_media);
 }
 
-static GFile *
-ensure_unique_child (GFile      *dir,
-                     char const *template,
-                     bool        test_suffix)
+static void
+_scanner_cb (MpdMediaScanner    *scanner,
+             MpdMediaScanResult *result,
+             MpdStorageDevice   *self)
 {
-  GFile       *child;
-  char        *basename = NULL;
-  char const  *suffix = NULL;
-  unsigned int i = 0;
-
-  g_return_val_if_fail (dir, NULL);
-  g_return_val_if_fail (template, NULL);
+  MpdStorageDevicePrivate *priv = GET_PRIVATE (self);
 
-  if (test_suffix)
-  {
-    suffix = strrchr (template, '.');
-    if (NULL == suffix ||
-        0 == g_strcmp0 (template, suffix))
-    {
-      /* No suffix found. */
-      test_suffix = false;
-    } else {
-      basename = g_strndup (template, strlen (template) - strlen (suffix));
-    }
-  }
+  g_debug ("%s() %s: %u audio, %u image, %u video",
+           __FUNCTION__, priv->path,
+           result->counts[MPD_MEDIA_CATEGORY_AUDIO],
+           result->counts[MPD_MEDIA_CATEGORY_IMAGE],
+           result->counts[MPD_MEDIA_CATEGORY_VIDEO]);
 
-  child = g_file_get_child (dir, template);
-  while (g_file_query_exists (child, NULL))
+  if (priv->volume_key &&
+      result->n_dirs_reused < result->dirs->len)
   {
-    char *filename = g_strdup_printf ("%s (%d)%s", basename, ++i, suffix);
-    g_object_unref (child);
-    child = g_file_get_child (dir, filename);
-    g_free (filename);
+    mpd_media_index_save_async (priv->volume_key, priv->path, result);
   }
 
-  g_free (basename);
-
-  return child;
-}
-
-static GFile *
-ensure_import_subdir (char const   *path,
-                      GError      **error)
-{
-  GTimeVal   tv = { 0, };
-  GDate      date = { 0, };
-  char       template[PATH_MAX] = { 0, } /* whatever */;
-  GFile     *basedir;
-  GFile     *subdir;
+  if (priv->media)
+    mpd_media_scan_result_free (priv->media);
+  priv->media = result;
 
-  g_return_val_if_fail (g_file_test (path, G_FILE_TEST_IS_DIR), NULL);
+  announce_has_media (self, result->files->len);
 
-  g_get_current_time (&tv);
-  g_date_set_time_val (&date, &tv);
-
-  basedir = g_file_new_for_path (path);
-  g_date_strftime (template, sizeof (template), "%x", &date);
-  /* We like locale specific dir names but '/' don't work very well.
-   * so fall back to ISO date format. */
-  if (strchr (template, '/'))
+  /* Keep up to date while mounted. */
+  if (NULL == priv->monitor)
   {
-    memset (template, 0, sizeof (template));
-    g_date_strftime (template, sizeof (template), "%Y-%m-%d", &date);
+    priv->monitor = mpd_media_monitor_new ((MpdMediaMonitorCallback)
+                                             _monitor_cb,
+                                           self);
+    priv->changed_dirs = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                g_free, NULL);
   }
+  mpd_media_monitor_watch (priv->monitor, result);
 
-  subdir = ensure_unique_child (basedir, template, false);
-  if (!g_file_make_directory (subdir, NULL, error))
+  if (priv->import_pending)
   {
-    g_object_unref (subdir);
-    subdir = NULL;
+    GError *error = NULL;
+
+    priv->import_pending = false;
+    if (!start_import (self, &error))
+    {
+      g_signal_emit_by_name (self, "import-error", error);
+      g_clear_error (&error);
+    }
   }
 
-  g_object_unref (basedir);
-  return subdir;
+  apply_changes (self);
 }
 
 static void
-import_file_async (MpdStorageDevice *self);
-
-static void
-_file_copy_cb (GFile            *source_file,
-               GAsyncResult     *res,
-               MpdStorageDevice *self)
+ensure_scanner (MpdStorageDevice *self)
 {
   MpdStorageDevicePrivate *priv = GET_PRIVATE (self);
-  GFileInfo *info;
-  GError    *error = NULL;
-  float      progress;
 
-  g_file_copy_finish (source_file, res, &error);
-  if (error)
+  if (NULL == priv->scanner)
   {
-    g_warning ("%s : %s", G_STRLOC, error->message);
-    g_signal_emit_by_name (self, "import-error", error);
-    g_clear_error (&error);
-    return;
+    priv->scanner = mpd_media_scanner_new (priv->path);
+    priv->volume_key = get_volume_key (self);
   }
+}
 
-  info = g_file_query_info (source_file, "standard", G_FILE_QUERY_INFO_NONE,
-                            NULL, &error);
-  if (error)
-  {
-    g_warning ("%s : %s", G_STRLOC, error->message);
-    g_signal_emit_by_name (self, "import-error", error);
-    g_clear_error (&error);
-    return;
-  }
+static bool
+_scan_timeout_cb (MpdStorageDevice *self)
+{
+  MpdStorageDevicePrivate *priv = GET_PRIVATE (self);
 
-  priv->imported_size += g_file_info_get_size (info);
-  progress = (float) priv->imported_size / priv->media_files_size;
-  g_signal_emit_by_name (self, "import-progress", progress);
-  g_object_unref (info);
+  priv->scan_timeout_id = 0;
 
-  g_debug ("%s() %f", __FUNCTION__, progress);
+  /* Unless something else scanned meanwhile. */
+  if (NULL == priv->monitor &&
+      !mpd_media_scanner_is_running (priv->scanner))
+    mpd_media_scanner_start (priv->scanner,
+                             (MpdMediaScannerCallback) _scanner_cb,
+                             self);
 
-  /* Next file. */
-  if (priv->media_files)
-    import_file_async (self);
+  return false;
 }
 
 static void
-import_file_async (MpdStorageDevice *self)
+_probe_cb (GObject          *source,
+           GAsyncResult     *res,
+           MpdStorageDevice *self)
 {
   MpdStorageDevicePrivate *priv = GET_PRIVATE (self);
-  char        *source_path = NULL;
-  GFile       *source_file = NULL;
-  GFileInfo   *source_info = NULL;
-  char const  *content_type;
-  GFile       *target_dir = NULL;
-  char        *target_name = NULL;
-  GFile       *target_file = NULL;
-  GError      *error = NULL;
-
-  g_return_if_fail (priv->media_files);
-
-  source_path = (char *) priv->media_files->data;
-  priv->media_files = g_slist_delete_link (priv->media_files, priv->media_files);
+  MpdMediaProbeResult      result;
+  GError                  *error = NULL;
 
-  source_file = g_file_new_for_path (source_path);
-  source_info = g_file_query_info (source_file, "standard",
-                                   G_FILE_QUERY_INFO_NONE, NULL, &error);
-  if (error)
+  result = mpd_media_probe_finish (res, &error);
+  if (priv->probe_cancellable)
   {
-    g_signal_emit_by_name (self, "import-error", error);
-    g_clear_error (&error);
-    goto bail;
+    g_object_unref (priv->probe_cancellable);
+    priv->probe_cancellable = NULL;
   }
 
-  content_type = g_file_info_get_content_type (source_info);
-  if (g_str_has_prefix (content_type, "audio/"))
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
   {
-    if (NULL == priv->music_dir)
+    g_clear_error (&error);
+  } else {
+    if (error)
     {
-      priv->music_dir =
-        ensure_import_subdir (g_get_user_special_dir(G_USER_DIRECTORY_MUSIC),
-                              &error);
-      if (error)
-      {
-        g_signal_emit_by_name (self, "import-error", error);
-        g_clear_error (&error);
-        goto bail;
-      }
+      g_warning ("%s : %s", G_STRLOC, error->message);
+      g_clear_error (&error);
     }
-    target_dir = priv->music_dir;
 
-  } else if (g_str_has_prefix (content_type, "image/")) {
+    g_debug ("%s() %s: %d", __FUNCTION__, priv->path, result);
+
+    if (MPD_MEDIA_PROBE_FOUND == result)
+      announce_has_media (self, true);
+    else if (MPD_MEDIA_PROBE_NONE == result)
+      announce_has_media (self, false);
 
-    if (NULL == priv->pictures_dir)
+    if (MPD_MEDIA_PROBE_INCONCLUSIVE == result)
     {
-      priv->pictures_dir =
-        ensure_import_subdir (g_get_user_special_dir (G_USER_DIRECTORY_PICTURES),
-                              &error);
-      if (error)
-      {
-        g_signal_emit_by_name (self, "import-error", error);
-        g_clear_error (&error);
-        goto bail;
-      }
+      /* Only the full scan can tell. */
+      if (priv->scanner &&
+          !mpd_media_scanner_is_running (priv->scanner))
+        mpd_media_scanner_start (priv->scanner,
+                                 (MpdMediaScannerCallback) _scanner_cb,
+                                 self);
+    } else if (priv->scanner &&
+               0 == priv->scan_timeout_id) {
+      /* Changes are only noticed once the monitor watches a scan's
+       * directories, like photos arriving from a tethered camera. */
+      priv->scan_timeout_id =
+                  g_timeout_add_seconds (SCAN_DELAY_S,
+                                         (GSourceFunc) _scan_timeout_cb,
+                                         self);
     }
-    target_dir = priv->pictures_dir;
+  }
 
-  } else if (g_str_has_prefix (content_type, "video/")) {
+  g_object_unref (self);
+}
 
-    if (NULL == priv->pictures_dir)
-    {
-      priv->videos_dir =
-        ensure_import_subdir (g_get_user_special_dir (G_USER_DIRECTORY_VIDEOS),
-                              &error);
-      if (error)
-      {
-        g_signal_emit_by_name (self, "import-error", error);
-        g_clear_error (&error);
-        goto bail;
-      }
-    }
-    target_dir = priv->videos_dir;
+static void
+has_media (MpdStorageDevice *self)
+{
+  MpdStorageDevicePrivate *priv = GET_PRIVATE (self);
+  MpdMediaIndex *index = NULL;
 
-  } else {
+  ensure_scanner (self);
+
+  if (priv->volume_key)
+    index = mpd_media_index_open (priv->volume_key);
 
-    g_warning ("%s : Unhandled content type %s", G_STRLOC, content_type);
-    goto bail;
+  if (index)
+  {
+    /* Answer from the index right away, the scan then only revisits
+     * directories that changed since. */
+    mpd_media_scanner_set_index (priv->scanner, index);
+    if (NULL == priv->media)
+    {
+      priv->media = mpd_media_index_to_result (index, priv->path);
+      announce_has_media (self, priv->media->files->len);
+    }
+    mpd_media_index_unref (index);
   }
 
-  target_name = g_path_get_basename (source_path);
-  target_file = ensure_unique_child (target_dir, target_name, true);
-  g_file_copy_async (source_file, target_file, G_FILE_COPY_NONE,
-                     G_PRIORITY_DEFAULT, priv->cancellable,
-                     NULL, NULL,
-                     (GAsyncReadyCallback) _file_copy_cb, self);
+  if (index ||
+      priv->media)
+  {
+    mpd_media_scanner_start (priv->scanner,
+                             (MpdMediaScannerCallback) _scanner_cb,
+                             self);
+    return;
+  }
 
-bail:
-  if (target_file) g_object_unref (target_file);
-  if (target_name) g_free (target_name);
-  if (source_info) g_object_unref (source_info);
-  if (source_file) g_object_unref (source_file);
-  if (source_path) g_free (source_path);
+  /* First look at the volume, probe and leave enumerating it all to the
+   * import. */
+  if (NULL == priv->probe_cancellable)
+  {
+    priv->probe_cancellable = g_cancellable_new ();
+    mpd_media_probe_async (priv->path,
+                           priv->probe_cancellable,
+                           (GAsyncReadyCallback) _probe_cb,
+                           g_object_ref (self));
+  }
 }
 
-bool
-mpd_storage_device_import_async (MpdStorageDevice  *self,
-                                 GError           **error)
+void
+mpd_storage_device_has_media_async (MpdStorageDevice *self)
 {
   MpdStorageDevicePrivate *priv = GET_PRIVATE (self);
-  MpdStorageDevice *target;
-  uint64_t          target_available;
 
-  g_return_val_if_fail (MPD_IS_STORAGE_DEVICE (self), false);
+  g_return_if_fail (MPD_IS_STORAGE_DEVICE (self));
 
-  if (priv->dir_stack)
+  /* The volume key may need the size, wait for the first answer. */
+  if (NULL == priv->scanner &&
+      priv->space &&
+      !mpd_free_space_get (priv->space, NULL, NULL))
   {
-    g_warning ("%s : %s: Device indexing in progress",
-                G_STRLOC,
-                priv->path);
-    if (error)
-      *error = g_error_new (MPD_STORAGE_DEVICE_ERROR,
-                            MPD_STORAGE_DEVICE_IMPORT_ERROR_STILL_INDEXING,
-                            "%s : %s: Device indexing in progress",
-                            G_STRLOC, priv->path);
-    return false;
+    priv->has_media_pending = true;
+    return;
   }
 
-  if (NULL == priv->media_files)
+  has_media (self);
+}
+
+static void
+_importer_error_cb (MpdMediaImporter *importer,
+                    GError const     *error,
+                    MpdStorageDevice *self)
+{
+  /* The import stops on the first error. */
+  set_import_busy (self, false);
+  g_signal_emit_by_name (self, "import-error", error);
+}
+
+static void
+_importer_finished_cb (MpdMediaImporter *importer,
+                       uint64_t          imported_size,
+                       uint64_t          skipped_size,
+                       MpdStorageDevice *self)
+{
+  MpdStorageDevicePrivate *priv = GET_PRIVATE (self);
+  char *imported_text = g_format_size_for_display (imported_size);
+  char *skipped_text = g_format_size_for_display (skipped_size);
+
+  g_debug ("%s() %s: imported %s, skipped %s already imported before",
+           __FUNCTION__, priv->path, imported_text, skipped_text);
+  g_free (imported_text);
+  g_free (skipped_text);
+
+  /* Final numbers. */
+  update_import_stats (self);
+  set_import_busy (self, false);
+
+  priv->import_skipped_size = skipped_size;
+  g_object_notify (G_OBJECT (self), "import-skipped-size");
+  g_signal_emit_by_name (self, "import-finished");
+}
+
+static bool
+start_import (MpdStorageDevice  *self,
+              GError           **error)
+{
+  MpdStorageDevicePrivate *priv = GET_PRIVATE (self);
+  MpdFreeSpace     *target;
+  int64_t           target_available;
+  bool              target_known;
+
+  if (NULL == priv->media ||
+      0 == priv->media->files->len)
   {
     g_warning ("%s : %s: No media to import",
                 G_STRLOC,
@@ -891,13 +1299,16 @@ mpd_storage_device_import_async (MpdStorageDevice  *self,
     return false;
   }
 
-  target = mpd_storage_device_new (g_get_home_dir ());
-  target_available = mpd_storage_device_get_available_size (target);
-  g_object_unref (target);
-  if (target_available < priv->media_files_size)
+  /* Without an answer from the home file system, let the copies find
+   * out. */
+  target = mpd_free_space_open (g_get_home_dir ());
+  target_known = mpd_free_space_get (target, NULL, &target_available);
+  mpd_free_space_unref (target);
+  if (target_known &&
+      (uint64_t) target_available < priv->media->size)
   {
     char *available_text = g_format_size_for_display (target_available);
-    char *required_text = g_format_size_for_display (priv->media_files_size);
+    char *required_text = g_format_size_for_display (priv->media->size);
     g_warning ("%s : Would need %s on %s but only %s available",
                G_STRLOC,
                available_text,
@@ -916,17 +1327,80 @@ mpd_storage_device_import_async (MpdStorageDevice  *self,
     return false;
   }
 
-  priv->cancellable = g_cancellable_new ();
-  import_file_async (self);
+  priv->import_skipped_size = 0;
+  if (NULL == priv->importer)
+  {
+    priv->importer = mpd_media_importer_new ();
+    mpd_media_importer_set_max_copies (priv->importer, priv->import_copies);
+    mpd_media_importer_set_low_impact (priv->importer,
+                                       priv->import_low_impact);
+    mpd_media_importer_set_thumbnails (priv->importer,
+                                       priv->import_thumbnails);
+    mpd_media_importer_set_verify (priv->importer, priv->import_verify);
+  }
+
+  /* Pick up where an interrupted import of this volume stopped. */
+  if (priv->volume_key)
+  {
+    MpdImportJournal *journal = mpd_import_journal_open (priv->volume_key,
+                                                         priv->path);
+    mpd_media_importer_set_journal (priv->importer, journal);
+    mpd_import_journal_unref (journal);
+  }
+
+  /* Busy first, the importer finishes right away when everything is in
+   * the journal already. */
+  set_import_busy (self, true);
+  mpd_media_importer_start (priv->importer,
+                            priv->media,
+                            NULL,
+                            (MpdMediaImporterErrorCallback)
+                              _importer_error_cb,
+                            (MpdMediaImporterFinishedCallback)
+                              _importer_finished_cb,
+                            self);
+  if (priv->import_busy)
+    update_import_stats (self);
   return true;
 }
 
+/*
+ * If the volume was not enumerated yet, or the scan is still running,
+ * the import starts once it's done. Errors from then on are reported
+ * through "import-error".
+ */
+bool
+mpd_storage_device_import_async (MpdStorageDevice  *self,
+                                 GError           **error)
+{
+  MpdStorageDevicePrivate *priv = GET_PRIVATE (self);
+
+  g_return_val_if_fail (MPD_IS_STORAGE_DEVICE (self), false);
+
+  if (NULL == priv->media ||
+      (priv->scanner && mpd_media_scanner_is_running (priv->scanner)))
+  {
+    ensure_scanner (self);
+    priv->import_pending = true;
+    if (!mpd_media_scanner_is_running (priv->scanner))
+      mpd_media_scanner_start (priv->scanner,
+                               (MpdMediaScannerCallback) _scanner_cb,
+                               self);
+    return true;
+  }
+
+  return start_import (self, error);
+}
+
 bool
 mpd_storage_device_stop_import (MpdStorageDevice *self)
 {
   MpdStorageDevicePrivate *priv = GET_PRIVATE (self);
-  g_cancellable_cancel (priv->cancellable);
+
+  g_return_val_if_fail (MPD_IS_STORAGE_DEVICE (self), false);
+
+  priv->import_pending = false;
+  if (priv->importer)
+    mpd_media_importer_cancel (priv->importer);
   return true;
 }
-
-#endif
@@ -76,7 +76,51 @@ mpd_storage_device_get_available_size (MpdStorageDevice *self);
 char const *
 mpd_storage_device_get_path (MpdStorageDevice *self);
 
-#if 0 /* Volume crawling code etc. */
+unsigned int
+mpd_storage_device_get_import_copies (MpdStorageDevice *self);
+
+void
+mpd_storage_device_set_import_copies (MpdStorageDevice *self,
+                                      unsigned int      import_copies);
+
+bool
+mpd_storage_device_get_import_low_impact (MpdStorageDevice *self);
+
+void
+mpd_storage_device_set_import_low_impact (MpdStorageDevice *self,
+                                          bool              low_impact);
+
+bool
+mpd_storage_device_get_import_thumbnails (MpdStorageDevice *self);
+
+void
+mpd_storage_device_set_import_thumbnails (MpdStorageDevice *self,
+                                          bool              thumbnails);
+
+bool
+mpd_storage_device_get_import_verify (MpdStorageDevice *self);
+
+void
+mpd_storage_device_set_import_verify (MpdStorageDevice *self,
+                                      bool              verify);
+
+uint64_t
+mpd_storage_device_get_import_skipped_size (MpdStorageDevice *self);
+
+double
+mpd_storage_device_get_import_byte_rate (MpdStorageDevice *self);
+
+double
+mpd_storage_device_get_import_file_rate (MpdStorageDevice *self);
+
+int
+mpd_storage_device_get_import_eta (MpdStorageDevice *self);
+
+unsigned int const *
+mpd_storage_device_get_import_latency_histogram (MpdStorageDevice *self,
+                                                 unsigned int     *n_buckets);
+
+#if 0 /* Needs udisks. */
 
 char const *
 mpd_storage_device_get_label (MpdStorageDevice *self);
@@ -87,6 +131,8 @@ mpd_storage_device_get_model (MpdStorageDevice *self);
 char const *
 mpd_storage_device_get_vendor (MpdStorageDevice *self);
 
+#endif
+
 void
 mpd_storage_device_has_media_async (MpdStorageDevice *self);
 
@@ -97,8 +143,6 @@ mpd_storage_device_import_async (MpdStorageDevice  *self,
 bool
 mpd_storage_device_stop_import (MpdStorageDevice *self);
 
-#endif
-
 G_END_DECLS
 
 #endif /* MPD_STORAGE_DEVICE_H */
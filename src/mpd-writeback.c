@@ -0,0 +1,296 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "mpd-block-stat.h"
+#include "mpd-copy.h"
+#include "mpd-writeback.h"
+#include "config.h"
+
+/*
+ * The kernel exports dirty page counts system wide only, per device
+ * numbers need debugfs. So activity is taken from the device's block
+ * stat, and amounts from /proc/meminfo.
+ *
+ * Data written by the flush itself doesn't count as new activity, the
+ * baseline is taken again when it completes. The flush is the importer's
+ * mpd_copy_sync_async().
+ */
+
+#define SAMPLE_INTERVAL_S   2
+#define IDLE_SAMPLES        3
+
+typedef struct
+{
+  MpdWriteback          *writeback;   /* NULL when it's gone. */
+  MpdWritebackCallback   callback;
+  void                  *data;
+  uint64_t               write_sectors; /* When it started. */
+} FlushJob;
+
+struct MpdWriteback_
+{
+  char          *path;
+  char          *stat_path;     /* NULL if not backed by a block device. */
+  uint64_t       write_sectors;
+  bool           written;       /* Since the last flush. */
+  unsigned int   n_idle;
+  unsigned int   sample_id;
+  FlushJob      *flush;
+};
+
+/*
+ * Dirty and under writeback, in bytes, for the whole system.
+ */
+uint64_t
+mpd_writeback_get_dirty_size (void)
+{
+  char      *contents = NULL;
+  char      *line;
+  uint64_t   size = 0;
+
+  if (!g_file_get_contents ("/proc/meminfo", &contents, NULL, NULL))
+    return 0;
+
+  line = strstr (contents, "\nDirty:");
+  if (line)
+    size += g_ascii_strtoull (line + strlen ("\nDirty:"), NULL, 10);
+
+  line = strstr (contents, "\nWriteback:");
+  if (line)
+    size += g_ascii_strtoull (line + strlen ("\nWriteback:"), NULL, 10);
+
+  g_free (contents);
+  return size * 1024;
+}
+
+static bool
+_sample_cb (MpdWriteback *self)
+{
+  MpdBlockStat stat;
+
+  if (self->flush ||
+      !mpd_block_stat_read (self->stat_path, &stat))
+    return true;
+
+  if (stat.write_sectors != self->write_sectors)
+  {
+    self->write_sectors = stat.write_sectors;
+    self->written = true;
+    self->n_idle = 0;
+    return true;
+  }
+
+  if (!self->written || stat.in_flight > 0)
+    return true;
+
+  if (++self->n_idle < IDLE_SAMPLES)
+    return true;
+
+  self->written = false;
+  self->n_idle = 0;
+  if (mpd_writeback_get_dirty_size () > 0)
+  {
+    g_debug ("%s() %s went idle, flushing", __FUNCTION__, self->path);
+    mpd_writeback_flush_async (self, NULL, NULL);
+  }
+
+  return true;
+}
+
+static void
+_flush_cb (GObject      *source,
+           GAsyncResult *result,
+           FlushJob     *job)
+{
+  MpdWriteback *self = job->writeback;
+  GError       *error = NULL;
+
+  if (!mpd_copy_sync_finish (result, &error))
+  {
+    g_warning ("%s : %s", G_STRLOC, error->message);
+    g_clear_error (&error);
+  }
+
+  if (self)
+  {
+    MpdBlockStat stat;
+
+    self->flush = NULL;
+    if (self->stat_path &&
+        mpd_block_stat_read (self->stat_path, &stat))
+      self->write_sectors = stat.write_sectors;
+    self->written = false;
+    self->n_idle = 0;
+  }
+
+  if (job->callback)
+    job->callback (self, job->data);
+
+  g_free (job);
+}
+
+/*
+ * Writes to the block device behind `path' are watched if there is one,
+ * flushing works for any local file system.
+ */
+MpdWriteback *
+mpd_writeback_new (char const *path)
+{
+  MpdWriteback  *self;
+  MpdBlockStat   stat;
+
+  g_return_val_if_fail (path, NULL);
+
+  self = g_new0 (MpdWriteback, 1);
+  self->path = g_strdup (path);
+
+  self->stat_path = mpd_block_stat_get_path (path);
+  if (self->stat_path &&
+      mpd_block_stat_read (self->stat_path, &stat))
+  {
+    self->write_sectors = stat.write_sectors;
+    self->sample_id = g_timeout_add_seconds (SAMPLE_INTERVAL_S,
+                                             (GSourceFunc) _sample_cb,
+                                             self);
+  }
+
+  return self;
+}
+
+void
+mpd_writeback_free (MpdWriteback *self)
+{
+  g_return_if_fail (self);
+
+  if (self->sample_id)
+    g_source_remove (self->sample_id);
+
+  /* Let it finish, the callback still happens. */
+  if (self->flush)
+    self->flush->writeback = NULL;
+
+  g_free (self->stat_path);
+  g_free (self->path);
+  g_free (self);
+}
+
+/*
+ * Sync the file system in the background. A flush that's running already
+ * is joined, `callback' may be NULL.
+ */
+void
+mpd_writeback_flush_async (MpdWriteback         *self,
+                           MpdWritebackCallback  callback,
+                           void                 *data)
+{
+  g_return_if_fail (self);
+
+  if (self->flush)
+  {
+    if (callback)
+    {
+      g_return_if_fail (NULL == self->flush->callback);
+      self->flush->callback = callback;
+      self->flush->data = data;
+    }
+    return;
+  }
+
+  self->flush = g_new0 (FlushJob, 1);
+  self->flush->writeback = self;
+  self->flush->callback = callback;
+  self->flush->data = data;
+  self->flush->write_sectors = self->write_sectors;
+  if (self->stat_path)
+  {
+    MpdBlockStat stat;
+
+    if (mpd_block_stat_read (self->stat_path, &stat))
+      self->flush->write_sectors = stat.write_sectors;
+  }
+
+  mpd_copy_sync_async (self->path,
+                       (GAsyncReadyCallback) _flush_cb,
+                       self->flush);
+}
+
+bool
+mpd_writeback_is_flushing (MpdWriteback *self)
+{
+  g_return_val_if_fail (self, false);
+
+  return NULL != self->flush;
+}
+
+/*
+ * Whether the device was written to since the last flush, or still has
+ * requests in flight. Without a block device to watch that's unknown, and
+ * any dirty data in the system counts.
+ */
+bool
+mpd_writeback_has_unflushed (MpdWriteback *self)
+{
+  MpdBlockStat stat;
+
+  g_return_val_if_fail (self, false);
+
+  if (self->flush)
+    return true;
+
+  if (NULL == self->stat_path)
+    return mpd_writeback_get_dirty_size () > 0;
+
+  if (!mpd_block_stat_read (self->stat_path, &stat))
+    return self->written;
+
+  if (stat.write_sectors != self->write_sectors)
+  {
+    self->write_sectors = stat.write_sectors;
+    self->written = true;
+    self->n_idle = 0;
+  }
+
+  return self->written || stat.in_flight > 0;
+}
+
+/*
+ * Bytes written to the device since the running flush started, 0 when
+ * not flushing or not backed by a block device.
+ */
+uint64_t
+mpd_writeback_get_flushed_size (MpdWriteback *self)
+{
+  MpdBlockStat stat;
+
+  g_return_val_if_fail (self, 0);
+
+  if (NULL == self->flush ||
+      NULL == self->stat_path ||
+      !mpd_block_stat_read (self->stat_path, &stat) ||
+      stat.write_sectors < self->flush->write_sectors)
+    return 0;
+
+  return (stat.write_sectors - self->flush->write_sectors) *
+         MPD_BLOCK_STAT_SECTOR_SIZE;
+}
+
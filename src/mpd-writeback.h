@@ -0,0 +1,72 @@
+
+/*
+ * Copyright © 2011 Intel Corp.
+ *
+ * Authors: Rob Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPD_WRITEBACK_H
+#define MPD_WRITEBACK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Gets data written to a removable device out of the page cache before
+ * it is ejected. Writes to the backing block device are sampled, once
+ * they have stopped for a while the file system is synced in the
+ * background. An eject then finds little or nothing left to flush.
+ */
+
+typedef struct MpdWriteback_ MpdWriteback;
+
+/*
+ * Invoked in the main context once the flush is done. `writeback' is NULL
+ * if it was freed meanwhile.
+ */
+typedef void (*MpdWritebackCallback) (MpdWriteback *writeback,
+                                      void         *data);
+
+MpdWriteback *
+mpd_writeback_new (char const *path);
+
+void
+mpd_writeback_free (MpdWriteback *self);
+
+void
+mpd_writeback_flush_async (MpdWriteback         *self,
+                           MpdWritebackCallback  callback,
+                           void                 *data);
+
+bool
+mpd_writeback_is_flushing (MpdWriteback *self);
+
+bool
+mpd_writeback_has_unflushed (MpdWriteback *self);
+
+uint64_t
+mpd_writeback_get_flushed_size (MpdWriteback *self);
+
+uint64_t
+mpd_writeback_get_dirty_size (void);
+
+G_END_DECLS
+
+#endif /* MPD_WRITEBACK_H */
+
@@ -0,0 +1,587 @@
+
+/*
+ * Copyright (c) 2011 Intel Corp.
+ *
+ * Author: Robert Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#include "mpd-fake-volume-monitor.h"
+
+typedef struct
+{
+  MpdFakeVolumeMonitor  *monitor;     /* NULL once removed. */
+  char                  *path;
+  GFile                 *root;
+  char                  *name;
+  char                  *icon_name;
+  char                  *content_type;
+  char                  *uuid;
+  MpdFakeEjectBehaviour  eject_behaviour;
+  unsigned int           delay_ms;
+} MpdFakeMountPrivate;
+
+typedef struct
+{
+  char    *path;
+  GList   *mounts;
+} MpdFakeVolumeMonitorPrivate;
+
+/* Completes a result after the mount's delay, like a round trip to gvfs. */
+typedef struct
+{
+  GSimpleAsyncResult  *result;
+  GCancellable        *cancellable;
+  bool                 remove;      /* Mount goes away on success. */
+} AsyncOp;
+
+static void
+mpd_fake_mount_iface_init (GMountIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (MpdFakeMount, mpd_fake_mount, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (G_TYPE_MOUNT,
+                                                mpd_fake_mount_iface_init))
+
+G_DEFINE_TYPE (MpdFakeVolumeMonitor, mpd_fake_volume_monitor, G_TYPE_VOLUME_MONITOR)
+
+#define GET_MOUNT_PRIVATE(o) \
+  (G_TYPE_INSTANCE_GET_PRIVATE ((o), MPD_TYPE_FAKE_MOUNT, MpdFakeMountPrivate))
+
+#define GET_MONITOR_PRIVATE(o) \
+  (G_TYPE_INSTANCE_GET_PRIVATE ((o), MPD_TYPE_FAKE_VOLUME_MONITOR, MpdFakeVolumeMonitorPrivate))
+
+/*
+ * Mount
+ */
+
+static bool
+_async_op_complete_cb (AsyncOp *op)
+{
+  GError *error = NULL;
+
+  if (op->cancellable &&
+      g_cancellable_set_error_if_cancelled (op->cancellable, &error))
+  {
+    g_simple_async_result_set_from_error (op->result, error);
+    g_clear_error (&error);
+  } else if (op->remove) {
+    MpdFakeMount *mount = (MpdFakeMount *)
+                    g_async_result_get_source_object (G_ASYNC_RESULT (op->result));
+    MpdFakeMountPrivate *priv = GET_MOUNT_PRIVATE (mount);
+
+    if (priv->monitor)
+      mpd_fake_volume_monitor_remove_mount (priv->monitor, mount);
+    g_object_unref (mount);
+  }
+
+  g_simple_async_result_complete (op->result);
+
+  g_object_unref (op->result);
+  if (op->cancellable)
+    g_object_unref (op->cancellable);
+  g_free (op);
+  return false;
+}
+
+static void
+complete_later (MpdFakeMount        *self,
+                GSimpleAsyncResult  *result,
+                GCancellable        *cancellable,
+                bool                 remove)
+{
+  MpdFakeMountPrivate *priv = GET_MOUNT_PRIVATE (self);
+  AsyncOp *op;
+
+  op = g_new0 (AsyncOp, 1);
+  op->result = result;
+  op->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
+  op->remove = remove;
+
+  g_timeout_add (priv->delay_ms, (GSourceFunc) _async_op_complete_cb, op);
+}
+
+static GFile *
+_get_root (GMount *mount)
+{
+  MpdFakeMountPrivate *priv = GET_MOUNT_PRIVATE (mount);
+
+  return g_object_ref (priv->root);
+}
+
+static char *
+_get_name (GMount *mount)
+{
+  MpdFakeMountPrivate *priv = GET_MOUNT_PRIVATE (mount);
+
+  return g_strdup (priv->name);
+}
+
+static GIcon *
+_get_icon (GMount *mount)
+{
+  MpdFakeMountPrivate *priv = GET_MOUNT_PRIVATE (mount);
+
+  return g_themed_icon_new_with_default_fallbacks (
+                    priv->icon_name ? priv->icon_name : "drive-removable-media");
+}
+
+static char *
+_get_uuid (GMount *mount)
+{
+  MpdFakeMountPrivate *priv = GET_MOUNT_PRIVATE (mount);
+
+  return g_strdup (priv->uuid);
+}
+
+static GVolume *
+_get_volume (GMount *mount)
+{
+  return NULL;
+}
+
+static GDrive *
+_get_drive (GMount *mount)
+{
+  return NULL;
+}
+
+static gboolean
+_can_eject (GMount *mount)
+{
+  MpdFakeMountPrivate *priv = GET_MOUNT_PRIVATE (mount);
+
+  return MPD_FAKE_EJECT_UNSUPPORTED != priv->eject_behaviour;
+}
+
+static void
+_eject_with_operation (GMount               *mount,
+                       GMountUnmountFlags    flags,
+                       GMountOperation      *mount_operation,
+                       GCancellable         *cancellable,
+                       GAsyncReadyCallback   callback,
+                       void                 *data)
+{
+  MpdFakeMountPrivate *priv = GET_MOUNT_PRIVATE (mount);
+  GSimpleAsyncResult *result;
+
+  result = g_simple_async_result_new (G_OBJECT (mount), callback, data,
+                                      _eject_with_operation);
+
+  switch (priv->eject_behaviour)
+  {
+  case MPD_FAKE_EJECT_OK:
+    complete_later (MPD_FAKE_MOUNT (mount), result, cancellable, true);
+    return;
+  case MPD_FAKE_EJECT_BUSY:
+    /* Like gvfs, list who's in the way first. */
+    if (mount_operation)
+    {
+      GArray  *processes = g_array_new (false, false, sizeof (GPid));
+      GPid     pid = getpid ();
+      char    *choices[] = { "Unmount Anyway", "Cancel", NULL };
+
+      g_array_append_val (processes, pid);
+      g_signal_emit_by_name (mount_operation, "show-processes",
+                             "Volume is busy", processes, choices);
+      g_array_free (processes, true);
+    }
+    g_simple_async_result_set_error (result, G_IO_ERROR, G_IO_ERROR_BUSY,
+                                     "Device or resource busy");
+    break;
+  case MPD_FAKE_EJECT_FAILED:
+    g_simple_async_result_set_error (result, G_IO_ERROR, G_IO_ERROR_FAILED,
+                                     "Failed to eject %s", priv->name);
+    break;
+  case MPD_FAKE_EJECT_UNSUPPORTED:
+    g_simple_async_result_set_error (result, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                                     "%s can not be ejected", priv->name);
+    break;
+  }
+
+  complete_later (MPD_FAKE_MOUNT (mount), result, cancellable, false);
+}
+
+static gboolean
+_eject_with_operation_finish (GMount        *mount,
+                              GAsyncResult  *result,
+                              GError       **error)
+{
+  return !g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (result),
+                                                 error);
+}
+
+static char **
+get_content_types (MpdFakeMount *self)
+{
+  MpdFakeMountPrivate *priv = GET_MOUNT_PRIVATE (self);
+  char **content_types = g_new0 (char *, 2);
+
+  if (priv->content_type && *priv->content_type)
+    content_types[0] = g_strdup (priv->content_type);
+
+  return content_types;
+}
+
+static void
+_guess_content_type (GMount              *mount,
+                     gboolean             force_rescan,
+                     GCancellable        *cancellable,
+                     GAsyncReadyCallback  callback,
+                     void                *data)
+{
+  GSimpleAsyncResult *result;
+
+  result = g_simple_async_result_new (G_OBJECT (mount), callback, data,
+                                      _guess_content_type);
+  g_simple_async_result_set_op_res_gpointer (result,
+                                             get_content_types (MPD_FAKE_MOUNT (mount)),
+                                             (GDestroyNotify) g_strfreev);
+
+  complete_later (MPD_FAKE_MOUNT (mount), result, cancellable, false);
+}
+
+static char **
+_guess_content_type_finish (GMount        *mount,
+                            GAsyncResult  *result,
+                            GError       **error)
+{
+  GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT (result);
+
+  if (g_simple_async_result_propagate_error (simple, error))
+    return NULL;
+
+  return g_strdupv (g_simple_async_result_get_op_res_gpointer (simple));
+}
+
+static char **
+_guess_content_type_sync (GMount        *mount,
+                          gboolean       force_rescan,
+                          GCancellable  *cancellable,
+                          GError       **error)
+{
+  return get_content_types (MPD_FAKE_MOUNT (mount));
+}
+
+static void
+mpd_fake_mount_iface_init (GMountIface *iface)
+{
+  iface->get_root = _get_root;
+  iface->get_name = _get_name;
+  iface->get_icon = _get_icon;
+  iface->get_uuid = _get_uuid;
+  iface->get_volume = _get_volume;
+  iface->get_drive = _get_drive;
+  iface->can_unmount = _can_eject;
+  iface->can_eject = _can_eject;
+  iface->unmount_with_operation = _eject_with_operation;
+  iface->unmount_with_operation_finish = _eject_with_operation_finish;
+  iface->eject_with_operation = _eject_with_operation;
+  iface->eject_with_operation_finish = _eject_with_operation_finish;
+  iface->guess_content_type = _guess_content_type;
+  iface->guess_content_type_finish = _guess_content_type_finish;
+  iface->guess_content_type_sync = _guess_content_type_sync;
+}
+
+static void
+_mount_finalize (GObject *object)
+{
+  MpdFakeMountPrivate *priv = GET_MOUNT_PRIVATE (object);
+
+  g_object_unref (priv->root);
+  g_free (priv->path);
+  g_free (priv->name);
+  g_free (priv->icon_name);
+  g_free (priv->content_type);
+  g_free (priv->uuid);
+
+  G_OBJECT_CLASS (mpd_fake_mount_parent_class)->finalize (object);
+}
+
+static void
+mpd_fake_mount_class_init (MpdFakeMountClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  g_type_class_add_private (klass, sizeof (MpdFakeMountPrivate));
+
+  object_class->finalize = _mount_finalize;
+}
+
+static void
+mpd_fake_mount_init (MpdFakeMount *self)
+{
+}
+
+char const *
+mpd_fake_mount_get_path (MpdFakeMount *self)
+{
+  MpdFakeMountPrivate *priv = GET_MOUNT_PRIVATE (self);
+
+  g_return_val_if_fail (MPD_IS_FAKE_MOUNT (self), NULL);
+
+  return priv->path;
+}
+
+void
+mpd_fake_mount_set_eject_behaviour (MpdFakeMount          *self,
+                                    MpdFakeEjectBehaviour  behaviour)
+{
+  MpdFakeMountPrivate *priv = GET_MOUNT_PRIVATE (self);
+
+  g_return_if_fail (MPD_IS_FAKE_MOUNT (self));
+
+  priv->eject_behaviour = behaviour;
+}
+
+/*
+ * How long guessing the content type and ejecting take.
+ */
+void
+mpd_fake_mount_set_delay (MpdFakeMount *self,
+                          unsigned int  delay_ms)
+{
+  MpdFakeMountPrivate *priv = GET_MOUNT_PRIVATE (self);
+
+  g_return_if_fail (MPD_IS_FAKE_MOUNT (self));
+
+  priv->delay_ms = delay_ms;
+}
+
+/*
+ * Volume monitor
+ */
+
+static GList *
+_get_connected_drives (GVolumeMonitor *monitor)
+{
+  return NULL;
+}
+
+static GList *
+_get_volumes (GVolumeMonitor *monitor)
+{
+  return NULL;
+}
+
+static GList *
+_get_mounts (GVolumeMonitor *monitor)
+{
+  MpdFakeVolumeMonitorPrivate *priv = GET_MONITOR_PRIVATE (monitor);
+  GList *mounts;
+
+  mounts = g_list_copy (priv->mounts);
+  g_list_foreach (mounts, (GFunc) g_object_ref, NULL);
+
+  return mounts;
+}
+
+static GVolume *
+_get_volume_for_uuid (GVolumeMonitor *monitor,
+                      char const     *uuid)
+{
+  return NULL;
+}
+
+static GMount *
+_get_mount_for_uuid (GVolumeMonitor *monitor,
+                     char const     *uuid)
+{
+  MpdFakeVolumeMonitorPrivate *priv = GET_MONITOR_PRIVATE (monitor);
+  GList *iter;
+
+  for (iter = priv->mounts; iter; iter = iter->next)
+  {
+    MpdFakeMountPrivate *mount_priv = GET_MOUNT_PRIVATE (iter->data);
+    if (0 == g_strcmp0 (uuid, mount_priv->uuid))
+      return g_object_ref (iter->data);
+  }
+
+  return NULL;
+}
+
+static void
+_monitor_dispose (GObject *object)
+{
+  MpdFakeVolumeMonitorPrivate *priv = GET_MONITOR_PRIVATE (object);
+
+  while (priv->mounts)
+  {
+    mpd_fake_volume_monitor_remove_mount (MPD_FAKE_VOLUME_MONITOR (object),
+                                          priv->mounts->data);
+  }
+
+  if (priv->path)
+  {
+    g_rmdir (priv->path);
+    g_free (priv->path);
+    priv->path = NULL;
+  }
+
+  G_OBJECT_CLASS (mpd_fake_volume_monitor_parent_class)->dispose (object);
+}
+
+static void
+mpd_fake_volume_monitor_class_init (MpdFakeVolumeMonitorClass *klass)
+{
+  GObjectClass        *object_class = G_OBJECT_CLASS (klass);
+  GVolumeMonitorClass *monitor_class = G_VOLUME_MONITOR_CLASS (klass);
+
+  g_type_class_add_private (klass, sizeof (MpdFakeVolumeMonitorPrivate));
+
+  object_class->dispose = _monitor_dispose;
+
+  monitor_class->get_connected_drives = _get_connected_drives;
+  monitor_class->get_volumes = _get_volumes;
+  monitor_class->get_mounts = _get_mounts;
+  monitor_class->get_volume_for_uuid = _get_volume_for_uuid;
+  monitor_class->get_mount_for_uuid = _get_mount_for_uuid;
+}
+
+static void
+mpd_fake_volume_monitor_init (MpdFakeVolumeMonitor *self)
+{
+  MpdFakeVolumeMonitorPrivate *priv = GET_MONITOR_PRIVATE (self);
+
+  priv->path = g_build_filename (g_get_tmp_dir (),
+                                 "mpd-fake-volume-monitor-XXXXXX",
+                                 NULL);
+  if (NULL == mkdtemp (priv->path))
+  {
+    g_critical ("%s : %s: %s", G_STRLOC, priv->path, g_strerror (errno));
+  }
+}
+
+MpdFakeVolumeMonitor *
+mpd_fake_volume_monitor_new (void)
+{
+  return g_object_new (MPD_TYPE_FAKE_VOLUME_MONITOR, NULL);
+}
+
+/*
+ * Creates an empty directory for the mount and announces it. `icon_name',
+ * `content_type' and `uuid' may be NULL, the mount belongs to the monitor.
+ */
+MpdFakeMount *
+mpd_fake_volume_monitor_add_mount (MpdFakeVolumeMonitor *self,
+                                   char const           *name,
+                                   char const           *icon_name,
+                                   char const           *content_type,
+                                   char const           *uuid)
+{
+  MpdFakeVolumeMonitorPrivate *priv = GET_MONITOR_PRIVATE (self);
+  MpdFakeMountPrivate *mount_priv;
+  MpdFakeMount *mount;
+  char *path;
+
+  g_return_val_if_fail (MPD_IS_FAKE_VOLUME_MONITOR (self), NULL);
+  g_return_val_if_fail (name, NULL);
+
+  path = g_build_filename (priv->path, "mount-XXXXXX", NULL);
+  if (NULL == mkdtemp (path))
+  {
+    g_warning ("%s : %s: %s", G_STRLOC, path, g_strerror (errno));
+    g_free (path);
+    return NULL;
+  }
+
+  mount = g_object_new (MPD_TYPE_FAKE_MOUNT, NULL);
+  mount_priv = GET_MOUNT_PRIVATE (mount);
+  mount_priv->monitor = self;
+  mount_priv->path = path;
+  mount_priv->root = g_file_new_for_path (path);
+  mount_priv->name = g_strdup (name);
+  mount_priv->icon_name = g_strdup (icon_name);
+  mount_priv->content_type = g_strdup (content_type);
+  mount_priv->uuid = g_strdup (uuid);
+
+  priv->mounts = g_list_append (priv->mounts, mount);
+  g_signal_emit_by_name (self, "mount-added", mount);
+
+  return mount;
+}
+
+MpdFakeMount *
+mpd_fake_volume_monitor_find_mount (MpdFakeVolumeMonitor *self,
+                                    char const           *name)
+{
+  MpdFakeVolumeMonitorPrivate *priv = GET_MONITOR_PRIVATE (self);
+  GList *iter;
+
+  g_return_val_if_fail (MPD_IS_FAKE_VOLUME_MONITOR (self), NULL);
+
+  for (iter = priv->mounts; iter; iter = iter->next)
+  {
+    MpdFakeMountPrivate *mount_priv = GET_MOUNT_PRIVATE (iter->data);
+    if (0 == g_strcmp0 (name, mount_priv->name))
+      return iter->data;
+  }
+
+  return NULL;
+}
+
+void
+mpd_fake_volume_monitor_change_mount (MpdFakeVolumeMonitor *self,
+                                      MpdFakeMount         *mount)
+{
+  g_return_if_fail (MPD_IS_FAKE_VOLUME_MONITOR (self));
+  g_return_if_fail (MPD_IS_FAKE_MOUNT (mount));
+
+  g_signal_emit_by_name (mount, "changed");
+  g_signal_emit_by_name (self, "mount-changed", mount);
+}
+
+/*
+ * Announces that the mount is gone and deletes its directory, which is
+ * expected to be empty. References held elsewhere stay valid.
+ */
+void
+mpd_fake_volume_monitor_remove_mount (MpdFakeVolumeMonitor *self,
+                                      MpdFakeMount         *mount)
+{
+  MpdFakeVolumeMonitorPrivate *priv = GET_MONITOR_PRIVATE (self);
+  MpdFakeMountPrivate *mount_priv = GET_MOUNT_PRIVATE (mount);
+
+  g_return_if_fail (MPD_IS_FAKE_VOLUME_MONITOR (self));
+  g_return_if_fail (MPD_IS_FAKE_MOUNT (mount));
+  g_return_if_fail (mount_priv->monitor == self);
+
+  priv->mounts = g_list_remove (priv->mounts, mount);
+  mount_priv->monitor = NULL;
+
+  g_signal_emit_by_name (mount, "unmounted");
+  g_signal_emit_by_name (self, "mount-removed", mount);
+
+  if (0 != g_rmdir (mount_priv->path))
+    g_warning ("%s : %s: %s", G_STRLOC, mount_priv->path, g_strerror (errno));
+
+  g_object_unref (mount);
+}
+
+unsigned int
+mpd_fake_volume_monitor_get_n_mounts (MpdFakeVolumeMonitor *self)
+{
+  MpdFakeVolumeMonitorPrivate *priv = GET_MONITOR_PRIVATE (self);
+
+  g_return_val_if_fail (MPD_IS_FAKE_VOLUME_MONITOR (self), 0);
+
+  return g_list_length (priv->mounts);
+}
+
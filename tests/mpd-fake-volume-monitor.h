@@ -0,0 +1,123 @@
+
+/*
+ * Copyright (c) 2011 Intel Corp.
+ *
+ * Author: Robert Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPD_FAKE_VOLUME_MONITOR_H
+#define MPD_FAKE_VOLUME_MONITOR_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/*
+ * In-process stand-in for the system volume monitor. Mounts are backed by
+ * temporary directories and come and go when told to, emitting the same
+ * signals GIO does. Pass it to MpdDevicesTile's "volume-monitor".
+ */
+
+#define MPD_TYPE_FAKE_MOUNT mpd_fake_mount_get_type()
+
+#define MPD_FAKE_MOUNT(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), MPD_TYPE_FAKE_MOUNT, MpdFakeMount))
+
+#define MPD_IS_FAKE_MOUNT(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), MPD_TYPE_FAKE_MOUNT))
+
+typedef struct
+{
+  GObject parent;
+} MpdFakeMount;
+
+typedef struct
+{
+  GObjectClass parent;
+} MpdFakeMountClass;
+
+#define MPD_TYPE_FAKE_VOLUME_MONITOR mpd_fake_volume_monitor_get_type()
+
+#define MPD_FAKE_VOLUME_MONITOR(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), MPD_TYPE_FAKE_VOLUME_MONITOR, MpdFakeVolumeMonitor))
+
+#define MPD_IS_FAKE_VOLUME_MONITOR(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), MPD_TYPE_FAKE_VOLUME_MONITOR))
+
+typedef struct
+{
+  GVolumeMonitor parent;
+} MpdFakeVolumeMonitor;
+
+typedef struct
+{
+  GVolumeMonitorClass parent;
+} MpdFakeVolumeMonitorClass;
+
+typedef enum
+{
+  MPD_FAKE_EJECT_OK,          /* Goes away like a real mount. */
+  MPD_FAKE_EJECT_BUSY,        /* Fails with G_IO_ERROR_BUSY. */
+  MPD_FAKE_EJECT_FAILED,      /* Fails with G_IO_ERROR_FAILED. */
+  MPD_FAKE_EJECT_UNSUPPORTED  /* Can neither eject nor unmount. */
+} MpdFakeEjectBehaviour;
+
+GType
+mpd_fake_mount_get_type (void);
+
+char const *
+mpd_fake_mount_get_path (MpdFakeMount *self);
+
+void
+mpd_fake_mount_set_eject_behaviour (MpdFakeMount          *self,
+                                    MpdFakeEjectBehaviour  behaviour);
+
+void
+mpd_fake_mount_set_delay (MpdFakeMount *self,
+                          unsigned int  delay_ms);
+
+GType
+mpd_fake_volume_monitor_get_type (void);
+
+MpdFakeVolumeMonitor *
+mpd_fake_volume_monitor_new (void);
+
+MpdFakeMount *
+mpd_fake_volume_monitor_add_mount (MpdFakeVolumeMonitor *self,
+                                   char const           *name,
+                                   char const           *icon_name,
+                                   char const           *content_type,
+                                   char const           *uuid);
+
+MpdFakeMount *
+mpd_fake_volume_monitor_find_mount (MpdFakeVolumeMonitor *self,
+                                    char const           *name);
+
+void
+mpd_fake_volume_monitor_change_mount (MpdFakeVolumeMonitor *self,
+                                      MpdFakeMount         *mount);
+
+void
+mpd_fake_volume_monitor_remove_mount (MpdFakeVolumeMonitor *self,
+                                      MpdFakeMount         *mount);
+
+unsigned int
+mpd_fake_volume_monitor_get_n_mounts (MpdFakeVolumeMonitor *self);
+
+G_END_DECLS
+
+#endif /* MPD_FAKE_VOLUME_MONITOR_H */
+
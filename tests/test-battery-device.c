@@ -35,6 +35,10 @@ battery_print (MpdBatteryDevice *battery,
     g_debug ("%s", text);
     g_free (text);
   }
+
+  if (mpd_battery_device_get_discovery_time (battery) >= 0)
+    g_debug ("discovery: %.1f ms",
+             mpd_battery_device_get_discovery_time (battery) * 1000);
 }
 
 static void
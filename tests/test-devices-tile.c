@@ -0,0 +1,163 @@
+
+/*
+ * Copyright (c) 2011 Intel Corp.
+ *
+ * Author: Robert Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Devices tile on a fake volume monitor, driven by commands on stdin so
+ * hotplug sequences can be typed or piped in:
+ *
+ *   add <name> [<icon-name> [<content-type>]]
+ *   change <name>
+ *   remove <name>
+ *   eject <name> ok|busy|failed|unsupported
+ *   delay <name> <ms>
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <clutter/clutter.h>
+#include <gio/gio.h>
+#include <gtk/gtk.h>
+#include <mx/mx.h>
+#include "mpd-devices-tile.h"
+#include "mpd-fake-volume-monitor.h"
+
+static void
+run_command (MpdFakeVolumeMonitor  *monitor,
+             char                 **argv)
+{
+  MpdFakeMount  *mount;
+  unsigned int   argc = g_strv_length (argv);
+
+  if (argc < 2)
+  {
+    g_warning ("%s : Command and mount name expected", G_STRLOC);
+    return;
+  }
+
+  if (0 == strcmp ("add", argv[0]))
+  {
+    mpd_fake_volume_monitor_add_mount (monitor,
+                                       argv[1],
+                                       argc > 2 ? argv[2] : NULL,
+                                       argc > 3 ? argv[3] : NULL,
+                                       argv[1]);
+    return;
+  }
+
+  mount = mpd_fake_volume_monitor_find_mount (monitor, argv[1]);
+  if (NULL == mount)
+  {
+    g_warning ("%s : No mount '%s'", G_STRLOC, argv[1]);
+    return;
+  }
+
+  if (0 == strcmp ("change", argv[0]))
+  {
+    mpd_fake_volume_monitor_change_mount (monitor, mount);
+  } else if (0 == strcmp ("remove", argv[0])) {
+    mpd_fake_volume_monitor_remove_mount (monitor, mount);
+  } else if (0 == strcmp ("eject", argv[0]) && argc > 2) {
+    char const *behaviours[] = { "ok", "busy", "failed", "unsupported" };
+    unsigned int i;
+    for (i = 0; i < G_N_ELEMENTS (behaviours); i++)
+    {
+      if (0 == strcmp (behaviours[i], argv[2]))
+      {
+        mpd_fake_mount_set_eject_behaviour (mount, i);
+        break;
+      }
+    }
+    if (i == G_N_ELEMENTS (behaviours))
+      g_warning ("%s : Unknown eject behaviour '%s'", G_STRLOC, argv[2]);
+  } else if (0 == strcmp ("delay", argv[0]) && argc > 2) {
+    mpd_fake_mount_set_delay (mount, atoi (argv[2]));
+  } else {
+    g_warning ("%s : Unknown command '%s'", G_STRLOC, argv[0]);
+  }
+}
+
+static bool
+_stdin_cb (GIOChannel           *channel,
+           GIOCondition          condition,
+           MpdFakeVolumeMonitor *monitor)
+{
+  char    *line = NULL;
+  char   **argv;
+  GError  *error = NULL;
+
+  switch (g_io_channel_read_line (channel, &line, NULL, NULL, &error))
+  {
+  case G_IO_STATUS_NORMAL:
+    argv = g_strsplit_set (g_strstrip (line), " \t", -1);
+    if (argv[0] && *argv[0])
+      run_command (monitor, argv);
+    g_strfreev (argv);
+    g_free (line);
+    return true;
+  case G_IO_STATUS_AGAIN:
+    return true;
+  case G_IO_STATUS_ERROR:
+    g_warning ("%s : %s", G_STRLOC, error->message);
+    g_clear_error (&error);
+    return false;
+  default:
+    /* Keep showing what's there at the end of a script. */
+    return false;
+  }
+}
+
+int
+main (int     argc,
+      char  **argv)
+{
+  ClutterActor          *stage;
+  ClutterActor          *tile;
+  MpdFakeVolumeMonitor  *monitor;
+  GIOChannel            *channel;
+
+  clutter_init (&argc, &argv);
+  /* Just for icon theme, no widgets. */
+  gtk_init (&argc, &argv);
+
+  monitor = mpd_fake_volume_monitor_new ();
+
+  stage = clutter_stage_get_default ();
+  tile = g_object_new (MPD_TYPE_DEVICES_TILE,
+                       "volume-monitor", monitor,
+                       NULL);
+  clutter_actor_set_size (tile, 480.0, 600.0);
+  clutter_container_add_actor (CLUTTER_CONTAINER (stage), tile);
+
+  channel = g_io_channel_unix_new (STDIN_FILENO);
+  g_io_add_watch (channel, G_IO_IN | G_IO_HUP,
+                  (GIOFunc) _stdin_cb, monitor);
+
+  clutter_actor_show_all (stage);
+  clutter_main ();
+
+  g_io_channel_unref (channel);
+  clutter_actor_destroy (tile);
+  g_object_unref (monitor);
+
+  return EXIT_SUCCESS;
+}
+
@@ -0,0 +1,426 @@
+
+/*
+ * Copyright (c) 2011 Intel Corp.
+ *
+ * Author: Robert Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Hotplug storm benchmark. Mounts on a fake volume monitor are added,
+ * changed and removed by the hundred while a devices tile watches, and
+ * one line of JSON per run is printed:
+ *
+ *   for n in 50 200 500; do test-hotplug-benchmark -n $n; done
+ *
+ * Latency is from an event being emitted to the tile asking for a relayout
+ * in response, so it includes the tile's own batching delay and is only
+ * accurate to a frame. Relayouts count the requests that got through,
+ * those made while one is pending already are folded into it by clutter.
+ * Changes are counted but not timed, they normally don't show. Removed
+ * tiles linger for their goodbye message, when they finally go away that
+ * counts towards whichever phase is running.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <glib/gstdio.h>
+#include <clutter/clutter.h>
+#include <gtk/gtk.h>
+#include <mx/mx.h>
+#include "mpd-devices-tile.h"
+#include "mpd-fake-volume-monitor.h"
+#include "mpd-import-stats.h"
+
+/* Settled when nothing is pending and no relayout came for this long. */
+#define QUIET_MS          250
+#define SETTLE_TIMEOUT_MS 30000
+#define POLL_INTERVAL_MS  10
+
+typedef enum
+{
+  PHASE_ADD,
+  PHASE_CHANGE,
+  PHASE_REMOVE,
+
+  PHASE_LAST
+} PhaseKind;
+
+typedef struct
+{
+  unsigned int   n_events;
+  unsigned int   n_relayouts;
+  unsigned int   n_unresolved;
+  GArray        *latencies;     /* int64_t, microseconds */
+  int64_t        settle_time;
+} Phase;
+
+typedef struct
+{
+  GMainLoop             *loop;
+  MpdFakeVolumeMonitor  *monitor;
+  GPtrArray             *mounts;
+  Phase                  phases[PHASE_LAST];
+  Phase                 *phase;
+  GArray                *pending;       /* int64_t, emission times */
+  int64_t                phase_start;
+  int64_t                last_relayout;
+  unsigned int           n_emitted;
+  unsigned int           n_to_emit;
+  unsigned int           n_mounts;
+  unsigned int           spread_ms;
+  unsigned int           delay_ms;
+  unsigned int           serial;
+} Benchmark;
+
+static char const *_phase_names[PHASE_LAST] = { "add", "change", "remove" };
+
+static void
+remove_tree (char const *path)
+{
+  GDir        *dir;
+  char const  *name;
+
+  dir = g_dir_open (path, 0, NULL);
+  if (dir)
+  {
+    while (NULL != (name = g_dir_read_name (dir)))
+    {
+      char *child = g_build_filename (path, name, NULL);
+      if (g_file_test (child, G_FILE_TEST_IS_DIR) &&
+          !g_file_test (child, G_FILE_TEST_IS_SYMLINK))
+        remove_tree (child);
+      else
+        g_unlink (child);
+      g_free (child);
+    }
+    g_dir_close (dir);
+  }
+
+  g_rmdir (path);
+}
+
+static void
+_queue_relayout_cb (ClutterActor  *actor,
+                    Benchmark     *bench)
+{
+  int64_t now = mpd_import_stats_get_time ();
+
+  bench->last_relayout = now;
+  if (NULL == bench->phase)
+    return;
+
+  bench->phase->n_relayouts++;
+
+  /* Everything emitted so far has been seen to. */
+  if (PHASE_CHANGE != bench->phase - bench->phases)
+  {
+    for (unsigned int i = 0; i < bench->pending->len; i++)
+    {
+      int64_t latency = now - g_array_index (bench->pending, int64_t, i);
+      g_array_append_val (bench->phase->latencies, latency);
+    }
+    g_array_set_size (bench->pending, 0);
+  }
+}
+
+static void
+emit (Benchmark *bench)
+{
+  PhaseKind     kind = bench->phase - bench->phases;
+  unsigned int  i = bench->n_emitted++;
+  int64_t       now;
+
+  now = mpd_import_stats_get_time ();
+  if (PHASE_CHANGE != kind)
+    g_array_append_val (bench->pending, now);
+  bench->phase->n_events++;
+
+  switch (kind)
+  {
+  case PHASE_ADD:
+  {
+    MpdFakeMount  *mount;
+    char          *name = g_strdup_printf ("Stick %u", ++bench->serial);
+    char          *uuid = g_strdup_printf ("%08X-BENCH", bench->serial);
+
+    /* Some cameras among the sticks, and some devices seen before. */
+    mount = mpd_fake_volume_monitor_add_mount (
+                      bench->monitor,
+                      name,
+                      i % 4 ? "drive-removable-media" : "camera-photo",
+                      i % 4 ? NULL : "x-content/image-dcf",
+                      i % 8 ? uuid : "00000000-BENCH");
+    if (mount)
+    {
+      mpd_fake_mount_set_delay (mount, bench->delay_ms);
+      g_ptr_array_add (bench->mounts, mount);
+    }
+    g_free (uuid);
+    g_free (name);
+    break;
+  }
+  case PHASE_CHANGE:
+    mpd_fake_volume_monitor_change_mount (bench->monitor,
+                                          g_ptr_array_index (bench->mounts, i));
+    break;
+  case PHASE_REMOVE:
+    mpd_fake_volume_monitor_remove_mount (bench->monitor,
+                                          g_ptr_array_index (bench->mounts, i));
+    break;
+  default:
+    g_assert_not_reached ();
+  }
+}
+
+static bool
+_emit_cb (Benchmark *bench)
+{
+  emit (bench);
+  return bench->n_emitted < bench->n_to_emit;
+}
+
+static bool
+_settle_cb (Benchmark *bench)
+{
+  int64_t now = mpd_import_stats_get_time ();
+  bool    emitting = bench->n_emitted < bench->n_to_emit;
+
+  if (!emitting &&
+      (bench->pending->len == 0 ||
+       PHASE_CHANGE == bench->phase - bench->phases) &&
+      now - bench->last_relayout > QUIET_MS * 1000)
+  {
+    bench->phase->settle_time += bench->last_relayout - bench->phase_start;
+    g_main_loop_quit (bench->loop);
+    return false;
+  }
+
+  if (now - bench->phase_start > SETTLE_TIMEOUT_MS * 1000)
+  {
+    g_warning ("%s : %s did not settle", G_STRLOC,
+               _phase_names[bench->phase - bench->phases]);
+    bench->phase->n_unresolved += bench->pending->len;
+    bench->phase->settle_time += now - bench->phase_start;
+    g_main_loop_quit (bench->loop);
+    return false;
+  }
+
+  return true;
+}
+
+static void
+run_phase (Benchmark *bench,
+           PhaseKind  kind)
+{
+  unsigned int emit_id = 0;
+
+  bench->phase = &bench->phases[kind];
+  bench->n_emitted = 0;
+  bench->n_to_emit = PHASE_ADD == kind ? bench->n_mounts : bench->mounts->len;
+  g_array_set_size (bench->pending, 0);
+  bench->phase_start = mpd_import_stats_get_time ();
+  bench->last_relayout = bench->phase_start;
+
+  if (bench->spread_ms && bench->n_to_emit)
+  {
+    emit_id = g_timeout_add (MAX (1, bench->spread_ms / bench->n_to_emit),
+                             (GSourceFunc) _emit_cb, bench);
+  } else {
+    /* One storm, all within the same main loop iteration. */
+    while (bench->n_emitted < bench->n_to_emit)
+      emit (bench);
+  }
+
+  g_timeout_add (POLL_INTERVAL_MS, (GSourceFunc) _settle_cb, bench);
+  g_main_loop_run (bench->loop);
+
+  if (emit_id && bench->n_emitted < bench->n_to_emit)
+    g_source_remove (emit_id);
+
+  if (PHASE_REMOVE == kind)
+    g_ptr_array_set_size (bench->mounts, 0);
+
+  bench->phase = NULL;
+}
+
+static int
+compare_int64 (int64_t const *a,
+               int64_t const *b)
+{
+  return *a < *b ? -1 : *a > *b;
+}
+
+static double
+percentile_ms (GArray *latencies,
+               double  fraction)
+{
+  unsigned int i;
+
+  if (0 == latencies->len)
+    return 0;
+
+  i = (unsigned int) (fraction * (latencies->len - 1) + 0.5);
+  return g_array_index (latencies, int64_t, i) / 1000.;
+}
+
+static void
+print_json (Benchmark     *bench,
+            unsigned int   n_rounds)
+{
+  GString *json = g_string_new (NULL);
+
+  g_string_append_printf (json,
+                          "{\"mounts\": %u, \"rounds\": %u"
+                          ", \"spread_ms\": %u, \"delay_ms\": %u",
+                          bench->n_mounts, n_rounds,
+                          bench->spread_ms, bench->delay_ms);
+
+  for (unsigned int i = 0; i < PHASE_LAST; i++)
+  {
+    Phase *phase = &bench->phases[i];
+
+    g_array_sort (phase->latencies, (GCompareFunc) compare_int64);
+    g_string_append_printf (json,
+                            ", \"%s\": {\"events\": %u, \"relayouts\": %u"
+                            ", \"settle_ms\": %.1f",
+                            _phase_names[i],
+                            phase->n_events,
+                            phase->n_relayouts,
+                            phase->settle_time / 1000. / n_rounds);
+    if (PHASE_CHANGE != i)
+    {
+      g_string_append_printf (json,
+                              ", \"median_ms\": %.1f, \"p95_ms\": %.1f"
+                              ", \"max_ms\": %.1f, \"unresolved\": %u",
+                              percentile_ms (phase->latencies, 0.5),
+                              percentile_ms (phase->latencies, 0.95),
+                              percentile_ms (phase->latencies, 1.0),
+                              phase->n_unresolved);
+    }
+    g_string_append (json, "}");
+  }
+
+  g_string_append (json, "}");
+  printf ("%s\n", json->str);
+  g_string_free (json, true);
+}
+
+int
+main (int     argc,
+      char  **argv)
+{
+  int                n_mounts = 200;
+  int                n_rounds = 3;
+  int                spread_ms = 0;
+  int                delay_ms = 10;
+  GOptionEntry       entries[] = {
+    { "mounts", 'n', 0, G_OPTION_ARG_INT, &n_mounts,
+      "Number of mounts per storm", "N" },
+    { "rounds", 'r', 0, G_OPTION_ARG_INT, &n_rounds,
+      "Number of add, change and remove storms", "N" },
+    { "spread", 's', 0, G_OPTION_ARG_INT, &spread_ms,
+      "Spread each storm over this many milliseconds", "MS" },
+    { "delay", 'd', 0, G_OPTION_ARG_INT, &delay_ms,
+      "Time mounts take to guess their content type and eject", "MS" },
+    { NULL }
+  };
+  GOptionContext    *context;
+  Benchmark          bench = { 0, };
+  ClutterActor      *stage;
+  ClutterActor      *tile;
+  char              *base;
+  char              *cache;
+  GError            *error = NULL;
+
+  context = g_option_context_new ("- Hotplug storm benchmark");
+  g_option_context_add_main_entries (context, entries, NULL);
+  g_option_context_add_group (context, clutter_get_option_group_without_init ());
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+  {
+    g_critical ("%s : %s", G_STRLOC, error->message);
+    g_clear_error (&error);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free (context);
+
+  if (n_mounts <= 0 || n_rounds <= 0 || spread_ms < 0 || delay_ms < 0)
+  {
+    g_critical ("%s : Invalid arguments", G_STRLOC);
+    return EXIT_FAILURE;
+  }
+
+  /* Media indices of the fake devices don't go to the home directory,
+   * this has to happen before GLib looks it up. */
+  base = g_build_filename (g_get_tmp_dir (), "mpd-benchmark-XXXXXX", NULL);
+  if (NULL == mkdtemp (base))
+  {
+    g_critical ("%s : Could not create %s", G_STRLOC, base);
+    return EXIT_FAILURE;
+  }
+  cache = g_build_filename (base, "cache", NULL);
+  g_mkdir (cache, 0700);
+  g_setenv ("XDG_CACHE_HOME", cache, true);
+
+  clutter_init (&argc, &argv);
+  /* Just for icon theme, no widgets. */
+  gtk_init (&argc, &argv);
+
+  bench.loop = g_main_loop_new (NULL, false);
+  bench.monitor = mpd_fake_volume_monitor_new ();
+  bench.mounts = g_ptr_array_new ();
+  bench.pending = g_array_new (false, false, sizeof (int64_t));
+  bench.n_mounts = n_mounts;
+  bench.spread_ms = spread_ms;
+  bench.delay_ms = delay_ms;
+  for (unsigned int i = 0; i < PHASE_LAST; i++)
+    bench.phases[i].latencies = g_array_new (false, false, sizeof (int64_t));
+
+  stage = clutter_stage_get_default ();
+  tile = g_object_new (MPD_TYPE_DEVICES_TILE,
+                       "volume-monitor", bench.monitor,
+                       NULL);
+  clutter_actor_set_size (tile, 480.0, 600.0);
+  clutter_container_add_actor (CLUTTER_CONTAINER (stage), tile);
+  g_signal_connect (tile, "queue-relayout",
+                    G_CALLBACK (_queue_relayout_cb), &bench);
+  clutter_actor_show_all (stage);
+
+  for (int i = 0; i < n_rounds; i++)
+  {
+    run_phase (&bench, PHASE_ADD);
+    run_phase (&bench, PHASE_CHANGE);
+    run_phase (&bench, PHASE_REMOVE);
+  }
+
+  print_json (&bench, n_rounds);
+
+  clutter_actor_destroy (tile);
+  g_object_unref (bench.monitor);
+  for (unsigned int i = 0; i < PHASE_LAST; i++)
+    g_array_free (bench.phases[i].latencies, true);
+  g_array_free (bench.pending, true);
+  g_ptr_array_free (bench.mounts, true);
+  g_main_loop_unref (bench.loop);
+
+  remove_tree (base);
+  g_free (cache);
+  g_free (base);
+
+  return EXIT_SUCCESS;
+}
+
@@ -0,0 +1,516 @@
+
+/*
+ * Copyright (c) 2011 Intel Corp.
+ *
+ * Author: Robert Staudinger <robert.staudinger@intel.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Synthetic card benchmark. Generates a camera-like tree in a temporary
+ * directory and times scanning, the first has-media answer and an import
+ * into the same directory, printing one line of JSON per run:
+ *
+ *   for n in 10000 50000 100000; do test-media-benchmark -n $n; done
+ *
+ * One layout per process so peak RSS is that of the run. Syscall counts
+ * are the read and write class calls from /proc/self/io.
+ *
+ * The tree has DCIM folders of 999 files each with names repeating across
+ * folders, a deeply nested branch, and non-media files next to the media.
+ * Caches and import targets are redirected into the temporary directory,
+ * thumbnails are off unless asked for since they go to the home directory.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <glib/gstdio.h>
+#include "mpd-import-stats.h"
+#include "mpd-media-scanner.h"
+#include "mpd-storage-device.h"
+
+#define FILES_PER_DIR       999
+#define FILES_PER_LEVEL     10
+#define JUNK_FILE_SIZE      512
+
+typedef struct
+{
+  int64_t   time;
+  uint64_t  read_syscalls;
+  uint64_t  write_syscalls;
+  long      minor_faults;
+} Sample;
+
+typedef struct
+{
+  GMainLoop     *loop;
+  GString       *json;
+  Sample         start;
+  unsigned int   n_media;
+  unsigned int   n_junk;
+  unsigned int   n_dirs;
+  uint64_t       media_size;
+  bool           failed;
+} Benchmark;
+
+static uint64_t
+read_proc_io (char const *contents,
+              char const *key)
+{
+  char const *p = strstr (contents, key);
+
+  return p ? g_ascii_strtoull (p + strlen (key), NULL, 10) : 0;
+}
+
+static void
+sample_take (Sample *sample)
+{
+  struct rusage  usage;
+  char          *contents = NULL;
+
+  sample->time = mpd_import_stats_get_time ();
+
+  if (g_file_get_contents ("/proc/self/io", &contents, NULL, NULL))
+  {
+    sample->read_syscalls = read_proc_io (contents, "syscr: ");
+    sample->write_syscalls = read_proc_io (contents, "syscw: ");
+    g_free (contents);
+  }
+
+  getrusage (RUSAGE_SELF, &usage);
+  sample->minor_faults = usage.ru_minflt;
+}
+
+static void
+phase_start (Benchmark *bench)
+{
+  sample_take (&bench->start);
+}
+
+static double
+phase_end (Benchmark  *bench,
+           char const *name)
+{
+  Sample  end;
+  double  ms;
+
+  sample_take (&end);
+  ms = (end.time - bench->start.time) / 1000.;
+
+  g_string_append_printf (bench->json,
+                          ", \"%s\": {\"ms\": %.1f, "
+                          "\"read_syscalls\": %" G_GUINT64_FORMAT ", "
+                          "\"write_syscalls\": %" G_GUINT64_FORMAT ", "
+                          "\"minor_faults\": %ld",
+                          name, ms,
+                          end.read_syscalls - bench->start.read_syscalls,
+                          end.write_syscalls - bench->start.write_syscalls,
+                          end.minor_faults - bench->start.minor_faults);
+  return ms;
+}
+
+static bool
+write_file (char const  *path,
+            char        *buf,
+            size_t       size,
+            uint32_t     salt,
+            unsigned int index)
+{
+  FILE *fp;
+  bool  ret;
+
+  /* Distinct head and tail, so files aren't taken for copies of each
+   * other by the importer. */
+  if (size >= 16)
+  {
+    memcpy (buf + 4, &salt, sizeof (salt));
+    memcpy (buf + 8, &index, sizeof (index));
+    memcpy (buf + size - 8, &index, sizeof (index));
+  }
+
+  fp = g_fopen (path, "wb");
+  if (NULL == fp)
+  {
+    g_warning ("%s : Could not create %s", G_STRLOC, path);
+    return false;
+  }
+
+  ret = fwrite (buf, 1, size, fp) == size;
+  ret = 0 == fclose (fp) && ret;
+  return ret;
+}
+
+static char *
+make_dir (Benchmark   *bench,
+          char const  *parent,
+          char const  *name)
+{
+  char *path = g_build_filename (parent, name, NULL);
+
+  if (g_mkdir (path, 0755) < 0)
+    g_warning ("%s : Could not create %s", G_STRLOC, path);
+  bench->n_dirs++;
+  return path;
+}
+
+static bool
+generate (Benchmark    *bench,
+          char const   *root,
+          unsigned int  n_files,
+          unsigned int  file_size,
+          unsigned int  depth,
+          unsigned int  junk)
+{
+  char          *buf;
+  char          *dcim;
+  char          *misc;
+  char          *path;
+  char          *dir = NULL;
+  uint32_t       salt = g_random_int ();
+  unsigned int   index = 0;
+  unsigned int   i;
+  unsigned int   j;
+  bool           ret = true;
+
+  buf = g_malloc0 (MAX (file_size, JUNK_FILE_SIZE));
+  buf[0] = 0xff;
+  buf[1] = 0xd8;
+
+  dcim = make_dir (bench, root, "DCIM");
+  misc = make_dir (bench, root, "MISC");
+
+  /* Deep branch first, it takes FILES_PER_LEVEL per level off the total. */
+  dir = g_strdup (dcim);
+  for (i = 0; i < depth && index + FILES_PER_LEVEL <= n_files; i++)
+  {
+    char *name = g_strdup_printf ("level%u", i);
+    char *child = make_dir (bench, dir, name);
+
+    g_free (name);
+    g_free (dir);
+    dir = child;
+
+    for (j = 0; j < FILES_PER_LEVEL && ret; j++, index++)
+    {
+      name = g_strdup_printf ("DSC_%04u.JPG", j);
+      path = g_build_filename (dir, name, NULL);
+      ret = write_file (path, buf, file_size, salt, index);
+      g_free (path);
+      g_free (name);
+    }
+  }
+  g_free (dir);
+  dir = NULL;
+
+  /* Camera folders, names repeat in each. */
+  for (i = 0; index < n_files && ret; i++)
+  {
+    char *name = g_strdup_printf ("%03uMEDIA", 100 + i);
+
+    dir = make_dir (bench, dcim, name);
+    g_free (name);
+
+    for (j = 1; j <= FILES_PER_DIR && index < n_files && ret; j++, index++)
+    {
+      name = g_strdup_printf (j % 20 ? "IMG_%04u.JPG" : "MVI_%04u.MOV", j);
+      path = g_build_filename (dir, name, NULL);
+      ret = write_file (path, buf, file_size, salt, index);
+      g_free (path);
+      g_free (name);
+    }
+
+    for (j = 0; j < junk && ret; j++)
+    {
+      name = g_strdup_printf ("IMG_%04u.%s", j + 1, j % 2 ? "THM" : "CTG");
+      path = g_build_filename (dir, name, NULL);
+      ret = write_file (path, buf, JUNK_FILE_SIZE, salt, j);
+      bench->n_junk++;
+      g_free (path);
+      g_free (name);
+    }
+
+    g_free (dir);
+    dir = NULL;
+  }
+
+  for (j = 0; j < junk && ret; j++)
+  {
+    char *name = g_strdup_printf ("NOTE%04u.TXT", j);
+    path = g_build_filename (misc, name, NULL);
+    ret = write_file (path, buf, JUNK_FILE_SIZE, salt, j);
+    bench->n_junk++;
+    g_free (path);
+    g_free (name);
+  }
+
+  bench->n_media = index;
+  bench->media_size = (uint64_t) index * file_size;
+
+  g_free (misc);
+  g_free (dcim);
+  g_free (buf);
+  return ret;
+}
+
+static void
+remove_tree (char const *path)
+{
+  GDir        *dir;
+  char const  *name;
+
+  dir = g_dir_open (path, 0, NULL);
+  if (dir)
+  {
+    while (NULL != (name = g_dir_read_name (dir)))
+    {
+      char *child = g_build_filename (path, name, NULL);
+      if (g_file_test (child, G_FILE_TEST_IS_DIR) &&
+          !g_file_test (child, G_FILE_TEST_IS_SYMLINK))
+        remove_tree (child);
+      else
+        g_unlink (child);
+      g_free (child);
+    }
+    g_dir_close (dir);
+  }
+
+  g_rmdir (path);
+}
+
+/*
+ * Caches and import targets go below `base', this has to happen before
+ * GLib looks them up.
+ */
+static void
+redirect_user_dirs (char const *base)
+{
+  char *cache = g_build_filename (base, "cache", NULL);
+  char *config = g_build_filename (base, "config", NULL);
+  char *target = g_build_filename (base, "import", NULL);
+  char *user_dirs = g_build_filename (config, "user-dirs.dirs", NULL);
+  char *contents;
+
+  g_mkdir_with_parents (cache, 0700);
+  g_mkdir_with_parents (config, 0700);
+  g_mkdir_with_parents (target, 0700);
+
+  contents = g_strdup_printf ("XDG_MUSIC_DIR=\"%s\"\n"
+                              "XDG_PICTURES_DIR=\"%s\"\n"
+                              "XDG_VIDEOS_DIR=\"%s\"\n",
+                              target, target, target);
+  g_file_set_contents (user_dirs, contents, -1, NULL);
+
+  g_setenv ("XDG_CACHE_HOME", cache, true);
+  g_setenv ("XDG_CONFIG_HOME", config, true);
+
+  g_free (contents);
+  g_free (user_dirs);
+  g_free (target);
+  g_free (config);
+  g_free (cache);
+}
+
+static void
+_scan_cb (MpdMediaScanner    *scanner,
+          MpdMediaScanResult *result,
+          Benchmark          *bench)
+{
+  phase_end (bench, "scan");
+  g_string_append_printf (bench->json, ", \"media_files\": %u}",
+                          result->files->len);
+  mpd_media_scan_result_free (result);
+  g_main_loop_quit (bench->loop);
+}
+
+static void
+_has_media_cb (MpdStorageDevice *storage,
+               bool              has_media,
+               Benchmark        *bench)
+{
+  phase_end (bench, "has_media");
+  g_string_append_printf (bench->json, ", \"result\": %s}",
+                          has_media ? "true" : "false");
+  g_signal_handlers_disconnect_by_func (storage, _has_media_cb, bench);
+  g_main_loop_quit (bench->loop);
+}
+
+static void
+_import_error_cb (MpdStorageDevice *storage,
+                  GError const     *error,
+                  Benchmark        *bench)
+{
+  g_warning ("%s : %s", G_STRLOC, error->message);
+  phase_end (bench, "import");
+  g_string_append (bench->json, ", \"failed\": true}");
+  bench->failed = true;
+  g_main_loop_quit (bench->loop);
+}
+
+static void
+_import_finished_cb (MpdStorageDevice *storage,
+                     Benchmark        *bench)
+{
+  uint64_t  imported;
+  double    ms;
+
+  ms = phase_end (bench, "import");
+  imported = bench->media_size -
+             mpd_storage_device_get_import_skipped_size (storage);
+  g_string_append_printf (bench->json,
+                          ", \"mb_s\": %.2f"
+                          ", \"skipped_bytes\": %" G_GUINT64_FORMAT "}",
+                          ms > 0 ? imported / (ms * 1000.) : 0.,
+                          bench->media_size - imported);
+  g_main_loop_quit (bench->loop);
+}
+
+int
+main (int     argc,
+      char  **argv)
+{
+  int                n_files = 10000;
+  int                file_size = 16 * 1024;
+  int                depth = 12;
+  int                junk = 50;
+  gboolean           no_import = false;
+  gboolean           thumbnails = false;
+  gboolean           keep = false;
+  GOptionEntry       entries[] = {
+    { "files", 'n', 0, G_OPTION_ARG_INT, &n_files,
+      "Number of media files", "N" },
+    { "file-size", 's', 0, G_OPTION_ARG_INT, &file_size,
+      "Size of each media file in bytes", "BYTES" },
+    { "depth", 'd', 0, G_OPTION_ARG_INT, &depth,
+      "Nesting depth of the deep branch", "N" },
+    { "junk", 'j', 0, G_OPTION_ARG_INT, &junk,
+      "Non-media files per directory", "N" },
+    { "no-import", 0, 0, G_OPTION_ARG_NONE, &no_import,
+      "Only scan and look for media", NULL },
+    { "thumbnails", 0, 0, G_OPTION_ARG_NONE, &thumbnails,
+      "Create thumbnails when importing", NULL },
+    { "keep", 'k', 0, G_OPTION_ARG_NONE, &keep,
+      "Keep the generated tree", NULL },
+    { NULL }
+  };
+  GOptionContext    *context;
+  Benchmark          bench = { 0, };
+  MpdMediaScanner   *scanner;
+  MpdStorageDevice  *storage;
+  char              *base;
+  char              *root;
+  struct rusage      usage;
+  GError            *error = NULL;
+
+  if (!g_thread_supported ())
+    g_thread_init (NULL);
+  g_type_init ();
+
+  context = g_option_context_new ("- Synthetic card benchmark");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+  {
+    g_critical ("%s : %s", G_STRLOC, error->message);
+    g_clear_error (&error);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free (context);
+
+  if (n_files <= 0 || file_size < 0 || depth < 0 || junk < 0)
+  {
+    g_critical ("%s : Invalid arguments", G_STRLOC);
+    return EXIT_FAILURE;
+  }
+
+  base = g_build_filename (g_get_tmp_dir (), "mpd-benchmark-XXXXXX", NULL);
+  if (NULL == mkdtemp (base))
+  {
+    g_critical ("%s : Could not create %s", G_STRLOC, base);
+    return EXIT_FAILURE;
+  }
+  redirect_user_dirs (base);
+  root = g_build_filename (base, "card", NULL);
+  g_mkdir (root, 0755);
+
+  bench.loop = g_main_loop_new (NULL, false);
+  bench.json = g_string_new (NULL);
+
+  phase_start (&bench);
+  if (!generate (&bench, root, n_files, file_size, depth, junk))
+    bench.failed = true;
+  phase_end (&bench, "generate");
+  g_string_append (bench.json, "}");
+
+  if (!bench.failed)
+  {
+    scanner = mpd_media_scanner_new (root);
+    phase_start (&bench);
+    mpd_media_scanner_start (scanner,
+                             (MpdMediaScannerCallback) _scan_cb, &bench);
+    g_main_loop_run (bench.loop);
+    mpd_media_scanner_free (scanner);
+
+    storage = mpd_storage_device_new (root);
+    mpd_storage_device_set_import_thumbnails (storage, thumbnails);
+    g_signal_connect (storage, "has-media",
+                      G_CALLBACK (_has_media_cb), &bench);
+    phase_start (&bench);
+    mpd_storage_device_has_media_async (storage);
+    g_main_loop_run (bench.loop);
+
+    if (!no_import)
+    {
+      g_signal_connect (storage, "import-error",
+                        G_CALLBACK (_import_error_cb), &bench);
+      g_signal_connect (storage, "import-finished",
+                        G_CALLBACK (_import_finished_cb), &bench);
+      phase_start (&bench);
+      if (mpd_storage_device_import_async (storage, &error))
+      {
+        g_main_loop_run (bench.loop);
+      } else {
+        g_warning ("%s : %s", G_STRLOC, error->message);
+        g_clear_error (&error);
+        bench.failed = true;
+      }
+    }
+
+    g_object_unref (storage);
+  }
+
+  getrusage (RUSAGE_SELF, &usage);
+  g_print ("{\"files\": %u, \"junk_files\": %u, \"dirs\": %u, "
+           "\"file_size\": %d, \"depth\": %d%s, "
+           "\"peak_rss_kib\": %ld, \"failed\": %s}\n",
+           bench.n_media, bench.n_junk, bench.n_dirs,
+           file_size, depth, bench.json->str,
+           usage.ru_maxrss, bench.failed ? "true" : "false");
+
+  if (keep)
+    g_message ("Kept %s", base);
+  else
+    remove_tree (base);
+
+  g_string_free (bench.json, true);
+  g_main_loop_unref (bench.loop);
+  g_free (root);
+  g_free (base);
+
+  return bench.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+